@@ -0,0 +1,14 @@
+#version 330
+
+// Bounding box of an occlusion query, stretched from the unit cube
+uniform mat4 modelViewProjectionMatrix;
+uniform vec3 boxMin;
+uniform vec3 boxSize;
+
+layout(location = 0) in vec3 position;
+out vec3 vertexNormal;      // Not shaded, the query draws with color writes off
+
+void main(void) {
+    vertexNormal = vec3(0, 0, 1);
+    gl_Position = modelViewProjectionMatrix * vec4(boxMin + position * boxSize, 1);
+}
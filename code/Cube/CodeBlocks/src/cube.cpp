@@ -6,52 +6,263 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <math.h>
+#include <string.h>
+#include <stdlib.h>
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <stddef.h>
 using namespace std;
 
 #include <glutil/MatrixStack.h>
 using glutil::MatrixStack; // We shall be using a custom matrix stack implementation
+#include <glm/gtc/half_float.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
 
 #include "shader_util.h"
+#include "nbody_util.h"
+#include "timer_util.h"
+#include "headless.h"
+#include "deferred.h"
+#include "rasterizer.h"
+#include "scene.h"
+#include "stream_buffer.h"
+#include "frame_pipeline.h"
+#include "occlusion.h"
+#include "gpu_culling.h"
 #define GLUT_KEY_ESCAPE 27
 #define GLUT_KEY_ENTER 13
 
 // --------------- Forward declarations ------------- //
 int main(int argc, char* argv[]);
+int int_argument(int argc, char* argv[], int index, int defaultValue, int minimum = 1);
+float float_argument(int argc, char* argv[], int index, float defaultValue);
 void display();
 void idle();
 void prepare_vertex_data();
+void prepare_indexed_vertex_data(bool compact);
+void draw_geometry(int instances);
 void draw_cube(float t);
+void draw_cube_uniforms(float t);
+void draw_cube_block(float t);
+void set_frame_uniforms(const glm::mat4 &modelViewProjection, const glm::mat4 &modelView);
+void prepare_particles(int count);
+void draw_particles(float t);
+void compile_variant(shader_prog &program, bool instanced, const char *defines = "");
+void set_normal_uniforms(shader_prog &program, const glm::mat4 &modelView);
+void generate_instances(int count);
+void prepare_instances(int count);
+void upload_instances(GLenum usage);
+void point_instances(GLuint matrices, GLuint normals, int first);
+void free_instances();
+void set_camera(MatrixStack &mvp, MatrixStack &mv, float t);
+void draw_instances(float t);
+void draw_cubes_one_by_one(float t);
+float frame_time(void (*draw)(float));
+void instancing_benchmark(int maxCount);
+void vertex_format_benchmark(int count);
+void frame_benchmark(int frames, int cubes);
+void normal_matrix_benchmark(int count);
+void prepare_lights(int lightCount, int cubes);
+void free_lights();
+void draw_forward(float t);
+void draw_deferred(float t);
+double gpu_frame_time(void (*draw)(float), int frames);
+void lighting_benchmark(int cubes);
+void software_render(int frames, int cubes);
+void generate_field(int count);
+void prepare_scene(int count);
+void set_field_camera(MatrixStack &mvp, MatrixStack &mv, float t);
+void draw_culled(float t);
+void culling_benchmark(int count);
+void stream_benchmark(int frames);
+void prepare_pipeline(int cubes, int threads);
+void free_pipeline();
+void pipeline_camera(glm::mat4 &viewProjection, glm::mat4 &view, float t);
+void set_instance_attributes(long offset);
+void draw_pipelined(float t);
+void pipeline_benchmark(int cubes);
+void prepare_city(int count, bool occlusion, float lodDistance);
+void free_city();
+glm::vec3 set_city_camera(MatrixStack &mvp, MatrixStack &mv, float t);
+void draw_city(float t);
+void city_benchmark(int count);
+bool prepare_gpu_scene(int count);
+void free_gpu_scene();
+void draw_gpu_culled(float t);
+void measure_frames(void (*draw)(float), int frames, double &submitMs, double &frameMs, double &gpuMs);
+void gpu_culling_benchmark(int maxCount);
+void shader_cache_benchmark();
+void shader_compile_benchmark();
 void calculate_fps();
 
 // --------------------- Shader --------------------- //
 shader_prog shader("../src/cube.vert.glsl", "../src/cube.frag.glsl");
+shader_prog frameShader("../src/cube.vert.glsl", "../src/cube.frag.glsl");
+shader_prog instancedShader("../src/cube.vert.glsl", "../src/cube.frag.glsl");
+shader_prog forwardShader("../src/cube.vert.glsl", "../src/cube.frag.glsl");
+shader_prog gbufferShader("../src/cube.vert.glsl", "../src/gbuffer.frag.glsl");
+shader_prog particleShader("../src/particles.vert.glsl", "../src/particles.frag.glsl");
 
 // -------------------- Variables ------------------- //
 GLuint cubeVertexArrayHandle;
 GLuint cubeArrayBufferHandle;
+GLuint cubeElementBufferHandle = 0;
+int cubeIndexCount = 0;     // 0 when the cube is drawn from unindexed vertices
+int cubeVertexBytes = 6*sizeof(float);
 int frameCount = 0;
 float fps = 0;
 int currentTime = 0;
 int previousTime = 0;
+NBody *nbody = NULL;        // Set when running with the "nbody [count]" argument
+GLuint instanceBufferHandle = 0;
+GLuint instanceNormalBufferHandle = 0;
+int instanceCount = 0;      // Number of cubes in the instanced mode, 0 draws a single cube
+vector<glm::mat4> instanceMatrices;
+vector<glm::mat3> instanceNormalMatrices;
+bool perVertexNormals = false;  // Shader variant that inverts the model view matrix for every vertex
+LightSet *lights = NULL;    // Set in the "forward" and "deferred" modes
+bool deferredShading = false;
+GBuffer *gbuffer = NULL;
+LightTiles *lightTiles = NULL;
+shader_prog *lightingShader = NULL;
+double cullTime = 0;        // Milliseconds spent in tiled light culling by the last deferred frame
+Scene *scene = NULL;        // Set in the "culled" mode
+int visibleCount = 0;       // Instances drawn by the last culled frame
+double frustumCullTime = 0; // Milliseconds spent in frustum culling by the last culled frame
+StreamBuffer *frameStream = NULL;   // Uniform block of draw_cube, one region per frame in flight
+uniform_block *frameBlock = NULL;   // The same block laid out by introspection, for draw_cube_block
+FramePipeline *pipeline = NULL;     // Set in the "pipelined" mode
+StreamBuffer *instanceStream = NULL;    // Instances of the pipelined frames
+City *city = NULL;          // Set in the "city" mode
+int cityCubes = 0;          // Cubes drawn by the last city frame without a condition
+GPUScene *gpuScene = NULL;  // Set in the "gpu-culled" mode
 
+// Shader variants of all the modes: vertex shader, fragment shader and the defines of both
+const char *shaderVariants[][3] = {
+    {"../src/cube.vert.glsl", "../src/cube.frag.glsl", ""},
+    {"../src/cube.vert.glsl", "../src/cube.frag.glsl", "#define INSTANCED\n"},
+    {"../src/cube.vert.glsl", "../src/cube.frag.glsl", "#define PER_VERTEX_NORMAL_MATRIX\n"},
+    {"../src/cube.vert.glsl", "../src/cube.frag.glsl", "#define INSTANCED\n#define PER_VERTEX_NORMAL_MATRIX\n"},
+    {"../src/cube.vert.glsl", "../src/cube.frag.glsl", "#define FRAME_BLOCK\n"},
+    {"../src/cube.vert.glsl", "../src/gbuffer.frag.glsl", "#define INSTANCED\n"},
+    {"../src/particles.vert.glsl", "../src/particles.frag.glsl", ""},
+    {"../src/box.vert.glsl", "../src/cube.frag.glsl", ""},
+    {"../src/impostor.vert.glsl", "../src/cube.frag.glsl", ""},
+};
+
+// Uniform block "Frame" of cube.vert.glsl in the std140 layout
+typedef struct FrameUniforms {
+    glm::mat4 modelViewProjectionMatrix;
+    glm::mat4 modelViewMatrix;
+    glm::vec4 normalMatrix[3];      // std140 pads every column of a mat3 to a vec4
+} FrameUniforms;
+
+// Unindexed cube: 36 vertices of position and normal, drawn by OpenGL and by the software rasterizer
+const float cubeVertexData[] = {
+
+    // left
+    0, 0, 0,   -1, 0, 0,
+    0, 1, 0,   -1, 0, 0,
+    0, 1, 1,   -1, 0, 0,
+    0, 1, 1,   -1, 0, 0,
+    0, 0, 1,   -1, 0, 0,
+    0, 0, 0,   -1, 0, 0,
+
+    // right
+    1, 0, 0,   1, 0, 0,
+    1, 0, 1,   1, 0, 0,
+    1, 1, 1,   1, 0, 0,
+    1, 1, 1,   1, 0, 0,
+    1, 1, 0,   1, 0, 0,
+    1, 0, 0,   1, 0, 0,
+
+    // top
+    0, 1, 0,   0, 1, 0,
+    0, 1, 1,   0, 1, 0,
+    1, 1, 1,   0, 1, 0,
+    1, 1, 1,   0, 1, 0,
+    1, 1, 0,   0, 1, 0,
+    0, 1, 0,   0, 1, 0,
+
+    // bottom
+    0, 0, 0,   0, -1, 0,
+    0, 0, 1,   0, -1, 0,
+    1, 0, 1,   0, -1, 0,
+    1, 0, 1,   0, -1, 0,
+    1, 0, 0,   0, -1, 0,
+    0, 0, 0,   0, -1, 0,
+
+    // front
+    0, 0, 1,   0, 0, 1,
+    0, 1, 1,   0, 0, 1,
+    1, 1, 1,   0, 0, 1,
+    1, 1, 1,   0, 0, 1,
+    1, 0, 1,   0, 0, 1,
+    0, 0, 1,   0, 0, 1,
+
+    // back
+    0, 0, 0,   0, 0, -1,
+    0, 1, 0,   0, 0, -1,
+    1, 1, 0,   0, 0, -1,
+    1, 1, 0,   0, 0, -1,
+    1, 0, 0,   0, 0, -1,
+    0, 0, 0,   0, 0, -1,
+
+};
+
+
+/**
+ * Number in argv[index], or defaultValue if there is no such argument, it is below minimum or
+ * it is not a number (e.g. an option such as "--compact" given right after the mode)
+ */
+int int_argument(int argc, char* argv[], int index, int defaultValue, int minimum) {
+    if (index >= argc) return defaultValue;
+    char *end;
+    long value = strtol(argv[index], &end, 10);
+    return end == argv[index] || *end != '\0' || value < minimum ? defaultValue : (int)value;
+}
+
+// The same for a positive float
+float float_argument(int argc, char* argv[], int index, float defaultValue) {
+    if (index >= argc) return defaultValue;
+    char *end;
+    float value = strtof(argv[index], &end);
+    return end == argv[index] || *end != '\0' || !(value > 0) ? defaultValue : value;
+}
+
 
 /**
  * Program entry point
  */
 int main(int argc, char* argv[]) {
 
-    // Initialize GLUT and GLEW
-    glutInit(&argc, argv);
+    // Render the scene on the CPU with 1, 2, 4... threads. Needs no OpenGL at all.
+    if (argc > 1 && strcmp(argv[1], "software") == 0) {
+        software_render(int_argument(argc, argv, 2, 20), int_argument(argc, argv, 3, 1000));
+        return 0;
+    }
+
+    // The frame time benchmark renders offscreen, so it does not need a window if we can get
+    // a headless context (see headless.h). Otherwise it runs in a GLUT window like the rest.
+    bool headless = argc > 1 && strcmp(argv[1], "frame-benchmark") == 0 && createHeadlessContext();
+
+    if (!headless) {
+        // Initialize GLUT and GLEW
+        glutInit(&argc, argv);
 
-    // The two lines below will tell GLUT to set the context up so that
-    // we will not be able to use any of the old functions
-    glutInitContextVersion(3, 3);
-    glutInitContextProfile(GLUT_CORE_PROFILE);
+        // The two lines below will tell GLUT to set the context up so that
+        // we will not be able to use any of the old functions.
+        // Culling in compute shaders needs OpenGL 4.3, the rest runs on 3.3.
+        bool gpuDriven = argc > 1 && (strcmp(argv[1], "gpu-culled") == 0 || strcmp(argv[1], "gpu-culling-benchmark") == 0);
+        glutInitContextVersion(gpuDriven ? 4 : 3, 3);
+        glutInitContextProfile(GLUT_CORE_PROFILE);
 
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
-    glutInitWindowSize(800, 800);
-    glutCreateWindow("Cube");
+        glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+        glutInitWindowSize(800, 800);
+        glutCreateWindow("Cube");
+    }
 
     // Initialize GLEW.
     glewExperimental = true; // This is a hack. Without it the current GLEW version fails to load
@@ -62,29 +273,179 @@ int main(int argc, char* argv[]) {
     }
 
     // Register handlers
-    glutDisplayFunc(display);
-    glutIdleFunc(idle);
+    if (!headless) {
+        glutDisplayFunc(display);
+        glutIdleFunc(idle);
+    }
 
     // Configuration
     glClearColor(0, 0, 0, 0);
 
+    // Shader variant option: "--per-vertex-normals" computes the normal matrix in the vertex shader
+    // for every vertex, instead of once per frame (and once per instance) on the CPU.
+    // "--no-persistent" streams the uniform block with glMapBufferRange even if persistent mapping is available.
+    // "--no-shader-cache" compiles every program from source instead of loading the binaries in shader_cache.
+    bool persistentMapping = true, shaderCache = true;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--per-vertex-normals") == 0) perVertexNormals = true;
+        if (strcmp(argv[i], "--no-persistent") == 0) persistentMapping = false;
+        if (strcmp(argv[i], "--no-shader-cache") == 0) shaderCache = false;
+    }
+    if (shaderCache) set_program_cache("shader_cache");
+
+    // Time to build the shader variants from source, into an empty cache and from a full one
+    if (argc > 1 && strcmp(argv[1], "shader-cache-benchmark") == 0) {
+        shader_cache_benchmark();
+        return 0;
+    }
+
     // We *must* use a shader in a OpenGL 3.2+ core profile
-    shader.use();
+    compile_variant(shader, false);
 
     // We must specify the name of the "output" variable of our
     // fragment shader. gl_FragColor does not work any more.
     // The good thing - you can output to several channels in parallel.
     glBindFragDataLocation(shader, 0, "fragColor");
 
+    // The single cube reads its matrices from a uniform block instead, bound to binding point 0
+    compile_variant(frameShader, false, "#define FRAME_BLOCK\n");
+    frameShader.bind_uniform_block("Frame", 0);
+    frameStream = initStreamBuffer(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), persistentMapping);
+
     // Next, we prepare the vertex data
     prepare_vertex_data();
 
+    // Geometry options for all the modes below, given after the other arguments, e.g. "instanced 10000 --compact":
+    // "--indexed" shares the corners of a face through an element buffer,
+    // "--compact" additionally packs the vertices into 12 bytes instead of 24
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--indexed") == 0) prepare_indexed_vertex_data(false);
+        if (strcmp(argv[i], "--compact") == 0) prepare_indexed_vertex_data(true);
+    }
+
+    // Instead of the cube, draw an N-body simulation that never leaves the GPU
+    if (argc > 1 && strcmp(argv[1], "nbody") == 0) {
+        prepare_particles(int_argument(argc, argv, 2, 4096));
+    }
+
+    // Many cubes with a single draw call
+    if (argc > 1 && strcmp(argv[1], "instanced") == 0) {
+        prepare_instances(int_argument(argc, argv, 2, 10000));
+    }
+
+    // A field of cubes seen from the inside, only the ones in the view frustum are drawn
+    if (argc > 1 && strcmp(argv[1], "culled") == 0) {
+        prepare_scene(int_argument(argc, argv, 2, 1 << 20));
+    }
+
+    // A street between tall buildings, drawing only what the queries of the last frame saw
+    if (argc > 1 && strcmp(argv[1], "city") == 0) {
+        prepare_city(int_argument(argc, argv, 2, 1 << 20), true, float_argument(argc, argv, 3, 150));
+    }
+
+    // The field of the "culled" mode, culled by a compute shader and drawn with one indirect call
+    if (argc > 1 && strcmp(argv[1], "gpu-culled") == 0) {
+        if (!prepare_gpu_scene(int_argument(argc, argv, 2, 1 << 20))) return 1;
+    }
+
+    // Cubes animated and culled on worker threads, a frame ahead of the drawing
+    if (argc > 1 && strcmp(argv[1], "pipelined") == 0) {
+        int threads = int_argument(argc, argv, 3, (int)std::thread::hardware_concurrency());
+        prepare_pipeline(int_argument(argc, argv, 2, 100000), std::max(threads, 1));
+    }
+
+    // Many cubes lit by point lights, with forward or deferred shading
+    if (argc > 1 && (strcmp(argv[1], "forward") == 0 || strcmp(argv[1], "deferred") == 0)) {
+        deferredShading = strcmp(argv[1], "deferred") == 0;
+        prepare_lights(int_argument(argc, argv, 2, 256), int_argument(argc, argv, 3, 4096));
+    }
+
+    // Forward vs deferred shading from 1 to 1024 lights
+    if (argc > 1 && strcmp(argv[1], "lighting-benchmark") == 0) {
+        lighting_benchmark(int_argument(argc, argv, 2, 4096));
+        return 0;
+    }
+
+    // Frame time of one draw call per cube vs instancing, from 1 to maxCount cubes
+    if (argc > 1 && strcmp(argv[1], "instancing-benchmark") == 0) {
+        instancing_benchmark(int_argument(argc, argv, 2, 1 << 20));
+        return 0;
+    }
+
+    // Frustum culling time with and without the BVH over a field of count cubes
+    if (argc > 1 && strcmp(argv[1], "culling-benchmark") == 0) {
+        culling_benchmark(int_argument(argc, argv, 2, 1 << 20));
+        return 0;
+    }
+
+    // CPU time and stalls of glUniform calls vs the streamed uniform block, over frames frames
+    if (argc > 1 && strcmp(argv[1], "stream-benchmark") == 0) {
+        stream_benchmark(int_argument(argc, argv, 2, 10000));
+        return 0;
+    }
+
+    // Time to the first frame and until all shader variants are built, sequentially and in parallel
+    if (argc > 1 && strcmp(argv[1], "shader-compile-benchmark") == 0) {
+        shader_compile_benchmark();
+        return 0;
+    }
+
+    // Frame time of the pipelined mode with 1, 2, 4... building threads
+    if (argc > 1 && strcmp(argv[1], "pipeline-benchmark") == 0) {
+        pipeline_benchmark(int_argument(argc, argv, 2, 100000));
+        return 0;
+    }
+
+    // Frame time of the city with frustum culling only, occlusion queries, and impostors in the distance
+    if (argc > 1 && strcmp(argv[1], "occlusion-benchmark") == 0) {
+        city_benchmark(int_argument(argc, argv, 2, 1 << 20));
+        return 0;
+    }
+
+    // CPU culling with instanced drawing vs GPU culling with indirect drawing, up to maxCount cubes
+    if (argc > 1 && strcmp(argv[1], "gpu-culling-benchmark") == 0) {
+        gpu_culling_benchmark(int_argument(argc, argv, 2, 1 << 20));
+        return 0;
+    }
+
+    // Vertex fetch bandwidth of the different vertex formats with count instanced cubes
+    if (argc > 1 && strcmp(argv[1], "vertex-format-benchmark") == 0) {
+        vertex_format_benchmark(int_argument(argc, argv, 2, 1 << 18));
+        return 0;
+    }
+
+    // Vertex throughput with the normal matrix computed per vertex vs once on the CPU
+    if (argc > 1 && strcmp(argv[1], "normal-matrix-benchmark") == 0) {
+        normal_matrix_benchmark(int_argument(argc, argv, 2, 1 << 18));
+        return 0;
+    }
+
+    // Per-frame CPU, GPU and wall clock times of frames frames with cubes instanced cubes
+    // (0 draws the single cube), written to frame_times.csv and frame_times.json
+    if (argc > 1 && strcmp(argv[1], "frame-benchmark") == 0) {
+        frame_benchmark(int_argument(argc, argv, 2, 1000), int_argument(argc, argv, 3, 0, 0));
+        if (headless) destroyHeadlessContext();
+        return 0;
+    }
+
     // Run the event loop
     glutMainLoop();
 
     // Finally, be polite and clean up the objects from GPU memory
     glDeleteVertexArrays(1, &cubeVertexArrayHandle);
     glDeleteBuffers(1, &cubeArrayBufferHandle);
+    if (cubeElementBufferHandle) glDeleteBuffers(1, &cubeElementBufferHandle);
+    if (lights) free_lights();
+    if (instanceBufferHandle) free_instances();
+    if (scene) freeScene(scene);
+    if (pipeline) free_pipeline();
+    if (city) free_city();
+    if (gpuScene) free_gpu_scene();
+    freeStreamBuffer(frameStream);
+    if (nbody) {
+        freeNBody(nbody);
+        particleShader.free();
+    }
 
     return 0;
 }
@@ -153,58 +514,6 @@ void prepare_vertex_data() {
     // (this makes it the "current buffer"). Whatever you will then make with this
     // current buffer
 
-    const float cubeVertexData[] = {
-
-        // left
-        0, 0, 0,   -1, 0, 0,
-        0, 1, 0,   -1, 0, 0,
-        0, 1, 1,   -1, 0, 0,
-        0, 1, 1,   -1, 0, 0,
-        0, 0, 1,   -1, 0, 0,
-        0, 0, 0,   -1, 0, 0,
-
-        // right
-        1, 0, 0,   1, 0, 0,
-        1, 0, 1,   1, 0, 0,
-        1, 1, 1,   1, 0, 0,
-        1, 1, 1,   1, 0, 0,
-        1, 1, 0,   1, 0, 0,
-        1, 0, 0,   1, 0, 0,
-
-        // top
-        0, 1, 0,   0, 1, 0,
-        0, 1, 1,   0, 1, 0,
-        1, 1, 1,   0, 1, 0,
-        1, 1, 1,   0, 1, 0,
-        1, 1, 0,   0, 1, 0,
-        0, 1, 0,   0, 1, 0,
-
-        // bottom
-        0, 0, 0,   0, -1, 0,
-        0, 0, 1,   0, -1, 0,
-        1, 0, 1,   0, -1, 0,
-        1, 0, 1,   0, -1, 0,
-        1, 0, 0,   0, -1, 0,
-        0, 0, 0,   0, -1, 0,
-
-        // front
-        0, 0, 1,   0, 0, 1,
-        0, 1, 1,   0, 0, 1,
-        1, 1, 1,   0, 0, 1,
-        1, 1, 1,   0, 0, 1,
-        1, 0, 1,   0, 0, 1,
-        0, 0, 1,   0, 0, 1,
-
-        // back
-        0, 0, 0,   0, 0, -1,
-        0, 1, 0,   0, 0, -1,
-        1, 1, 0,   0, 0, -1,
-        1, 1, 0,   0, 0, -1,
-        1, 0, 0,   0, 0, -1,
-        0, 0, 0,   0, 0, -1,
-
-    };
-
     glBindBuffer(GL_ARRAY_BUFFER, cubeArrayBufferHandle);
     glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertexData), cubeVertexData, GL_STATIC_DRAW);
 
@@ -245,13 +554,113 @@ void prepare_vertex_data() {
 }
 
 
+/**
+ * Packs a unit vector into the signed 10-10-10-2 format of GL_INT_2_10_10_10_REV:
+ * x in the lowest 10 bits, then y, z and the 2-bit w.
+ * (glm::uint10_10_10_2_cast of glm/gtx/int_10_10_10_2.hpp only handles positive values.)
+ */
+GLuint pack_int_2_10_10_10_rev(glm::vec4 v) {
+    GLuint x = (GLuint)(int)floor(v.x * 511.0f + 0.5f) & 0x3ff;
+    GLuint y = (GLuint)(int)floor(v.y * 511.0f + 0.5f) & 0x3ff;
+    GLuint z = (GLuint)(int)floor(v.z * 511.0f + 0.5f) & 0x3ff;
+    GLuint w = (GLuint)(int)floor(v.w + 0.5f) & 0x3;
+    return x | y << 10 | z << 20 | w << 30;
+}
+
+
+// Compact vertex: 12 bytes instead of six floats (24 bytes)
+struct CompactVertex {
+    glm::hvec4 position;        // Half floats, w = 1 pads the normal to a 4-byte boundary
+    GLuint normal;              // GL_INT_2_10_10_10_REV, normalized to [-1, 1]
+};
+
+
+// The same cube as in prepare_vertex_data, but every corner of a face is stored only once
+// (4 vertices per face instead of 6) and the two triangles of a face refer to them by index.
+// With compact set, the vertices are packed into a CompactVertex.
+void prepare_indexed_vertex_data(bool compact) {
+
+    // Corners a, b, c, d of every face, the triangles are a-b-c and c-d-a
+    const float faceCorners[6][4][3] = {
+        {{0, 0, 0}, {0, 1, 0}, {0, 1, 1}, {0, 0, 1}},   // left
+        {{1, 0, 0}, {1, 0, 1}, {1, 1, 1}, {1, 1, 0}},   // right
+        {{0, 1, 0}, {0, 1, 1}, {1, 1, 1}, {1, 1, 0}},   // top
+        {{0, 0, 0}, {0, 0, 1}, {1, 0, 1}, {1, 0, 0}},   // bottom
+        {{0, 0, 1}, {0, 1, 1}, {1, 1, 1}, {1, 0, 1}},   // front
+        {{0, 0, 0}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}},   // back
+    };
+    const float faceNormals[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+
+    float vertices[24][6];
+    CompactVertex compactVertices[24];
+    GLubyte indices[36];
+    for (int face = 0; face < 6; face++) {
+        for (int corner = 0; corner < 4; corner++) {
+            float *v = vertices[face * 4 + corner];
+            for (int i = 0; i < 3; i++) {
+                v[i] = faceCorners[face][corner][i];
+                v[3 + i] = faceNormals[face][i];
+            }
+            compactVertices[face * 4 + corner].position = glm::hvec4(glm::vec4(v[0], v[1], v[2], 1));
+            compactVertices[face * 4 + corner].normal = pack_int_2_10_10_10_rev(glm::vec4(v[3], v[4], v[5], 0));
+        }
+        const GLubyte faceIndices[6] = {0, 1, 2, 2, 3, 0};
+        for (int i = 0; i < 6; i++) indices[face * 6 + i] = face * 4 + faceIndices[i];
+    }
+
+    glBindVertexArray(cubeVertexArrayHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, cubeArrayBufferHandle);
+    if (compact) {
+        cubeVertexBytes = sizeof(CompactVertex);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(compactVertices), compactVertices, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 4, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (const GLvoid*)0);
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactVertex), (const GLvoid*)sizeof(glm::hvec4));
+    } else {
+        cubeVertexBytes = 6*sizeof(float);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6*sizeof(float), (const GLvoid*)(0*sizeof(float)));
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6*sizeof(float), (const GLvoid*)(3*sizeof(float)));
+    }
+
+    // The element buffer binding is part of the VAO state
+    if (!cubeElementBufferHandle) glGenBuffers(1, &cubeElementBufferHandle);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeElementBufferHandle);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    cubeIndexCount = 36;
+}
+
+
+/**
+ * Draws the cube from whichever vertex data has been prepared,
+ * as many times as given (instanced when more than once)
+ */
+void draw_geometry(int instances) {
+    if (cubeIndexCount == 0) {
+        if (instances == 1) glDrawArrays(GL_TRIANGLES, 0, 36);
+        else glDrawArraysInstanced(GL_TRIANGLES, 0, 36, instances);
+    } else {
+        if (instances == 1) glDrawElements(GL_TRIANGLES, cubeIndexCount, GL_UNSIGNED_BYTE, 0);
+        else glDrawElementsInstanced(GL_TRIANGLES, cubeIndexCount, GL_UNSIGNED_BYTE, 0, instances);
+    }
+}
+
+
 /**
  * When GLUT determines that the window needs to be redisplayed, the display callback for the window is called.
  */
 void display() {
     float t = glutGet(GLUT_ELAPSED_TIME);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);     // Clear screen
-    draw_cube(t);
+    if (nbody) draw_particles(t);
+    else if (lights && deferredShading) draw_deferred(t);
+    else if (lights) draw_forward(t);
+    else if (scene) draw_culled(t);
+    else if (pipeline) draw_pipelined(t);
+    else if (city) draw_city(t);
+    else if (gpuScene) draw_gpu_culled(t);
+    else if (instanceCount > 0) draw_instances(t);
+    else draw_cube(t);
+    glutSwapBuffers();
 }
 
 
@@ -279,12 +688,1294 @@ void draw_cube(float t) {
     mv.Rotate(glm::vec3(0, 1, 1), t*0.1);
     mv.Translate(glm::vec3(-0.5, -0.5, -0.5));
 
+    glUseProgram(frameShader);
+    set_frame_uniforms(mvp.Top(), mv.Top());
+
+    draw_geometry(1);
+    endStreamFrame(frameStream);
+}
+
+
+/**
+ * draw_cube with the matrices set by glUniform calls, for comparison
+ */
+void draw_cube_uniforms(float t) {
+    glBindVertexArray(cubeVertexArrayHandle);
+
+    MatrixStack mvp, mv;
+    set_camera(mvp, mv, t);
+    mvp.Translate(glm::vec3(-0.5, -0.5, -0.5));
+    mv.Translate(glm::vec3(-0.5, -0.5, -0.5));
+
+    glUseProgram(shader);
     shader.uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(mvp.Top()));
-    shader.uniformMatrix4fv("modelViewMatrix", glm::value_ptr(mv.Top()));
+    set_normal_uniforms(shader, mv.Top());
 
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    draw_geometry(1);
+}
 
-    glutSwapBuffers();
+
+/**
+ * draw_cube with the Frame block written member by member through a uniform_block, at the offsets
+ * reported by the program, and uploaded with one glBufferSubData
+ */
+void draw_cube_block(float t) {
+    glBindVertexArray(cubeVertexArrayHandle);
+
+    MatrixStack mvp, mv;
+    set_camera(mvp, mv, t);
+    mvp.Translate(glm::vec3(-0.5, -0.5, -0.5));
+    mv.Translate(glm::vec3(-0.5, -0.5, -0.5));
+    glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(mv.Top()));
+
+    glUseProgram(frameShader);
+    frameBlock->uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(mvp.Top()));
+    frameBlock->uniformMatrix4fv("modelViewMatrix", glm::value_ptr(mv.Top()));
+    frameBlock->uniformMatrix3fv("normalMatrix", glm::value_ptr(normalMatrix));
+    frameBlock->upload();
+
+    draw_geometry(1);
+}
+
+
+/**
+ * Writes the matrices into the next region of the uniform stream and binds it to the Frame block.
+ * Call endStreamFrame(frameStream) after the draw calls of the frame.
+ */
+void set_frame_uniforms(const glm::mat4 &modelViewProjection, const glm::mat4 &modelView) {
+    FrameUniforms *frame = (FrameUniforms *)beginStreamFrame(frameStream);
+    glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(modelView));
+    frame->modelViewProjectionMatrix = modelViewProjection;
+    frame->modelViewMatrix = modelView;
+    for (int column = 0; column < 3; column++) frame->normalMatrix[column] = glm::vec4(normalMatrix[column], 0);
+    flushStreamFrame(frameStream);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, frameStream->buffer, streamFrameOffset(frameStream), sizeof(FrameUniforms));
+}
+
+
+/**
+ * Compiles the cube shader with the defines of the selected variant:
+ *  INSTANCED - model matrices come from the instance attributes
+ *  PER_VERTEX_NORMAL_MATRIX - the shader inverts the model view matrix itself
+ * plus any other defines given (added to both stages).
+ */
+void compile_variant(shader_prog &program, bool instanced, const char *defines) {
+    if (instanced) program.prepend(GL_VERTEX_SHADER, "#define INSTANCED\n");
+    if (perVertexNormals) program.prepend(GL_VERTEX_SHADER, "#define PER_VERTEX_NORMAL_MATRIX\n");
+    program.prepend(GL_VERTEX_SHADER, defines);
+    program.prepend(GL_FRAGMENT_SHADER, defines);
+    program.use();
+}
+
+
+/**
+ * Normals are transformed by the inverse transpose of the model view matrix. Unless the
+ * shader computes it per vertex, it is computed here once with glm::inverseTranspose.
+ */
+void set_normal_uniforms(shader_prog &program, const glm::mat4 &modelView) {
+    if (perVertexNormals) {
+        program.uniformMatrix4fv("modelViewMatrix", glm::value_ptr(modelView));
+    } else {
+        glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(modelView));
+        program.uniformMatrix3fv("normalMatrix", glm::value_ptr(normalMatrix));
+    }
+}
+
+
+/**
+ * Places count cubes on a grid inside [-1, 1]^3, each one scaled down and turned at random.
+ * Fills instanceMatrices and instanceNormalMatrices, without touching OpenGL.
+ */
+void generate_instances(int count) {
+    instanceCount = count;
+
+    int side = (int)ceil(pow(count, 1.0 / 3.0));
+    while (side * side * side < count) side++;
+    float cell = 2.0f / side;
+
+    srand(1);
+    instanceMatrices.resize(count);
+    instanceNormalMatrices.resize(count);
+    for (int i = 0; i < count; i++) {
+        MatrixStack model;
+        model.Translate(glm::vec3(-1 + cell * (i % side + 0.5f),
+                                  -1 + cell * (i / side % side + 0.5f),
+                                  -1 + cell * (i / side / side + 0.5f)));
+        model.Rotate(glm::vec3(rand() % 100 + 1, rand() % 100, rand() % 100), rand() % 360);
+        model.Scale(cell * 0.5f);
+        model.Translate(glm::vec3(-0.5, -0.5, -0.5));
+        instanceMatrices[i] = model.Top();
+        instanceNormalMatrices[i] = glm::inverseTranspose(glm::mat3(model.Top()));
+    }
+}
+
+
+/**
+ * Places count cubes with generate_instances and uploads them
+ */
+void prepare_instances(int count) {
+    generate_instances(count);
+    upload_instances(GL_STATIC_DRAW);
+}
+
+
+/**
+ * Uploads instanceMatrices and instanceNormalMatrices.
+ * The model matrix of every cube goes into an instance buffer: a mat4 attribute takes
+ * the locations 2-5, one vec4 column each, and glVertexAttribDivisor(location, 1) advances
+ * it once per instance instead of once per vertex. The inverse transpose of the model matrix
+ * (for the normals) goes into a second instance buffer, a mat3 at the locations 6-8.
+ */
+void upload_instances(GLenum usage) {
+    int count = (int)instanceMatrices.size();
+
+    glBindVertexArray(cubeVertexArrayHandle);
+    if (!instanceBufferHandle) glGenBuffers(1, &instanceBufferHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBufferHandle);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::mat4), &instanceMatrices[0], usage);
+    if (!instanceNormalBufferHandle) glGenBuffers(1, &instanceNormalBufferHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceNormalBufferHandle);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::mat3), &instanceNormalMatrices[0], usage);
+    point_instances(instanceBufferHandle, instanceNormalBufferHandle, 0);
+
+    // The same shader files, with the instance matrix switched on
+    if (!instancedShader) compile_variant(instancedShader, true);
+
+    glEnable(GL_DEPTH_TEST);
+}
+
+
+/**
+ * Sets up the instance attributes of the cube's vertex array (which must be bound) to start
+ * from instance first of the given buffers of mat4 model matrices and mat3 normal matrices
+ */
+void point_instances(GLuint matrices, GLuint normals, int first) {
+    glBindBuffer(GL_ARRAY_BUFFER, matrices);
+    for (int column = 0; column < 4; column++) {
+        glEnableVertexAttribArray(2 + column);
+        glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                              (const GLvoid*)(first * sizeof(glm::mat4) + column * 4 * sizeof(float)));
+        glVertexAttribDivisor(2 + column, 1);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, normals);
+    for (int column = 0; column < 3; column++) {
+        glEnableVertexAttribArray(6 + column);
+        glVertexAttribPointer(6 + column, 3, GL_FLOAT, GL_FALSE, sizeof(glm::mat3),
+                              (const GLvoid*)(first * sizeof(glm::mat3) + column * 3 * sizeof(float)));
+        glVertexAttribDivisor(6 + column, 1);
+    }
+}
+
+
+/**
+ * Releases the instance buffers and the instanced shader
+ */
+void free_instances() {
+    glDeleteBuffers(1, &instanceBufferHandle);
+    glDeleteBuffers(1, &instanceNormalBufferHandle);
+    instanceBufferHandle = instanceNormalBufferHandle = 0;
+    instancedShader.free();
+    instancedShader = shader_prog("../src/cube.vert.glsl", "../src/cube.frag.glsl");
+}
+
+
+/**
+ * Camera shared by the instanced modes: same view and rotation as draw_cube,
+ * without moving the cube's corner to the origin (the instance matrices do that)
+ */
+void set_camera(MatrixStack &mvp, MatrixStack &mv, float t) {
+    mvp.Perspective(60, 1, 0.5, 100);
+    mvp.LookAt(glm::vec3(0, 0, 3), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+    mvp.Rotate(glm::vec3(0, 1, 1), t*0.1);
+
+    mv.LookAt(glm::vec3(0, 0, 3), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+    mv.Rotate(glm::vec3(0, 1, 1), t*0.1);
+}
+
+
+/**
+ * Draws all instanceCount cubes with a single call
+ */
+void draw_instances(float t) {
+    glUseProgram(instancedShader);
+    glBindVertexArray(cubeVertexArrayHandle);
+
+    MatrixStack mvp, mv;
+    set_camera(mvp, mv, t);
+    instancedShader.uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(mvp.Top()));
+    set_normal_uniforms(instancedShader, mv.Top());
+
+    draw_geometry(instanceCount);
+}
+
+
+/**
+ * The same picture as draw_instances, but the way draw_cube does it:
+ * matrices and uniforms are set up on the CPU and a draw call is issued for every cube
+ */
+void draw_cubes_one_by_one(float t) {
+    glUseProgram(shader);
+    glBindVertexArray(cubeVertexArrayHandle);
+
+    MatrixStack mvp, mv;
+    set_camera(mvp, mv, t);
+    for (int i = 0; i < instanceCount; i++) {
+        mvp.Push();
+        mv.Push();
+        mvp.ApplyMatrix(instanceMatrices[i]);
+        mv.ApplyMatrix(instanceMatrices[i]);
+        shader.uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(mvp.Top()));
+        set_normal_uniforms(shader, mv.Top());
+        draw_geometry(1);
+        mvp.Pop();
+        mv.Pop();
+    }
+}
+
+
+/**
+ * Average frame time of the given drawing function: renders frames for about a second
+ * (at least three). The frames are not swapped to the screen, so vsync does not limit them,
+ * and glFinish makes sure the GPU work is included, not only its submission.
+ */
+float frame_time(void (*draw)(float)) {
+    int frames = 0;
+    int startTime = glutGet(GLUT_ELAPSED_TIME);
+    int elapsed = 0;
+    while (frames < 3 || elapsed < 1000) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw(frames * 10.0f);
+        glFinish();
+        frames++;
+        elapsed = glutGet(GLUT_ELAPSED_TIME) - startTime;
+    }
+    return (float)elapsed / frames;
+}
+
+
+/**
+ * Scales the number of cubes from 1 to maxCount. With one draw call per cube the frame time
+ * grows with the number of calls the CPU has to submit, while the instanced version stays
+ * flat until the GPU itself becomes the bottleneck. One draw call per cube stops at 64K cubes.
+ */
+void instancing_benchmark(int maxCount) {
+    printf("%8s %22s %22s\n", "cubes", "one by one ms (fps)", "instanced ms (fps)");
+    for (int count = 1; count <= maxCount; count *= 4) {
+        prepare_instances(count);
+
+        char oneByOne[32] = "-";
+        if (count <= 65536) {
+            float ms = frame_time(draw_cubes_one_by_one);
+            sprintf(oneByOne, "%9.2f (%8.1f)", ms, 1000 / ms);
+        }
+        float ms = frame_time(draw_instances);
+        printf("%8d %22s %11.2f (%8.1f)\n", count, oneByOne, ms, 1000 / ms);
+    }
+
+    free_instances();
+}
+
+
+/**
+ * Draws count instanced cubes with the three vertex formats: unindexed floats, indexed floats
+ * and indexed compact vertices. The cubes are tiny, so the time goes into fetching and
+ * transforming vertices rather than into filling pixels.
+ */
+void vertex_format_benchmark(int count) {
+    prepare_instances(count);
+
+    const char *names[3] = {"arrays, 6 floats", "indexed, 6 floats", "indexed, compact"};
+    printf("%d cubes\n%-18s %12s %14s %10s %12s %16s\n", count, "format", "bytes/vertex", "bytes/cube",
+           "ms/frame", "Mvertices/s", "vertex data GB/s");
+    for (int format = 0; format < 3; format++) {
+        if (format > 0) prepare_indexed_vertex_data(format == 2);
+
+        // Vertex data read per cube: every index refers to a vertex, plus the indices themselves
+        int vertexBytes = 36 * cubeVertexBytes + cubeIndexCount;
+        int bufferBytes = cubeIndexCount == 0 ? vertexBytes : 24 * cubeVertexBytes + cubeIndexCount;
+        float ms = frame_time(draw_instances);
+        double vertices = 36.0 * count;
+        printf("%-18s %12d %14d %10.2f %12.1f %16.2f\n", names[format], cubeVertexBytes, bufferBytes, ms,
+               vertices / ms / 1000, (double)vertexBytes * count / ms / 1.0e6);
+    }
+
+    free_instances();
+}
+
+
+/**
+ * Renders frames into an offscreen framebuffer of the window's size, so neither vsync nor
+ * the window system gets in the way. Every frame is timed three ways:
+ *  - cpu: how long it takes to submit the frame
+ *  - gpu: GL_TIME_ELAPSED query around the frame, measured by the GPU itself
+ *  - wall: from the start of the submission until glFinish returns
+ * The per-frame times go to frame_times.csv and frame_times.json, and the summary
+ * (median = p50, p95, p99) is printed as a JSON record, so a renderer change can be
+ * checked for frame time regressions by comparing two runs.
+ */
+void frame_benchmark(int frames, int cubes) {
+    const int width = 800, height = 800, warmupFrames = 10;
+    if (frames < 1) return;
+
+    GLuint framebuffer, renderbuffers[2];
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(2, renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Offscreen framebuffer is not complete\n");
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteRenderbuffers(2, renderbuffers);
+        glDeleteFramebuffers(1, &framebuffer);
+        return;
+    }
+    glViewport(0, 0, width, height);
+
+    void (*draw)(float) = draw_cube;
+    if (cubes > 0) {
+        prepare_instances(cubes);
+        draw = draw_instances;
+    } else {
+        glUseProgram(shader);
+    }
+
+    vector<double> cpu(frames), gpu(frames), wall(frames);
+    struct GPUtimer *timer = initGPUTimer(frames);
+    for (int i = -warmupFrames; i < frames; i++) {
+        float t = i * 1000.0f / 60;   // Animate as if running at 60 fps
+        double startTime = wallClockMs();
+        if (i >= 0) beginGPUPass(timer);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw(t);
+        if (i >= 0) endGPUPass(timer);
+        double submitTime = wallClockMs();
+        glFinish();
+        if (i >= 0) {
+            cpu[i] = submitTime - startTime;
+            wall[i] = wallClockMs() - startTime;
+        }
+    }
+    if (timer->supported) gpuPassTimes(timer, &gpu[0]);
+    freeGPUTimer(timer);
+
+    FILE *csv = fopen("frame_times.csv", "w");
+    FILE *json = fopen("frame_times.json", "w");
+    if (csv && json) {
+        fprintf(csv, "frame,cpu_ms,gpu_ms,wall_ms\n");
+        fprintf(json, "[\n");
+        for (int i = 0; i < frames; i++) {
+            fprintf(csv, "%d,%.6f,%.6f,%.6f\n", i, cpu[i], gpu[i], wall[i]);
+            fprintf(json, "  {\"frame\": %d, \"cpu_ms\": %.6f, \"gpu_ms\": %.6f, \"wall_ms\": %.6f}%s\n",
+                    i, cpu[i], gpu[i], wall[i], i + 1 < frames ? "," : "");
+        }
+        fprintf(json, "]\n");
+    } else {
+        printf("Could not write frame_times.csv or frame_times.json\n");
+    }
+    if (csv) fclose(csv);
+    if (json) fclose(json);
+
+    // timingStats sorts the samples, so the files have to be written first
+    printf("{\"benchmark\": \"frames\", \"frames\": %d, \"cubes\": %d, \"cpu_ms\": ", frames, cubes);
+    printStatsJSON(stdout, timingStats(&cpu[0], frames));
+    printf(", \"gpu_ms\": ");
+    printStatsJSON(stdout, timingStats(&gpu[0], frames));
+    printf(", \"wall_ms\": ");
+    printStatsJSON(stdout, timingStats(&wall[0], frames));
+    printf("}\n");
+
+    if (cubes > 0) {
+        free_instances();
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteRenderbuffers(2, renderbuffers);
+    glDeleteFramebuffers(1, &framebuffer);
+}
+
+
+/**
+ * Draws count instanced cubes with both shader variants. The cubes are tiny, so the frame time
+ * is dominated by the vertex shader, which is where the two variants differ. Software
+ * rasterizers such as llvmpipe run the vertex shader on the CPU and gain the most.
+ */
+void normal_matrix_benchmark(int count) {
+    printf("%d cubes\n%-28s %10s %12s\n", count, "normal matrix", "ms/frame", "Mvertices/s");
+    for (int variant = 0; variant < 2; variant++) {
+        perVertexNormals = variant == 0;
+        prepare_instances(count);       // Compiles the instanced shader of the current variant
+        float ms = frame_time(draw_instances);
+        printf("%-28s %10.2f %12.1f\n", perVertexNormals ? "per vertex (shader inverse)" : "per frame (CPU uniform)",
+               ms, 36.0 * count / ms / 1000);
+        free_instances();
+    }
+}
+
+
+/**
+ * Instanced cubes lit by lightCount point lights. Sets up both shading paths:
+ * forward (cube shaders with the LIGHTS variant, every fragment loops over all lights)
+ * and deferred (see deferred.h).
+ */
+void prepare_lights(int lightCount, int cubes) {
+    if (lights) freeLights(lights);
+    lights = initLights(lightCount);
+
+    if (!gbuffer) {
+        prepare_instances(cubes);
+        addPhong(forwardShader);
+        compile_variant(forwardShader, true, "#define LIGHTS\n#define EYE_POSITION\n");
+        compile_variant(gbufferShader, true);
+        gbuffer = initGBuffer(800, 800);
+        lightTiles = initLightTiles(800, 800);
+        lightingShader = initLightingShader();
+    }
+}
+
+
+/**
+ * Releases the lights and everything the two shading paths allocated
+ */
+void free_lights() {
+    freeLights(lights);
+    lights = NULL;
+    freeGBuffer(gbuffer);
+    gbuffer = NULL;
+    freeLightTiles(lightTiles);
+    lightingShader->free();
+    delete lightingShader;
+    forwardShader.free();
+    forwardShader = shader_prog("../src/cube.vert.glsl", "../src/cube.frag.glsl");
+    gbufferShader.free();
+    gbufferShader = shader_prog("../src/cube.vert.glsl", "../src/gbuffer.frag.glsl");
+}
+
+
+/**
+ * Forward shading: the Phong model for every light in every fragment shader invocation
+ */
+void draw_forward(float t) {
+    MatrixStack mvp, mv;
+    set_camera(mvp, mv, t);
+    updateLights(lights, mv.Top());
+
+    glUseProgram(forwardShader);
+    glBindVertexArray(cubeVertexArrayHandle);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, lights->texture);
+    forwardShader.uniform1i("lights", 0);
+    forwardShader.uniform1i("lightCount", lights->count);
+    forwardShader.uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(mvp.Top()));
+    forwardShader.uniformMatrix4fv("modelViewMatrix", glm::value_ptr(mv.Top()));
+    set_normal_uniforms(forwardShader, mv.Top());
+
+    draw_geometry(instanceCount);
+}
+
+
+/**
+ * Deferred shading: the cubes go into the G-buffer, the lights are binned into screen tiles
+ * on the CPU, and a full-screen pass shades every pixel with the lights of its tile
+ */
+void draw_deferred(float t) {
+    MatrixStack mvp, mv, projection;
+    set_camera(mvp, mv, t);
+    projection.Perspective(60, 1, 0.5, 100);    // The same as in set_camera
+
+    // Geometry pass
+    glBindFramebuffer(GL_FRAMEBUFFER, gbuffer->fbo);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glUseProgram(gbufferShader);
+    glBindVertexArray(cubeVertexArrayHandle);
+    gbufferShader.uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(mvp.Top()));
+    set_normal_uniforms(gbufferShader, mv.Top());
+    draw_geometry(instanceCount);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Tiled light culling
+    double startTime = wallClockMs();
+    updateLights(lights, mv.Top());
+    cullLights(lightTiles, lights, projection.Top(), 0.5f);
+    cullTime = wallClockMs() - startTime;
+
+    // Lighting pass
+    shadeDeferred(lightingShader, gbuffer, lights, lightTiles, projection.Top());
+}
+
+
+/**
+ * Median GPU time of frames frames of the given drawing function, from GL_TIME_ELAPSED queries
+ */
+double gpu_frame_time(void (*draw)(float), int frames) {
+    struct GPUtimer *timer = initGPUTimer(frames);
+    for (int i = 0; i < frames; i++) {
+        beginGPUPass(timer);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw(i * 10.0f);
+        endGPUPass(timer);
+    }
+    TimingStats stats = gpuTimerStats(timer, NULL);
+    freeGPUTimer(timer);
+    return stats.median;
+}
+
+
+/**
+ * Frame time (wall clock with glFinish, and GPU timer queries) of forward and deferred shading
+ * as the number of lights grows. Forward shading pays for every light in every fragment,
+ * deferred shading only for the lights whose tiles a visible pixel lies in.
+ */
+void lighting_benchmark(int cubes) {
+    printf("%d cubes, %dx%d pixel tiles\n", cubes, LIGHT_TILE_SIZE, LIGHT_TILE_SIZE);
+    printf("%6s %14s %14s %14s %14s %10s %14s\n", "lights", "forward ms", "forward GPU", "deferred ms",
+           "deferred GPU", "cull ms", "lights/tile");
+    for (int count = 1; count <= 1024; count *= 4) {
+        prepare_lights(count, cubes);
+        float forwardMs = frame_time(draw_forward);
+        double forwardGpu = gpu_frame_time(draw_forward, 50);
+        float deferredMs = frame_time(draw_deferred);
+        double deferredGpu = gpu_frame_time(draw_deferred, 50);
+        printf("%6d %14.2f %14.2f %14.2f %14.2f %10.3f %14.2f\n", count, forwardMs, forwardGpu, deferredMs,
+               deferredGpu, cullTime, (double)lightTiles->listedLights / (lightTiles->columns * lightTiles->rows));
+    }
+
+    free_lights();
+    free_instances();
+}
+
+
+/**
+ * Renders frames frames of cubes cubes on the CPU (see rasterizer.h): the scene and camera of the
+ * instanced mode, lit like the forward mode by a few point lights. The frame time is measured
+ * with one thread, then doubling the threads up to the number of cores. The last frame goes
+ * into software.ppm.
+ */
+void software_render(int frames, int cubes) {
+    const int width = 800, height = 800;
+    if (frames < 1 || cubes < 1) return;
+    generate_instances(cubes);
+
+    // World space lights: position, radius and color
+    const struct { glm::vec3 position; float radius; glm::vec3 color; } worldLights[] = {
+        {glm::vec3(2, 2, 3), 8, glm::vec3(1.0, 0.9, 0.8)},
+        {glm::vec3(-3, 1, 2), 8, glm::vec3(0.3, 0.4, 0.9)},
+        {glm::vec3(0, -3, 1), 6, glm::vec3(0.6, 0.3, 0.3)},
+    };
+    const int lightCount = sizeof(worldLights) / sizeof(worldLights[0]);
+
+    // set_camera applies the projection to mvp only, mv is the view
+    MatrixStack projection;
+    projection.Perspective(60, 1, 0.5, 100);
+
+    int maxThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    struct RasterImage *image = initRasterImage(width, height);
+    printf("%d cubes, %dx%d pixels, %dx%d pixel tiles\n", cubes, width, height, RASTER_TILE_SIZE, RASTER_TILE_SIZE);
+    printf("%7s %12s %12s %10s %10s %10s %8s\n", "threads", "median ms", "p95 ms", "vertex", "bin", "raster", "speedup");
+
+    double singleThreadMs = 0;
+    for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+        vector<double> times(frames);
+        RasterStats sum = {0, 0, 0, 0, 0};
+        for (int i = 0; i < frames; i++) {
+            float t = i * 1000.0f / 60;     // Animate as if running at 60 fps
+            MatrixStack mvp, mv;
+            set_camera(mvp, mv, t);
+
+            vector<RasterLight> eyeLights(lightCount);
+            for (int l = 0; l < lightCount; l++) {
+                eyeLights[l].position = glm::vec3(mv.Top() * glm::vec4(worldLights[l].position, 1));
+                eyeLights[l].radius = worldLights[l].radius;
+                eyeLights[l].color = worldLights[l].color;
+            }
+
+            double startTime = wallClockMs();
+            clearRasterImage(image);
+            RasterStats stats = rasterize(image, cubeVertexData, sizeof(cubeVertexData) / (6 * sizeof(float)), &instanceMatrices[0], cubes,
+                                          mv.Top(), projection.Top(), eyeLights, threads);
+            times[i] = wallClockMs() - startTime;
+            sum.vertexMs += stats.vertexMs;
+            sum.binMs += stats.binMs;
+            sum.rasterMs += stats.rasterMs;
+        }
+
+        TimingStats stats = timingStats(&times[0], frames);
+        if (threads == 1) singleThreadMs = stats.median;
+        printf("%7d %12.2f %12.2f %10.2f %10.2f %10.2f %8.2f\n", threads, stats.median, stats.p95,
+               sum.vertexMs / frames, sum.binMs / frames, sum.rasterMs / frames, singleThreadMs / stats.median);
+        if (threads == maxThreads) break;
+    }
+
+    saveRasterImage(image, "software.ppm");
+    printf("Last frame written to software.ppm\n");
+    freeRasterImage(image);
+}
+
+
+/**
+ * Places count cubes of random heights on a square grid in the xz plane, two units apart,
+ * into instanceMatrices and instanceNormalMatrices
+ */
+void generate_field(int count) {
+    int side = (int)ceil(sqrt((double)count));
+
+    srand(1);
+    instanceMatrices.resize(count);
+    instanceNormalMatrices.resize(count);
+    for (int i = 0; i < count; i++) {
+        MatrixStack model;
+        model.Translate(glm::vec3(2 * (i % side - side / 2) - 0.5f, 0, 2 * (i / side - side / 2) - 0.5f));
+        model.Scale(glm::vec3(1, 1 + rand() % 8, 1));
+        instanceMatrices[i] = model.Top();
+        instanceNormalMatrices[i] = glm::inverseTranspose(glm::mat3(model.Top()));
+    }
+}
+
+
+/**
+ * Builds the scene (see scene.h) of a field of count cubes. The instance buffers get room
+ * for all of them, and every frame draw_culled overwrites the front with the visible ones.
+ */
+void prepare_scene(int count) {
+    generate_field(count);
+    scene = initScene(instanceMatrices);
+    printf("BVH of %d cubes: %d nodes, built in %.1f ms\n", count, (int)scene->nodes.size(), scene->buildMs);
+    upload_instances(GL_STREAM_DRAW);
+}
+
+
+/**
+ * Camera standing above the middle of the field, turning around
+ */
+void set_field_camera(MatrixStack &mvp, MatrixStack &mv, float t) {
+    mvp.Perspective(60, 1, 0.5, 500);
+    mvp.LookAt(glm::vec3(0, 20, 0), glm::vec3(0, 0, -60), glm::vec3(0, 1, 0));
+    mvp.Rotate(glm::vec3(0, 1, 0), t*0.01);
+
+    mv.LookAt(glm::vec3(0, 20, 0), glm::vec3(0, 0, -60), glm::vec3(0, 1, 0));
+    mv.Rotate(glm::vec3(0, 1, 0), t*0.01);
+}
+
+
+/**
+ * Culls the scene against the view frustum and draws the visible cubes with one instanced call
+ */
+void draw_culled(float t) {
+    MatrixStack mvp, mv;
+    set_field_camera(mvp, mv, t);
+
+    // The instance matrices are in world space, so the frustum comes from the view projection matrix
+    double startTime = wallClockMs();
+    visibleCount = cullScene(scene, mvp.Top());
+    for (int i = 0; i < visibleCount; i++) {
+        instanceMatrices[i] = scene->models[scene->visible[i]];
+        instanceNormalMatrices[i] = scene->normalMatrices[scene->visible[i]];
+    }
+    frustumCullTime = wallClockMs() - startTime;
+    if (visibleCount == 0) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBufferHandle);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, visibleCount * sizeof(glm::mat4), &instanceMatrices[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceNormalBufferHandle);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, visibleCount * sizeof(glm::mat3), &instanceNormalMatrices[0]);
+
+    glUseProgram(instancedShader);
+    glBindVertexArray(cubeVertexArrayHandle);
+    instancedShader.uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(mvp.Top()));
+    set_normal_uniforms(instancedShader, mv.Top());
+
+    draw_geometry(visibleCount);
+}
+
+
+/**
+ * Culls a field of count cubes for a full turn of the camera, with the BVH and by testing
+ * every cube, and prints the visible count and both times for every frame
+ */
+void culling_benchmark(int count) {
+    generate_field(count);
+    struct Scene *field = initScene(instanceMatrices);
+    printf("BVH of %d cubes: %d nodes, built in %.1f ms\n", count, (int)field->nodes.size(), field->buildMs);
+    printf("%6s %10s %12s %12s\n", "frame", "visible", "BVH ms", "linear ms");
+
+    vector<double> bvhTimes, linearTimes;
+    for (int frame = 0; frame < 36; frame++) {
+        MatrixStack mvp, mv;
+        set_field_camera(mvp, mv, frame * 1000.0f);     // 10 degrees per frame
+
+        double startTime = wallClockMs();
+        int visible = cullScene(field, mvp.Top());
+        double bvhTime = wallClockMs();
+        int linearVisible = cullSceneLinear(field, mvp.Top());
+        double endTime = wallClockMs();
+        if (visible != linearVisible) printf("Visible counts differ: %d with the BVH, %d without\n", visible, linearVisible);
+
+        bvhTimes.push_back(bvhTime - startTime);
+        linearTimes.push_back(endTime - bvhTime);
+        printf("%6d %10d %12.3f %12.3f\n", frame, visible, bvhTimes.back(), linearTimes.back());
+    }
+
+    printf("%6s %10s %12.3f %12.3f\n", "median", "", timingStats(&bvhTimes[0], bvhTimes.size()).median,
+           timingStats(&linearTimes[0], linearTimes.size()).median);
+    freeScene(field);
+}
+
+
+/**
+ * Draws frames frames of the single cube with glUniform calls, with the uniform block streamed
+ * through glMapBufferRange and, if supported, through a persistent mapping. Prints the median
+ * CPU time of a frame and the number of frames that waited for a fence.
+ */
+void stream_benchmark(int frames) {
+    if (frames < 1) return;
+    printf("%-22s %12s %12s %8s\n", "", "median ms", "p95 ms", "stalls");
+
+    StreamBuffer *defaultStream = frameStream;
+    for (int method = 0; method < 4; method++) {
+        const char *names[] = {"glUniform", "glMapBufferRange", "persistent mapping", "uniform_block"};
+        if (method == 2 && !GLEW_ARB_buffer_storage) {
+            printf("%-22s not supported\n", names[method]);
+            continue;
+        }
+        bool streamed = method == 1 || method == 2;
+        if (streamed) frameStream = initStreamBuffer(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), method == 2);
+        if (method == 3) frameBlock = new uniform_block(frameShader, "Frame", 0);
+        void (*draw)(float) = method == 0 ? draw_cube_uniforms : method == 3 ? draw_cube_block : draw_cube;
+
+        vector<double> times(frames);
+        glFinish();
+        for (int i = 0; i < frames; i++) {
+            double startTime = wallClockMs();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            draw(i * 1000.0f / 60);
+            times[i] = wallClockMs() - startTime;
+        }
+        glFinish();
+
+        TimingStats stats = timingStats(&times[0], frames);
+        printf("%-22s %12.4f %12.4f %8ld\n", names[method], stats.median, stats.p95, streamed ? frameStream->stalls : 0L);
+        if (streamed) freeStreamBuffer(frameStream);
+        if (method == 3) {
+            frameBlock->free();
+            delete frameBlock;
+            frameBlock = NULL;
+        }
+    }
+    frameStream = defaultStream;
+}
+
+
+/**
+ * Starts building frames of cubes instanced cubes (see frame_pipeline.h) on threads threads:
+ * the builder and threads - 1 workers
+ */
+void prepare_pipeline(int cubes, int threads) {
+    generate_instances(cubes);
+    instanceCount = 0;      // Drawn by draw_pipelined instead
+    pipeline = initPipeline(instanceMatrices, threads - 1, pipeline_camera);
+
+    // Room for every cube in each frame in flight
+    instanceStream = initStreamBuffer(GL_ARRAY_BUFFER, (long)cubes * sizeof(InstanceData), true);
+    if (!instancedShader) compile_variant(instancedShader, true);
+    glEnable(GL_DEPTH_TEST);
+}
+
+
+/**
+ * Stops the builder and releases the instance stream
+ */
+void free_pipeline() {
+    freePipeline(pipeline);
+    freeStreamBuffer(instanceStream);
+    pipeline = NULL;
+    instanceStream = NULL;
+}
+
+
+/**
+ * The camera of set_camera, called on the builder thread
+ */
+void pipeline_camera(glm::mat4 &viewProjection, glm::mat4 &view, float t) {
+    MatrixStack mvp, mv;
+    set_camera(mvp, mv, t);
+    viewProjection = mvp.Top();
+    view = mv.Top();
+}
+
+
+/**
+ * Points the instance attributes (locations 2-8) at interleaved InstanceData in the instance stream
+ */
+void set_instance_attributes(long offset) {
+    glBindBuffer(GL_ARRAY_BUFFER, instanceStream->buffer);
+    for (int column = 0; column < 4; column++) {
+        glEnableVertexAttribArray(2 + column);
+        glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (const GLvoid*)(offset + offsetof(InstanceData, model) + column * 4 * sizeof(float)));
+        glVertexAttribDivisor(2 + column, 1);
+    }
+    for (int column = 0; column < 3; column++) {
+        glEnableVertexAttribArray(6 + column);
+        glVertexAttribPointer(6 + column, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (const GLvoid*)(offset + offsetof(InstanceData, normalMatrix) + column * 3 * sizeof(float)));
+        glVertexAttribDivisor(6 + column, 1);
+    }
+}
+
+
+/**
+ * Draws the next frame of the pipeline: copies the instances of its draw packets into the
+ * instance stream and submits one instanced call per packet. The builder animates with its
+ * own clock, so t is not used.
+ */
+void draw_pipelined(float) {
+    InstanceData *data = (InstanceData *)beginStreamFrame(instanceStream);
+    vector<DrawPacket> packets;
+    int copied = 0;
+    DrawPacket packet;
+    while ((packet = nextPacket(pipeline)).count >= 0) {
+        const InstanceData *instances = &pipeline->instances[packet.frame % PIPELINE_FRAMES][packet.first];
+        std::copy(instances, instances + packet.count, data + copied);
+        packet.first = copied;      // Now the position in the stream region
+        copied += packet.count;
+        packets.push_back(packet);
+    }
+    flushStreamFrame(instanceStream);
+
+    // The frame's matrices are copied out before the builder may reuse them
+    glm::mat4 viewProjection = pipeline->viewProjection[packet.frame % PIPELINE_FRAMES];
+    glm::mat4 view = pipeline->view[packet.frame % PIPELINE_FRAMES];
+    finishFrame(pipeline);
+
+    glUseProgram(instancedShader);
+    glBindVertexArray(cubeVertexArrayHandle);
+    instancedShader.uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(viewProjection));
+    set_normal_uniforms(instancedShader, view);
+    for (size_t i = 0; i < packets.size(); i++) {
+        set_instance_attributes(streamFrameOffset(instanceStream) + packets[i].first * (long)sizeof(InstanceData));
+        draw_geometry(packets[i].count);
+    }
+    endStreamFrame(instanceStream);
+}
+
+
+/**
+ * Frame time of the pipelined mode with cubes cubes, building with 1, 2, 4... threads
+ * up to the number of cores
+ */
+void pipeline_benchmark(int cubes) {
+    const int frames = 200, warmupFrames = 10;
+    int maxThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    printf("%d cubes, %d per draw packet\n", cubes, PIPELINE_GRAIN);
+    printf("%7s %12s %12s %8s\n", "threads", "frame ms", "build ms", "speedup");
+
+    double singleThreadMs = 0;
+    for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+        prepare_pipeline(cubes, threads);
+        double buildMs = 0, startTime = 0;
+        for (int i = -warmupFrames; i < frames; i++) {
+            if (i == 0) {
+                glFinish();
+                startTime = wallClockMs();
+            }
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            draw_pipelined(0);
+            if (i >= 0) buildMs += pipeline->buildMs;
+        }
+        glFinish();
+        double frameMs = (wallClockMs() - startTime) / frames;
+        if (threads == 1) singleThreadMs = frameMs;
+        printf("%7d %12.3f %12.3f %8.2f\n", threads, frameMs, buildMs / frames, singleThreadMs / frameMs);
+        free_pipeline();
+        if (threads == maxThreads) break;
+    }
+}
+
+
+/**
+ * Builds a city of count cubes (see occlusion.h). The instance buffers get room for all of them,
+ * and every frame draw_city writes the cubes of the buildings it draws to the front.
+ */
+void prepare_city(int count, bool occlusion, float lodDistance) {
+    city = initCity(count, lodDistance);
+    city->occlusion = occlusion;
+    instanceMatrices = city->models;
+    instanceNormalMatrices = city->normalMatrices;
+    upload_instances(GL_STREAM_DRAW);
+}
+
+
+/**
+ * Releases the city and the instance buffers
+ */
+void free_city() {
+    freeCity(city);
+    city = NULL;
+    free_instances();
+}
+
+
+/**
+ * Camera walking at eye height down the street at x = -2, looking a little to both sides.
+ * Returns the eye position in world space.
+ */
+glm::vec3 set_city_camera(MatrixStack &mvp, MatrixStack &mv, float t) {
+    glm::vec3 eye(-2, 1.7f, 150 - fmod(t * 0.005f, 300.0f));
+    glm::vec3 center = eye + glm::vec3(0.5f * sin(t * 0.0005f), 0, -1);
+    mvp.Perspective(60, 1, 0.1, 1000);
+    mvp.LookAt(eye, center, glm::vec3(0, 1, 0));
+    mv.LookAt(eye, center, glm::vec3(0, 1, 0));
+    return eye;
+}
+
+
+/**
+ * Draws the city: the near buildings seen in the last frame with one instanced call, the far ones
+ * as impostors, then the occlusion queries of this frame, and the near buildings that were hidden
+ * one by one under conditional rendering
+ */
+void draw_city(float t) {
+    MatrixStack mvp, mv;
+    glm::vec3 eye = set_city_camera(mvp, mv, t);
+    planCity(city, mvp.Top(), eye);
+
+    cityCubes = 0;
+    for (size_t i = 0; i < city->drawn.size(); i++) {
+        const Building &building = city->buildings[city->drawn[i]];
+        std::copy(city->models.begin() + building.first, city->models.begin() + building.first + building.count,
+                  instanceMatrices.begin() + cityCubes);
+        std::copy(city->normalMatrices.begin() + building.first,
+                  city->normalMatrices.begin() + building.first + building.count, instanceNormalMatrices.begin() + cityCubes);
+        cityCubes += building.count;
+    }
+
+    glUseProgram(instancedShader);
+    glBindVertexArray(cubeVertexArrayHandle);
+    instancedShader.uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(mvp.Top()));
+    set_normal_uniforms(instancedShader, mv.Top());
+    if (cityCubes > 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBufferHandle);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, cityCubes * sizeof(glm::mat4), &instanceMatrices[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceNormalBufferHandle);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, cityCubes * sizeof(glm::mat3), &instanceNormalMatrices[0]);
+        point_instances(instanceBufferHandle, instanceNormalBufferHandle, 0);
+        draw_geometry(cityCubes);
+    }
+
+    // The depth buffer now holds the likely occluders
+    drawImpostors(city, mvp.Top(), mv.Top(), eye);
+    queryCity(city, mvp.Top());
+
+    // GL_QUERY_WAIT makes the GPU, not the CPU, wait for the answer of the box
+    glUseProgram(instancedShader);
+    glBindVertexArray(cubeVertexArrayHandle);
+    for (size_t i = 0; i < city->retested.size(); i++) {
+        int b = city->retested[i];
+        glBeginConditionalRender(city->queries[b], GL_QUERY_WAIT);
+        point_instances(city->modelBuffer, city->normalBuffer, city->buildings[b].first);
+        draw_geometry(city->buildings[b].count);
+        glEndConditionalRender();
+    }
+}
+
+
+/**
+ * Walks down the street of a city of count cubes with frustum culling only, with occlusion queries,
+ * and with occlusion queries and impostors. Prints the median wall clock (with glFinish)
+ * and GPU time of a frame, and the average work submitted per frame.
+ */
+void city_benchmark(int count) {
+    const int frames = 300;
+    const char *names[3] = {"frustum", "occlusion", "occlusion + LOD"};
+    printf("%d cubes\n%-16s %12s %10s %10s %10s %10s %10s\n", count, "culling", "cubes drawn", "retested",
+           "impostors", "plan ms", "frame ms", "GPU ms");
+
+    for (int mode = 0; mode < 3; mode++) {
+        prepare_city(count, mode > 0, mode == 2 ? 150.0f : 1e30f);
+        struct GPUtimer *timer = initGPUTimer(frames);
+        vector<double> wall(frames);
+        double cubes = 0, retested = 0, impostors = 0, planMs = 0;
+        for (int i = 0; i < frames; i++) {
+            double startTime = wallClockMs();
+            beginGPUPass(timer);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            draw_city(i * 200.0f);      // One unit of street per frame
+            endGPUPass(timer);
+            glFinish();
+            wall[i] = wallClockMs() - startTime;
+            cubes += cityCubes;
+            retested += city->retested.size();
+            impostors += city->impostors.size();
+            planMs += city->planMs;
+        }
+        TimingStats gpu = gpuTimerStats(timer, NULL);
+        freeGPUTimer(timer);
+        printf("%-16s %12.0f %10.1f %10.1f %10.3f %10.2f %10.2f\n", names[mode], cubes / frames, retested / frames,
+               impostors / frames, planMs / frames, timingStats(&wall[0], frames).median, gpu.median);
+        free_city();
+    }
+}
+
+
+/**
+ * Places count cubes like the "culled" mode (generate_field) into a GPU scene (see gpu_culling.h)
+ * and points the cube's instance attributes to its visible lists. Returns false if the context
+ * cannot run it.
+ */
+bool prepare_gpu_scene(int count) {
+    if (!gpuCullingSupported()) {
+        printf("Culling on the GPU needs OpenGL 4.3, this context has %s\n", glGetString(GL_VERSION));
+        return false;
+    }
+
+    generate_field(count);
+    gpuScene = initGPUScene(instanceMatrices, instanceNormalMatrices, cubeIndexCount ? cubeIndexCount : 36,
+                            cubeIndexCount ? GL_UNSIGNED_BYTE : 0);
+    glBindVertexArray(cubeVertexArrayHandle);
+    bindGPUInstances(gpuScene);
+    if (!instancedShader) compile_variant(instancedShader, true);
+    glEnable(GL_DEPTH_TEST);
+    return true;
+}
+
+
+/**
+ * Releases the GPU scene and the instanced shader
+ */
+void free_gpu_scene() {
+    freeGPUScene(gpuScene);
+    gpuScene = NULL;
+    instancedShader.free();
+    instancedShader = shader_prog("../src/cube.vert.glsl", "../src/cube.frag.glsl");
+}
+
+
+/**
+ * Culls and draws the GPU scene. The CPU work does not depend on the number of cubes.
+ */
+void draw_gpu_culled(float t) {
+    MatrixStack mvp, mv;
+    set_field_camera(mvp, mv, t);
+    cullGPUScene(gpuScene, mvp.Top());
+
+    glUseProgram(instancedShader);
+    glBindVertexArray(cubeVertexArrayHandle);
+    instancedShader.uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(mvp.Top()));
+    set_normal_uniforms(instancedShader, mv.Top());
+    drawGPUScene(gpuScene);
+}
+
+
+/**
+ * Median CPU submission time, wall clock time (with glFinish) and GPU time of frames frames
+ * of the given drawing function, after a few warm-up frames
+ */
+void measure_frames(void (*draw)(float), int frames, double &submitMs, double &frameMs, double &gpuMs) {
+    const int warmupFrames = 10;
+    vector<double> submit(frames), wall(frames);
+    struct GPUtimer *timer = initGPUTimer(frames);
+    for (int i = -warmupFrames; i < frames; i++) {
+        double startTime = wallClockMs();
+        if (i >= 0) beginGPUPass(timer);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw(i * 100.0f);
+        if (i >= 0) endGPUPass(timer);
+        double submitTime = wallClockMs();
+        glFinish();
+        if (i >= 0) {
+            submit[i] = submitTime - startTime;
+            wall[i] = wallClockMs() - startTime;
+        }
+    }
+    gpuMs = timer->supported ? gpuTimerStats(timer, NULL).median : 0;
+    freeGPUTimer(timer);
+    submitMs = timingStats(&submit[0], frames).median;
+    frameMs = timingStats(&wall[0], frames).median;
+}
+
+
+/**
+ * Frame times of the field of the "culled" mode with 64K, 256K... up to maxCount cubes:
+ * culled with the BVH on the CPU and drawn with one instanced call, against culled in a
+ * compute shader and drawn with one indirect call
+ */
+void gpu_culling_benchmark(int maxCount) {
+    if (!gpuCullingSupported()) {
+        printf("Culling on the GPU needs OpenGL 4.3, this context has %s\n", glGetString(GL_VERSION));
+        return;
+    }
+
+    const int frames = 100;
+    printf("%8s %-14s %10s %10s %10s %10s\n", "cubes", "culling", "visible", "submit ms", "frame ms", "GPU ms");
+    for (int count = 1 << 16; count <= maxCount; count *= 4) {
+        double submitMs, frameMs, gpuMs;
+        prepare_scene(count);
+        measure_frames(draw_culled, frames, submitMs, frameMs, gpuMs);
+        printf("%8d %-14s %10d %10.3f %10.3f %10.3f\n", count, "CPU, BVH", visibleCount, submitMs, frameMs, gpuMs);
+        freeScene(scene);
+        scene = NULL;
+        free_instances();
+
+        prepare_gpu_scene(count);
+        measure_frames(draw_gpu_culled, frames, submitMs, frameMs, gpuMs);
+        printf("%8d %-14s %10d %10.3f %10.3f %10.3f\n", count, "GPU, indirect", gpuVisibleCount(gpuScene), submitMs, frameMs, gpuMs);
+        free_gpu_scene();
+    }
+}
+
+
+/**
+ * Startup cost of the shader variants used by the modes above: all of them built from source with
+ * the program cache off, with an empty cache (compiled and saved), and with the cache filled by
+ * the previous pass (loaded). A comment with the current time goes into the sources, so that
+ * binaries saved by earlier runs do not match. The saved files are removed at the end.
+ */
+void shader_cache_benchmark() {
+    const int count = sizeof(shaderVariants) / sizeof(shaderVariants[0]);
+    const char *names[3] = {"no cache", "empty cache", "full cache"};
+
+    char salt[64];
+    sprintf(salt, "// shader-cache-benchmark %.0f\n", wallClockMs());
+
+    printf("%d programs\n%-12s %10s %6s %8s\n", count, "pass", "ms", "hits", "misses");
+    vector<string> files;
+    for (int pass = 0; pass < 3; pass++) {
+        set_program_cache(pass == 0 ? NULL : "shader_cache");
+        program_cache_stats before = get_program_cache_stats();
+        vector<shader_prog> programs;
+        glFinish();
+        double startTime = wallClockMs();
+        for (int i = 0; i < count; i++) {
+            programs.push_back(shader_prog(shaderVariants[i][0], shaderVariants[i][1]));
+            shader_prog &program = programs.back();
+            program.prepend(GL_VERTEX_SHADER, string(salt) + shaderVariants[i][2]);
+            program.prepend(GL_FRAGMENT_SHADER, string(salt) + shaderVariants[i][2]);
+            program.use();
+
+            // The driver may finish the work lazily, the link status waits for it
+            GLint linked;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        }
+        double ms = wallClockMs() - startTime;
+        program_cache_stats after = get_program_cache_stats();
+        printf("%-12s %10.2f %6d %8d\n", names[pass], ms, after.hits - before.hits, after.misses - before.misses);
+
+        for (int i = 0; i < count; i++) {
+            if (pass == 2) files.push_back(programs[i].cache_file());
+            programs[i].free();
+        }
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!files[i].empty()) remove(files[i].c_str());
+    }
+    if (files.empty() || files[0].empty()) printf("The driver cannot save program binaries\n");
+}
+
+
+/**
+ * Time until the first frame and until every shader variant is built from source: with use(),
+ * which waits for each program in turn before anything is drawn, and with all of them queued by
+ * use_async() while the single cube is drawn every frame and the queue is polled with ready().
+ * Each pass salts the sources, so the driver's own cache cannot serve the second from the first.
+ */
+void shader_compile_benchmark() {
+    const int count = sizeof(shaderVariants) / sizeof(shaderVariants[0]);
+    const char *names[2] = {"use()", "use_async()"};
+    set_program_cache(NULL);
+
+    printf("%d programs, parallel compile %s\n", count, parallel_shader_compile_supported() ? "supported" : "not supported");
+    printf("%-12s %14s %14s %8s\n", "pass", "first frame ms", "all built ms", "frames");
+    for (int pass = 0; pass < 2; pass++) {
+        char salt[64];
+        sprintf(salt, "// shader-compile-benchmark %d %.0f\n", pass, wallClockMs());
+        vector<shader_prog> programs;
+        for (int i = 0; i < count; i++) {
+            programs.push_back(shader_prog(shaderVariants[i][0], shaderVariants[i][1]));
+            programs.back().prepend(GL_VERTEX_SHADER, string(salt) + shaderVariants[i][2]);
+            programs.back().prepend(GL_FRAGMENT_SHADER, string(salt) + shaderVariants[i][2]);
+        }
+
+        glFinish();
+        double startTime = wallClockMs(), firstFrameMs = 0, builtMs = 0;
+        int pending = count, frames = 0;
+        vector<char> built(count, 0);
+        for (int i = 0; i < count; i++) {
+            if (pass == 0) programs[i].use();
+            else programs[i].use_async();
+        }
+        if (pass == 0) {
+            pending = 0;
+            builtMs = wallClockMs() - startTime;
+        }
+
+        // At least one frame, and more until the last program is built
+        while (frames == 0 || pending > 0) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            draw_cube(frames * 100.0f);
+            glFinish();
+            if (frames++ == 0) firstFrameMs = wallClockMs() - startTime;
+            for (int i = 0; i < count && pending > 0; i++) {
+                if (built[i] || !programs[i].ready()) continue;
+                built[i] = 1;
+                if (--pending == 0) builtMs = wallClockMs() - startTime;
+            }
+        }
+        printf("%-12s %14.2f %14.2f %8d\n", names[pass], firstFrameMs, builtMs, frames);
+        for (int i = 0; i < count; i++) programs[i].free();
+    }
+}
+
+
+/**
+ * Sets up the simulation and the shader that draws it
+ */
+void prepare_particles(int count) {
+    float *positions = new float[count * 4];
+    float *velocities = new float[count * 4];
+    nbodyInitialState(count, positions, velocities);
+    nbody = initNBody(count, positions, velocities, 0.001f, 0.05f);
+    delete[] positions;
+    delete[] velocities;
+
+    particleShader.use();
+    glBindFragDataLocation(particleShader, 0, "fragColor");
+    particleShader.uniform1i("positions", 0);
+    particleShader.uniform1i("width", nbody->width);
+    particleShader.uniform1f("averageMass", 1.0f / count);
+
+    // The vertex shader sets the point size
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+}
+
+
+/**
+ * Advances the simulation by one step and draws every body as a point.
+ * The vertex shader fetches the positions from the simulation texture, so
+ * no vertex buffer is needed and nothing is copied back to the CPU.
+ */
+void draw_particles(float t) {
+    stepNBody(nbody);
+
+    MatrixStack mvp;
+    mvp.Perspective(60, 1, 0.5, 100);
+    mvp.LookAt(glm::vec3(0, 1.5, 2.5), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+    mvp.Rotate(glm::vec3(0, 1, 0), t*0.01);
+
+    // The simulation has its own program and vertex array, so bind ours again
+    glUseProgram(particleShader);
+    glBindVertexArray(cubeVertexArrayHandle);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, nbodyPositions(nbody));
+    particleShader.uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(mvp.Top()));
+
+    glDrawArrays(GL_POINTS, 0, nbody->count);
 }
 
 
@@ -315,6 +2006,11 @@ void calculate_fps() {
         frameCount = 0;
 
         // Print out FPS to console
-        printf("FPS: %4.2f\n", fps);
+        if (city) printf("FPS: %4.2f, %d cubes in %d buildings drawn, %d buildings retested, %d impostors, planned in %.3f ms\n",
+                         fps, cityCubes, (int)city->drawn.size(), (int)city->retested.size(), (int)city->impostors.size(), city->planMs);
+        else if (gpuScene) printf("FPS: %4.2f, %d of %d cubes visible, culled on the GPU\n", fps, gpuVisibleCount(gpuScene), gpuScene->count);
+        else if (pipeline) printf("FPS: %4.2f, %d of %d cubes visible, built in %.2f ms\n", fps, (int)pipeline->visible, pipeline->count, pipeline->buildMs);
+        else if (scene) printf("FPS: %4.2f, %d of %d cubes visible, culled in %.3f ms\n", fps, visibleCount, scene->count, frustumCullTime);
+        else printf("FPS: %4.2f\n", fps);
     }
 }
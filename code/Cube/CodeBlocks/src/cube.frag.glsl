@@ -2,11 +2,19 @@
 
 out vec4 fragColor;
 in vec3 vertexNormal;
+#ifdef LIGHTS
+in vec3 vertexPosition;
+uniform int lightCount;         // Point lights, see phong.glsl
+#endif
 
 void main(void) {
 
     // --------------- Color --------------- //
-    fragColor = vec4(0.5, 0.5, 0.5, 0);
+#ifndef LIGHTS
+    // Grey, darker where the surface turns away from the viewer (who looks along -z)
+    float facing = abs(normalize(vertexNormal).z);
+    fragColor = vec4(vec3(0.5) * (0.4 + 0.6 * facing), 0);
+#endif
 
     // -------------- Lighting ------------- //
 
@@ -15,5 +23,14 @@ void main(void) {
     //     light_diffuse * material_diffuse * cos(light, normal) +
     //     light_specular * material_specular * cos(reflection, viewer)^shineniness
 
-    // ... TODO ... //
+#ifdef LIGHTS
+    // Forward shading: every light for every fragment
+    vec3 albedo = vec3(0.5);
+    vec3 normal = normalize(vertexNormal);
+    vec3 color = ambientLight * albedo;
+    for (int i = 0; i < lightCount; i++) {
+        color += phong(i, vertexPosition, normal, albedo);
+    }
+    fragColor = vec4(color, 1);
+#endif
 }
@@ -1,14 +1,55 @@
 #version 330
 
+#ifdef FRAME_BLOCK
+// The same matrices from a uniform buffer written once per frame (see stream_buffer.h)
+layout(std140) uniform Frame {
+    mat4 modelViewProjectionMatrix;
+    mat4 modelViewMatrix;
+    mat3 normalMatrix;
+};
+#else
 uniform mat4 modelViewProjectionMatrix;
+#if defined(PER_VERTEX_NORMAL_MATRIX) || defined(EYE_POSITION)
 uniform mat4 modelViewMatrix;
+#endif
+#ifndef PER_VERTEX_NORMAL_MATRIX
+uniform mat3 normalMatrix;      // Inverse transpose of the model view matrix, computed on the CPU
+#endif
+#endif
 
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
+#ifdef INSTANCED
+layout(location = 2) in mat4 instanceMatrix;        // Model matrix of the cube, locations 2-5
+layout(location = 6) in mat3 instanceNormalMatrix;  // Its inverse transpose, locations 6-8
+#endif
 out vec3 vertexNormal;
+#ifdef EYE_POSITION
+out vec3 vertexPosition;        // Eye space, for lighting
+#endif
 
 void main(void) {
-    mat3 normalMatrix = transpose(inverse(mat3(modelViewMatrix)));
-    vertexNormal = normalize(normalMatrix * normal);
-    gl_Position = modelViewProjectionMatrix*vec4(position, 1);
+#ifdef INSTANCED
+    mat4 modelViewProjection = modelViewProjectionMatrix * instanceMatrix;
+#else
+    mat4 modelViewProjection = modelViewProjectionMatrix;
+#endif
+
+#if defined(PER_VERTEX_NORMAL_MATRIX) && defined(INSTANCED)
+    mat3 vertexNormalMatrix = transpose(inverse(mat3(modelViewMatrix * instanceMatrix)));
+#elif defined(PER_VERTEX_NORMAL_MATRIX)
+    mat3 vertexNormalMatrix = transpose(inverse(mat3(modelViewMatrix)));
+#elif defined(INSTANCED)
+    mat3 vertexNormalMatrix = normalMatrix * instanceNormalMatrix;  // (V M)^-T = V^-T M^-T
+#else
+    mat3 vertexNormalMatrix = normalMatrix;
+#endif
+    vertexNormal = normalize(vertexNormalMatrix * normal);
+    gl_Position = modelViewProjection*vec4(position, 1);
+
+#if defined(EYE_POSITION) && defined(INSTANCED)
+    vertexPosition = vec3(modelViewMatrix * instanceMatrix * vec4(position, 1));
+#elif defined(EYE_POSITION)
+    vertexPosition = vec3(modelViewMatrix * vec4(position, 1));
+#endif
 }
@@ -0,0 +1,235 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Deferred shading with many point lights.
+ */
+#include "deferred.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// A texture buffer over a buffer object
+static void initTextureBuffer(GLuint *buffer, GLuint *texture, GLenum internalFormat) {
+    glGenBuffers(1, buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, *buffer);
+    glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+    glGenTextures(1, texture);
+    glBindTexture(GL_TEXTURE_BUFFER, *texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, internalFormat, *buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// Replace the contents of a texture buffer (an empty one still gets one element)
+template <typename T>
+static void uploadTextureBuffer(GLuint buffer, const std::vector<T> &data) {
+    static const GLint empty[4] = {0, 0, 0, 0};
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    if (data.empty()) glBufferData(GL_TEXTURE_BUFFER, sizeof(empty), empty, GL_STREAM_DRAW);
+    else glBufferData(GL_TEXTURE_BUFFER, data.size() * sizeof(T), &data[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+struct LightSet *initLights(int count) {
+    struct LightSet *lights = new LightSet;
+    lights->count = count;
+    srand(7);
+    for (int i = 0; i < count; i++) {
+        glm::vec3 position(2.0f * rand() / RAND_MAX - 1, 2.0f * rand() / RAND_MAX - 1, 2.0f * rand() / RAND_MAX - 1);
+        float radius = 0.2f + 0.2f * rand() / RAND_MAX;
+        glm::vec3 color(0.2f + 0.8f * rand() / RAND_MAX, 0.2f + 0.8f * rand() / RAND_MAX, 0.2f + 0.8f * rand() / RAND_MAX);
+        lights->world.push_back(glm::vec4(position, radius));
+        lights->world.push_back(glm::vec4(color, 0));
+    }
+    lights->eye = lights->world;
+    initTextureBuffer(&lights->buffer, &lights->texture, GL_RGBA32F);
+    return lights;
+}
+
+void freeLights(struct LightSet *lights) {
+    glDeleteTextures(1, &lights->texture);
+    glDeleteBuffers(1, &lights->buffer);
+    delete lights;
+}
+
+void updateLights(struct LightSet *lights, const glm::mat4 &view) {
+    for (int i = 0; i < lights->count; i++) {
+        glm::vec4 world = lights->world[2 * i];
+        glm::vec4 eye = view * glm::vec4(glm::vec3(world), 1);
+        lights->eye[2 * i] = glm::vec4(glm::vec3(eye), world.w);
+    }
+    uploadTextureBuffer(lights->buffer, lights->eye);
+}
+
+static GLuint gbufferTexture(GLenum internalFormat, GLenum format, GLenum type, int width, int height) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    return texture;
+}
+
+struct GBuffer *initGBuffer(int width, int height) {
+    struct GBuffer *gbuffer = new GBuffer;
+    gbuffer->width = width;
+    gbuffer->height = height;
+    gbuffer->normals = gbufferTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT, width, height);
+    gbuffer->albedo = gbufferTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+    gbuffer->depth = gbufferTexture(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, width, height);
+
+    glGenVertexArrays(1, &gbuffer->vao);
+
+    glGenFramebuffers(1, &gbuffer->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, gbuffer->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gbuffer->normals, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gbuffer->albedo, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gbuffer->depth, 0);
+    const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        throw std::runtime_error("G-buffer framebuffer is not complete");
+    }
+    return gbuffer;
+}
+
+void freeGBuffer(struct GBuffer *gbuffer) {
+    glDeleteFramebuffers(1, &gbuffer->fbo);
+    glDeleteTextures(1, &gbuffer->normals);
+    glDeleteTextures(1, &gbuffer->albedo);
+    glDeleteTextures(1, &gbuffer->depth);
+    glDeleteVertexArrays(1, &gbuffer->vao);
+    delete gbuffer;
+}
+
+struct LightTiles *initLightTiles(int width, int height) {
+    struct LightTiles *tiles = new LightTiles;
+    tiles->columns = (width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+    tiles->rows = (height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+    tiles->listedLights = 0;
+    initTextureBuffer(&tiles->rangeBuffer, &tiles->rangeTexture, GL_RG32I);
+    initTextureBuffer(&tiles->indexBuffer, &tiles->indexTexture, GL_R32I);
+    return tiles;
+}
+
+void freeLightTiles(struct LightTiles *tiles) {
+    glDeleteTextures(1, &tiles->rangeTexture);
+    glDeleteTextures(1, &tiles->indexTexture);
+    glDeleteBuffers(1, &tiles->rangeBuffer);
+    glDeleteBuffers(1, &tiles->indexBuffer);
+    delete tiles;
+}
+
+void cullLights(struct LightTiles *tiles, struct LightSet *lights, const glm::mat4 &projection, float zNear) {
+    int tileCount = tiles->columns * tiles->rows;
+    std::vector<int> first(lights->count), last(lights->count);     // Tile rectangles, x0 y0 / x1 y1 packed
+    std::vector<GLint> counts(tileCount, 0);
+
+    for (int i = 0; i < lights->count; i++) {
+        glm::vec4 light = lights->eye[2 * i];
+        glm::vec3 center(light);
+        float radius = light.w;
+        first[i] = -1;
+
+        // The camera looks along -z: skip lights entirely behind the near plane
+        if (center.z - radius > -zNear) continue;
+
+        int x0 = 0, y0 = 0, x1 = tiles->columns - 1, y1 = tiles->rows - 1;
+        if (center.z + radius < -zNear) {
+            // Screen rectangle of the 8 corners of the sphere's bounding box
+            float minX = 1, minY = 1, maxX = -1, maxY = -1;
+            for (int corner = 0; corner < 8; corner++) {
+                glm::vec3 offset(corner & 1 ? radius : -radius, corner & 2 ? radius : -radius, corner & 4 ? radius : -radius);
+                glm::vec4 clip = projection * glm::vec4(center + offset, 1);
+                float x = clip.x / clip.w, y = clip.y / clip.w;
+                minX = std::min(minX, x);
+                maxX = std::max(maxX, x);
+                minY = std::min(minY, y);
+                maxY = std::max(maxY, y);
+            }
+            if (maxX < -1 || maxY < -1 || minX > 1 || minY > 1) continue;
+            x0 = std::max(0, (int)floor((minX * 0.5f + 0.5f) * tiles->columns));
+            y0 = std::max(0, (int)floor((minY * 0.5f + 0.5f) * tiles->rows));
+            x1 = std::min(tiles->columns - 1, (int)floor((maxX * 0.5f + 0.5f) * tiles->columns));
+            y1 = std::min(tiles->rows - 1, (int)floor((maxY * 0.5f + 0.5f) * tiles->rows));
+        }
+        // Otherwise the sphere reaches the near plane and may cover any tile
+
+        first[i] = x0 | y0 << 16;
+        last[i] = x1 | y1 << 16;
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) counts[y * tiles->columns + x]++;
+        }
+    }
+
+    // Offsets from the counts, then fill the lists
+    tiles->ranges.resize(2 * tileCount);
+    GLint offset = 0;
+    for (int tile = 0; tile < tileCount; tile++) {
+        tiles->ranges[2 * tile] = offset;
+        tiles->ranges[2 * tile + 1] = 0;
+        offset += counts[tile];
+    }
+    tiles->indices.resize(offset);
+    tiles->listedLights = offset;
+    for (int i = 0; i < lights->count; i++) {
+        if (first[i] < 0) continue;
+        for (int y = first[i] >> 16; y <= last[i] >> 16; y++) {
+            for (int x = first[i] & 0xffff; x <= (last[i] & 0xffff); x++) {
+                GLint *range = &tiles->ranges[2 * (y * tiles->columns + x)];
+                tiles->indices[range[0] + range[1]++] = i;
+            }
+        }
+    }
+
+    uploadTextureBuffer(tiles->rangeBuffer, tiles->ranges);
+    uploadTextureBuffer(tiles->indexBuffer, tiles->indices);
+}
+
+void addPhong(shader_prog &program) {
+    program.prepend(GL_FRAGMENT_SHADER, get_file_contents("../src/phong.glsl"));
+}
+
+shader_prog *initLightingShader() {
+    shader_prog *shader = new shader_prog("../src/fullscreen.vert.glsl", "../src/deferred_light.frag.glsl");
+    std::ostringstream defines;
+    defines << "#define LIGHT_TILE_SIZE " << LIGHT_TILE_SIZE << "\n";
+    shader->prepend(GL_FRAGMENT_SHADER, defines.str());
+    addPhong(*shader);
+    shader->use();
+    shader->uniform1i("normals", 0);
+    shader->uniform1i("albedos", 1);
+    shader->uniform1i("depths", 2);
+    shader->uniform1i("lights", 3);
+    shader->uniform1i("tileRanges", 4);
+    shader->uniform1i("tileLights", 5);
+    return shader;
+}
+
+void shadeDeferred(shader_prog *lightingShader, struct GBuffer *gbuffer, struct LightSet *lights,
+                   struct LightTiles *tiles, const glm::mat4 &projection) {
+    const GLenum targets[6] = {GL_TEXTURE_2D, GL_TEXTURE_2D, GL_TEXTURE_2D, GL_TEXTURE_BUFFER, GL_TEXTURE_BUFFER, GL_TEXTURE_BUFFER};
+    const GLuint textures[6] = {gbuffer->normals, gbuffer->albedo, gbuffer->depth,
+                                lights->texture, tiles->rangeTexture, tiles->indexTexture};
+    for (int unit = 5; unit >= 0; unit--) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(targets[unit], textures[unit]);
+    }
+
+    glUseProgram(*lightingShader);
+    lightingShader->uniformMatrix4fv("inverseProjection", glm::value_ptr(glm::inverse(projection)));
+    lightingShader->uniform1i("tileColumns", tiles->columns);
+
+    // The depth of the scene is already resolved, the triangle must not be depth tested
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(gbuffer->vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,83 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Deferred shading with many point lights.
+ *
+ * Forward shading evaluates every light for every fragment of every object, including
+ * fragments that are hidden later. Deferred shading splits the frame in two:
+ *  1. geometry pass: the scene is drawn once into a G-buffer holding the eye space normal,
+ *     the albedo and the depth of the visible surface under every pixel
+ *  2. lighting pass: a full-screen triangle shades every pixel once, reconstructing the eye
+ *     space position from the depth
+ * The lights have a limited radius. Before the lighting pass the screen is divided into
+ * LIGHT_TILE_SIZE x LIGHT_TILE_SIZE pixel tiles and every light is added to the list of the tiles
+ * its bounding sphere covers (tiled light culling), so a pixel only loops over the lights
+ * of its own tile.
+ *
+ * The Phong model itself is in phong.glsl, which is prepended to both the forward and
+ * the deferred fragment shaders.
+ */
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <GL/glew.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "shader_util.h"
+
+#define LIGHT_TILE_SIZE 16
+
+// Point lights in a texture buffer, 2 RGBA32F texels per light in eye space:
+// (position, radius) and (color, 0)
+typedef struct LightSet {
+    int count;
+    std::vector<glm::vec4> world;   // The same pairs in world space
+    std::vector<glm::vec4> eye;     // Transformed by updateLights
+    GLuint buffer, texture;
+} LightSet;
+
+// Random lights inside [-1, 1]^3
+struct LightSet *initLights(int count);
+void freeLights(struct LightSet *lights);
+
+// Transform the lights into eye space and upload them
+void updateLights(struct LightSet *lights, const glm::mat4 &view);
+
+// Textures written by the geometry pass
+typedef struct GBuffer {
+    int width, height;
+    GLuint fbo;
+    GLuint normals;     // RGBA16F, eye space normal
+    GLuint albedo;      // RGBA8
+    GLuint depth;       // DEPTH_COMPONENT32F
+    GLuint vao;         // Empty vertex array for the full-screen triangle of the lighting pass
+} GBuffer;
+
+struct GBuffer *initGBuffer(int width, int height);
+void freeGBuffer(struct GBuffer *gbuffer);
+
+// Per-tile light lists: ranges holds (offset, count) into indices for every tile
+typedef struct LightTiles {
+    int columns, rows;
+    std::vector<GLint> ranges, indices;
+    GLuint rangeBuffer, rangeTexture;   // RG32I texture buffer
+    GLuint indexBuffer, indexTexture;   // R32I texture buffer
+    long listedLights;                  // Sum of the list lengths after the last cullLights
+} LightTiles;
+
+struct LightTiles *initLightTiles(int width, int height);
+void freeLightTiles(struct LightTiles *tiles);
+
+// Bin the (eye space) lights into tiles by the screen rectangle of their bounding spheres
+void cullLights(struct LightTiles *tiles, struct LightSet *lights, const glm::mat4 &projection, float zNear);
+
+// Lighting pass shader, reading the G-buffer and the tile lists
+shader_prog *initLightingShader();
+
+// Shade every pixel of the current framebuffer from the G-buffer
+void shadeDeferred(shader_prog *lightingShader, struct GBuffer *gbuffer, struct LightSet *lights,
+                   struct LightTiles *tiles, const glm::mat4 &projection);
+
+// Prepend the Phong model to the fragment shader of a program (before use())
+void addPhong(shader_prog &program);
+
+#endif
@@ -0,0 +1,37 @@
+#version 330
+// Fragment shader of the lighting pass: one invocation per pixel, lights from the tile's list
+
+uniform sampler2D normals;
+uniform sampler2D albedos;
+uniform sampler2D depths;
+uniform isamplerBuffer tileRanges;  // (offset, count) into tileLights for every tile
+uniform isamplerBuffer tileLights;  // Light indices
+uniform int tileColumns;
+uniform mat4 inverseProjection;
+
+out vec4 fragColor;
+
+void main(void) {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(depths, pixel, 0).r;
+    if (depth == 1.0) {
+        fragColor = vec4(0.0);      // Background
+        return;
+    }
+
+    // Eye space position from the depth
+    vec2 viewportSize = vec2(textureSize(depths, 0));
+    vec4 ndc = vec4(gl_FragCoord.xy / viewportSize * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 eye = inverseProjection * ndc;
+    vec3 position = eye.xyz / eye.w;
+    vec3 normal = texelFetch(normals, pixel, 0).xyz;
+    vec3 albedo = texelFetch(albedos, pixel, 0).rgb;
+
+    ivec2 tile = pixel / LIGHT_TILE_SIZE;
+    ivec2 range = texelFetch(tileRanges, tile.y * tileColumns + tile.x).xy;
+    vec3 color = ambientLight * albedo;
+    for (int i = 0; i < range.y; i++) {
+        color += phong(texelFetch(tileLights, range.x + i).r, position, normal, albedo);
+    }
+    fragColor = vec4(color, 1.0);
+}
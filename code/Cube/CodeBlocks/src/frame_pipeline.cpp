@@ -0,0 +1,178 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Building frames on worker threads while the render thread draws.
+ */
+#include "frame_pipeline.h"
+#include <stdlib.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include "scene.h"
+#include "timer_util.h"
+
+static void initPacketQueue(struct PacketQueue *queue, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size *= 2;
+    queue->cells = std::vector<PacketCell>(size);
+    for (size_t i = 0; i < size; i++) queue->cells[i].sequence = i;
+    queue->mask = size - 1;
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+bool pushPacket(struct PacketQueue *queue, const DrawPacket &packet) {
+    size_t position = queue->tail.load(std::memory_order_relaxed);
+    for (;;) {
+        PacketCell &cell = queue->cells[position & queue->mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        long difference = (long)sequence - (long)position;
+        if (difference == 0) {
+            // The cell is free: claim it by moving the tail past it
+            if (queue->tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.packet = packet;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;       // Still holds a packet from one round ago: full
+        } else {
+            position = queue->tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool popPacket(struct PacketQueue *queue, DrawPacket *packet) {
+    size_t position = queue->head.load(std::memory_order_relaxed);
+    for (;;) {
+        PacketCell &cell = queue->cells[position & queue->mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        long difference = (long)sequence - (long)(position + 1);
+        if (difference == 0) {
+            if (queue->head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                *packet = cell.packet;
+                // Free for the push one round later
+                cell.sequence.store(position + queue->mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;       // Not filled yet: empty
+        } else {
+            position = queue->head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static void push(struct FramePipeline *pipeline, const DrawPacket &packet) {
+    while (!pushPacket(&pipeline->queue, packet)) std::this_thread::yield();
+}
+
+// Animate and cull cubes [begin, end) of a frame, and hand the visible ones to the render thread
+static void buildPiece(struct FramePipeline *pipeline, int frame, float t, const Frustum &frustum, int begin, int end) {
+    std::vector<InstanceData> &instances = pipeline->instances[frame % PIPELINE_FRAMES];
+    int visible = 0;
+    for (int i = begin; i < end; i++) {
+        // The bounding sphere does not move while the cube spins around its center
+        glm::vec4 sphere = pipeline->spheres[i];
+        bool inside = true;
+        for (int plane = 0; plane < 6 && inside; plane++) {
+            inside = frustum.nx[plane] * sphere.x + frustum.ny[plane] * sphere.y + frustum.nz[plane] * sphere.z +
+                     frustum.d[plane] >= -sphere.w;
+        }
+        if (!inside) continue;
+
+        glm::vec4 axis = pipeline->axes[i];
+        glm::mat4 spin = glm::translate(glm::mat4(1), glm::vec3(0.5f));
+        spin = glm::rotate(spin, axis.w * t / 1000, glm::vec3(axis));
+        spin = glm::translate(spin, glm::vec3(-0.5f));
+
+        InstanceData &instance = instances[begin + visible++];
+        instance.model = pipeline->rest[i] * spin;
+        instance.normalMatrix = glm::inverseTranspose(glm::mat3(instance.model));
+    }
+    if (visible > 0) {
+        DrawPacket packet = {frame, begin, visible, 0, 0};
+        push(pipeline, packet);
+    }
+    pipeline->building += visible;
+}
+
+static void builder(struct FramePipeline *pipeline) {
+    for (int frame = 0; !pipeline->stopping; frame++) {
+        // The instance array of this frame was last used PIPELINE_FRAMES frames ago
+        while (pipeline->renderedFrames < frame - PIPELINE_FRAMES + 1 && !pipeline->stopping) {
+            std::this_thread::yield();
+        }
+        if (pipeline->stopping) break;
+
+        double startTime = wallClockMs();
+        float t = (float)(startTime - pipeline->startTime);
+        int slot = frame % PIPELINE_FRAMES;
+        pipeline->camera(pipeline->viewProjection[slot], pipeline->view[slot], t);
+        Frustum frustum = frustumPlanes(pipeline->viewProjection[slot]);
+
+        pipeline->building = 0;
+        parallelFor(pipeline->pool, pipeline->count, PIPELINE_GRAIN, [&](int begin, int end) {
+            buildPiece(pipeline, frame, t, frustum, begin, end);
+        });
+        DrawPacket end = {frame, 0, -1, pipeline->building, (float)(wallClockMs() - startTime)};
+        push(pipeline, end);
+    }
+    pipeline->finished = true;
+}
+
+struct FramePipeline *initPipeline(const std::vector<glm::mat4> &models, int threads, PipelineCamera camera) {
+    struct FramePipeline *pipeline = new FramePipeline;
+    int count = pipeline->count = (int)models.size();
+    pipeline->rest = models;
+    pipeline->camera = camera;
+
+    srand(2);
+    for (int i = 0; i < count; i++) {
+        glm::vec3 axis(rand() % 100 + 1, rand() % 100, rand() % 100);
+        pipeline->axes.push_back(glm::vec4(glm::normalize(axis), 30 + rand() % 90));
+        glm::vec3 center(models[i] * glm::vec4(0.5f, 0.5f, 0.5f, 1));
+        glm::vec3 corner(models[i] * glm::vec4(1, 1, 1, 1));
+        pipeline->spheres.push_back(glm::vec4(center, glm::length(corner - center)));
+    }
+    for (int i = 0; i < PIPELINE_FRAMES; i++) pipeline->instances[i].resize(count);
+
+    // Enough cells for every packet of all the frames in flight
+    initPacketQueue(&pipeline->queue, (size_t)PIPELINE_FRAMES * (count / PIPELINE_GRAIN + 2) * 2);
+    pipeline->pool = initJobPool(threads);
+    pipeline->stopping = false;
+    pipeline->finished = false;
+    pipeline->renderedFrames = 0;
+    pipeline->building = 0;
+    pipeline->visible = 0;
+    pipeline->buildMs = 0;
+    pipeline->startTime = wallClockMs();
+    pipeline->builder = std::thread(builder, pipeline);
+    return pipeline;
+}
+
+void freePipeline(struct FramePipeline *pipeline) {
+    pipeline->stopping = true;
+
+    // The builder may be waiting for room in the queue, keep emptying it until it has stopped
+    DrawPacket packet;
+    while (!pipeline->finished) {
+        while (popPacket(&pipeline->queue, &packet)) {}
+        std::this_thread::yield();
+    }
+    pipeline->builder.join();
+    freeJobPool(pipeline->pool);
+    delete pipeline;
+}
+
+DrawPacket nextPacket(struct FramePipeline *pipeline) {
+    DrawPacket packet;
+    while (!popPacket(&pipeline->queue, &packet)) std::this_thread::yield();
+    if (packet.count < 0) {
+        pipeline->visible = packet.visible;
+        pipeline->buildMs = packet.buildMs;
+    }
+    return packet;
+}
+
+void finishFrame(struct FramePipeline *pipeline) {
+    pipeline->renderedFrames++;
+}
@@ -0,0 +1,97 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Building frames on worker threads while the render thread draws.
+ *
+ * GLUT calls display() on the thread that owns the OpenGL context, and only that thread may
+ * submit draw calls. Everything else a frame needs (animating the cubes, their normal matrices,
+ * frustum culling) happens here on a builder thread one or two frames ahead:
+ *  - the builder splits the cubes between the threads of a work-stealing pool (job_pool.h)
+ *  - every piece writes its visible cubes into the instance array of the frame and pushes
+ *    a draw packet with their range into a queue
+ *  - when all pieces are done, the builder pushes a packet that ends the frame
+ * The render thread pops the packets of a frame, copies their instances to the GPU and draws them.
+ * The queue is a bounded lock-free queue (Dmitry Vyukov's design): every cell carries a sequence
+ * number telling producers and the consumer whether it is free or filled.
+ * A frame has PIPELINE_FRAMES instance arrays, so the builder waits before reusing the array
+ * of a frame the render thread has not finished yet.
+ */
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <glm/glm.hpp>
+#include "job_pool.h"
+
+#define PIPELINE_FRAMES 3
+#define PIPELINE_GRAIN 1024     // Cubes per draw packet at most
+
+// Interleaved per-instance attributes
+typedef struct InstanceData {
+    glm::mat4 model;
+    glm::mat3 normalMatrix;
+} InstanceData;
+
+typedef struct DrawPacket {
+    int frame;
+    int first, count;           // Instances of the frame's array. A count of -1 ends the frame.
+    int visible;                // Only in the packet that ends a frame: cubes of the frame
+    float buildMs;              // and the builder time
+} DrawPacket;
+
+typedef struct PacketCell {
+    std::atomic<size_t> sequence;
+    DrawPacket packet;
+} PacketCell;
+
+// Bounded multi-producer multi-consumer queue
+typedef struct PacketQueue {
+    std::vector<PacketCell> cells;  // A power of two of them
+    size_t mask;
+    std::atomic<size_t> head;       // Next cell to pop
+    std::atomic<size_t> tail;       // Next cell to push
+} PacketQueue;
+
+// Both return false instead of waiting when the queue is full / empty
+bool pushPacket(struct PacketQueue *queue, const DrawPacket &packet);
+bool popPacket(struct PacketQueue *queue, DrawPacket *packet);
+
+// Camera of the frame at time t in milliseconds
+typedef void (*PipelineCamera)(glm::mat4 &viewProjection, glm::mat4 &view, float t);
+
+typedef struct FramePipeline {
+    int count;                                      // Cubes in the scene
+    std::vector<glm::mat4> rest;                    // Model matrices of the unit cubes before animation
+    std::vector<glm::vec4> axes;                    // Spin axis and speed in degrees per second
+    std::vector<glm::vec4> spheres;                 // World space bounding spheres
+    std::vector<InstanceData> instances[PIPELINE_FRAMES];
+    glm::mat4 viewProjection[PIPELINE_FRAMES], view[PIPELINE_FRAMES];
+    PipelineCamera camera;
+
+    struct JobPool *pool;
+    struct PacketQueue queue;
+    std::thread builder;
+    std::atomic<bool> stopping;
+    std::atomic<bool> finished;                     // Set by the builder when it has stopped
+    std::atomic<int> renderedFrames;                // Frames the render thread has finished
+    std::atomic<int> building;                      // Visible cubes of the frame being built
+    double startTime;                               // Wall clock of frame time 0
+
+    // Statistics of the last frame popped by the render thread, for the render thread only
+    int visible;                                    // Cubes drawn
+    double buildMs;                                 // Builder time
+} FramePipeline;
+
+// Start building frames of the given cubes (model matrices of unit cubes) with threads workers
+struct FramePipeline *initPipeline(const std::vector<glm::mat4> &models, int threads, PipelineCamera camera);
+void freePipeline(struct FramePipeline *pipeline);
+
+// Render thread: pop the next packet, waiting for the builder if needed.
+// The packet that ends a frame also sets visible and buildMs.
+DrawPacket nextPacket(struct FramePipeline *pipeline);
+
+// Render thread: the instances of the frame are no longer needed
+void finishFrame(struct FramePipeline *pipeline);
+
+#endif
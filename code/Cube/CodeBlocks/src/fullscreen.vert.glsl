@@ -0,0 +1,7 @@
+#version 330
+// Vertex shader: a triangle covering the whole viewport, without any vertex data
+
+void main(void) {
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0, 1);
+}
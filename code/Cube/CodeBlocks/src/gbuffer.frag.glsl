@@ -0,0 +1,11 @@
+#version 330
+// Fragment shader of the geometry pass: only stores what the lighting pass needs
+
+in vec3 vertexNormal;
+layout(location = 0) out vec4 normalOut;
+layout(location = 1) out vec4 albedoOut;
+
+void main(void) {
+    normalOut = vec4(normalize(vertexNormal), 0.0);
+    albedoOut = vec4(0.5, 0.5, 0.5, 1.0);
+}
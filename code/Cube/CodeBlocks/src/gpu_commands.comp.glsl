@@ -0,0 +1,34 @@
+#version 430
+// One indirect draw command per chunk of culled instances, then the counters start over
+
+layout(local_size_x = GPU_CULL_GROUP_SIZE) in;
+
+layout(std430, binding = 2) buffer Counts { uint counts[]; };
+layout(std430, binding = 3) writeonly buffer Commands { uint commands[]; };
+
+uniform int chunks;
+uniform int elements;           // Vertices or indices of one instance
+
+void main(void)
+{
+    uint chunk = gl_GlobalInvocationID.x;
+    if (chunk >= uint(chunks)) return;
+
+#ifdef INDEXED
+    // DrawElementsIndirectCommand: count, instanceCount, firstIndex, baseVertex, baseInstance
+    uint command = 5u * chunk;
+    commands[command + 0u] = uint(elements);
+    commands[command + 1u] = counts[chunk];
+    commands[command + 2u] = 0u;
+    commands[command + 3u] = 0u;
+    commands[command + 4u] = chunk * GPU_CULL_CHUNK;
+#else
+    // DrawArraysIndirectCommand: count, instanceCount, first, baseInstance
+    uint command = 4u * chunk;
+    commands[command + 0u] = uint(elements);
+    commands[command + 1u] = counts[chunk];
+    commands[command + 2u] = 0u;
+    commands[command + 3u] = chunk * GPU_CULL_CHUNK;
+#endif
+    counts[chunk] = 0u;
+}
@@ -0,0 +1,36 @@
+#version 430
+// Frustum culling: every visible instance is appended to the list of its chunk (see gpu_culling.h)
+
+layout(local_size_x = GPU_CULL_GROUP_SIZE) in;
+
+struct Instance {
+    mat4 model;
+    mat3 normalMatrix;          // Three vec4 columns in std430
+};
+
+layout(std430, binding = 0) readonly buffer Instances { Instance instances[]; };
+layout(std430, binding = 1) writeonly buffer Visible { Instance visible[]; };
+layout(std430, binding = 2) buffer Counts { uint counts[]; };
+
+uniform int count;              // Number of instances
+uniform vec4 planes[6];         // Frustum planes, inside when dot(plane.xyz, p) + plane.w >= 0
+
+void main(void)
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uint(count)) return;
+
+    // World space bounding box of the unit cube, as a center and half its size
+    mat4 model = instances[i].model;
+    vec3 center = vec3(model * vec4(0.5, 0.5, 0.5, 1));
+    vec3 extent = 0.5 * (abs(model[0].xyz) + abs(model[1].xyz) + abs(model[2].xyz));
+    for (int p = 0; p < 6; p++) {
+        float distance = dot(planes[p].xyz, center) + planes[p].w;
+        float radius = dot(abs(planes[p].xyz), extent);
+        if (distance + radius < 0.0) return;
+    }
+
+    uint chunk = i / GPU_CULL_CHUNK;
+    uint slot = atomicAdd(counts[chunk], 1u);
+    visible[chunk * GPU_CULL_CHUNK + slot] = instances[i];
+}
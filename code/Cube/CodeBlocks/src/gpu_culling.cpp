@@ -0,0 +1,134 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * GPU-driven drawing: frustum culling in a compute shader and indirect draw calls (OpenGL 4.3).
+ */
+#include "gpu_culling.h"
+#include <stddef.h>
+#include <sstream>
+#include <glm/gtc/type_ptr.hpp>
+#include "scene.h"
+
+bool gpuCullingSupported() {
+    return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object &&
+                                GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+}
+
+static GLuint storageBuffer(long bytes, const void *data, GLenum usage) {
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, data, usage);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return buffer;
+}
+
+static shader_prog *computeShader(const char *filename, bool indexed) {
+    shader_prog *shader = new shader_prog(filename);
+    std::ostringstream defines;
+    defines << "#define GPU_CULL_GROUP_SIZE " << GPU_CULL_GROUP_SIZE << "\n";
+    defines << "#define GPU_CULL_CHUNK " << GPU_CULL_CHUNK << "u\n";
+    if (indexed) defines << "#define INDEXED\n";
+    shader->prepend(GL_COMPUTE_SHADER, defines.str());
+    shader->use();
+    return shader;
+}
+
+struct GPUScene *initGPUScene(const std::vector<glm::mat4> &models, const std::vector<glm::mat3> &normalMatrices,
+                              int elements, GLenum indexType) {
+    struct GPUScene *scene = new GPUScene;
+    scene->count = (int)models.size();
+    scene->chunks = (scene->count + GPU_CULL_CHUNK - 1) / GPU_CULL_CHUNK;
+    scene->elements = elements;
+    scene->indexType = indexType;
+
+    std::vector<GPUInstance> instances(scene->count);
+    for (int i = 0; i < scene->count; i++) {
+        instances[i].model = models[i];
+        for (int column = 0; column < 3; column++) instances[i].normalMatrix[column] = glm::vec4(normalMatrices[i][column], 0);
+    }
+    long bytes = (long)scene->count * sizeof(GPUInstance);
+    scene->instances = storageBuffer(bytes, &instances[0], GL_STATIC_DRAW);
+
+    // Every chunk has room for all its instances, the lists are written by the GPU only
+    scene->visible = storageBuffer((long)scene->chunks * GPU_CULL_CHUNK * sizeof(GPUInstance), NULL, GL_DYNAMIC_COPY);
+    std::vector<GLuint> zeros(scene->chunks, 0);
+    scene->counts = storageBuffer(scene->chunks * sizeof(GLuint), &zeros[0], GL_DYNAMIC_COPY);
+    int commandSize = indexType ? 5 : 4;
+    scene->commands = storageBuffer((long)scene->chunks * commandSize * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+
+    scene->cullShader = computeShader("../src/gpu_cull.comp.glsl", indexType != 0);
+    scene->commandShader = computeShader("../src/gpu_commands.comp.glsl", indexType != 0);
+    return scene;
+}
+
+void freeGPUScene(struct GPUScene *scene) {
+    GLuint buffers[4] = {scene->instances, scene->visible, scene->counts, scene->commands};
+    glDeleteBuffers(4, buffers);
+    scene->cullShader->free();
+    scene->commandShader->free();
+    delete scene->cullShader;
+    delete scene->commandShader;
+    delete scene;
+}
+
+void bindGPUInstances(struct GPUScene *scene) {
+    glBindBuffer(GL_ARRAY_BUFFER, scene->visible);
+    for (int column = 0; column < 4; column++) {
+        glEnableVertexAttribArray(2 + column);
+        glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(GPUInstance),
+                              (const GLvoid*)(offsetof(GPUInstance, model) + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(2 + column, 1);
+    }
+    for (int column = 0; column < 3; column++) {
+        glEnableVertexAttribArray(6 + column);
+        glVertexAttribPointer(6 + column, 3, GL_FLOAT, GL_FALSE, sizeof(GPUInstance),
+                              (const GLvoid*)(offsetof(GPUInstance, normalMatrix) + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(6 + column, 1);
+    }
+}
+
+void cullGPUScene(struct GPUScene *scene, const glm::mat4 &viewProjection) {
+    Frustum frustum = frustumPlanes(viewProjection);
+    glm::vec4 planes[6];
+    for (int i = 0; i < 6; i++) planes[i] = glm::vec4(frustum.nx[i], frustum.ny[i], frustum.nz[i], frustum.d[i]);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, scene->instances);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, scene->visible);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, scene->counts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, scene->commands);
+
+    glUseProgram(*scene->cullShader);
+    scene->cullShader->uniform1i("count", scene->count);
+    scene->cullShader->uniform4fv("planes", 6, glm::value_ptr(planes[0]));
+    glDispatchCompute((scene->count + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(*scene->commandShader);
+    scene->commandShader->uniform1i("chunks", scene->chunks);
+    scene->commandShader->uniform1i("elements", scene->elements);
+    glDispatchCompute((scene->chunks + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+
+    // The commands are read by the draw call and by gpuVisibleCount (glGetBufferSubData),
+    // the lists as vertex attributes
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                    GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void drawGPUScene(struct GPUScene *scene) {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, scene->commands);
+    if (scene->indexType) glMultiDrawElementsIndirect(GL_TRIANGLES, scene->indexType, 0, scene->chunks, 0);
+    else glMultiDrawArraysIndirect(GL_TRIANGLES, 0, scene->chunks, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+int gpuVisibleCount(struct GPUScene *scene) {
+    int commandSize = scene->indexType ? 5 : 4;
+    std::vector<GLuint> commands(scene->chunks * commandSize);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, scene->commands);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commands.size() * sizeof(GLuint), &commands[0]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    int visible = 0;
+    for (int chunk = 0; chunk < scene->chunks; chunk++) visible += commands[chunk * commandSize + 1];
+    return visible;
+}
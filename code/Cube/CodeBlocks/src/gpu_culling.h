@@ -0,0 +1,70 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * GPU-driven drawing: frustum culling in a compute shader and indirect draw calls (OpenGL 4.3).
+ *
+ * Culling on the CPU (see scene.h) still costs the CPU time proportional to the scene, and
+ * the visible instances have to be copied into a buffer every frame. Here the instances
+ * stay in a shader storage buffer (SSBO) and the GPU decides what to draw:
+ *  1. a compute shader tests every instance against the frustum planes and appends the
+ *     visible ones to the list of its chunk of GPU_CULL_CHUNK instances, counting them
+ *     with an atomic counter per chunk
+ *  2. a second compute shader turns every chunk count into an indirect draw command
+ *     (vertex or index count, instance count, first instance = start of the chunk's list)
+ *     and resets the counters for the next frame
+ *  3. glMultiDrawArraysIndirect (or glMultiDrawElementsIndirect) reads the commands from
+ *     GL_DRAW_INDIRECT_BUFFER and draws all the chunks
+ * The CPU issues the same three calls whatever the number of instances and never waits
+ * for the GPU. Chunked lists keep every drawn instance within the range of its chunk, though
+ * not in the original order (atomicAdd hands out the slots in whatever order the invocations
+ * run), and spread the atomic additions over many counters instead of one.
+ */
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <GL/glew.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "shader_util.h"
+
+#define GPU_CULL_GROUP_SIZE 256     // local_size_x of both compute shaders
+#define GPU_CULL_CHUNK 1024         // Instances per draw command
+
+// An instance in the std430 layout, which pads every column of a mat3 to a vec4
+typedef struct GPUInstance {
+    glm::mat4 model;
+    glm::vec4 normalMatrix[3];
+} GPUInstance;
+
+typedef struct GPUScene {
+    int count, chunks;
+    int elements;           // Vertices (or indices) per instance
+    GLenum indexType;       // Type of the bound element buffer, 0 when drawing unindexed vertices
+    GLuint instances;       // All instances, binding point 0
+    GLuint visible;         // Chunk lists of visible instances, binding point 1, also the instance attributes
+    GLuint counts;          // Visible instances per chunk, binding point 2
+    GLuint commands;        // One indirect draw command per chunk, binding point 3
+    shader_prog *cullShader, *commandShader;
+} GPUScene;
+
+// True if the context supports compute shaders, storage buffers and indirect multi-draw
+bool gpuCullingSupported();
+
+// Instances of unit cubes ([0, 1]^3) with elements vertices or indices each
+struct GPUScene *initGPUScene(const std::vector<glm::mat4> &models, const std::vector<glm::mat3> &normalMatrices,
+                              int elements, GLenum indexType);
+void freeGPUScene(struct GPUScene *scene);
+
+// Point the instance attributes of the bound vertex array (mat4 at locations 2-5 and mat3 at 6-8)
+// to the visible lists
+void bindGPUInstances(struct GPUScene *scene);
+
+// Cull against the frustum of a view projection matrix and write the draw commands
+void cullGPUScene(struct GPUScene *scene, const glm::mat4 &viewProjection);
+
+// Draw all the chunks with a single call, using the bound vertex array and program
+void drawGPUScene(struct GPUScene *scene);
+
+// Number of instances drawn by the last commands. Reads back from the GPU, so it waits for it.
+int gpuVisibleCount(struct GPUScene *scene);
+
+#endif
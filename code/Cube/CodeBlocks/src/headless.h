@@ -0,0 +1,18 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * OpenGL context without a window.
+ *
+ * Benchmarks render into an FBO and never show anything, so they do not need a window
+ * or a display server. With EGL (build with -DUSE_EGL and link EGL) we create a
+ * surfaceless OpenGL 3.3 core context. GLEW has to be built with EGL support (GLEW_EGL)
+ * to load the functions in such a context. Without USE_EGL, createHeadlessContext
+ * fails and the caller opens a GLUT window instead.
+ */
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// Create the context and make it current, false if not possible
+bool createHeadlessContext();
+void destroyHeadlessContext();
+
+#endif
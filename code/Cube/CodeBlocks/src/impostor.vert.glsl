@@ -0,0 +1,25 @@
+#version 330
+
+// Far buildings as single quads in world space, turned around the vertical axis to face the camera
+uniform mat4 modelViewProjectionMatrix;     // View projection, the impostors have no model matrix
+uniform mat4 modelViewMatrix;               // View matrix, for the normal
+uniform vec3 eye;                           // Camera position in world space
+
+layout(location = 0) in vec2 corner;        // (-1 or 1, 0 or 1)
+layout(location = 1) in vec4 base;          // Per instance: center of the bottom face and the height
+layout(location = 2) in vec2 halfSize;      // Per instance: half the width (x) and depth (z)
+out vec3 vertexNormal;
+
+void main(void) {
+    vec2 toEye = eye.xz - base.xz;
+    vec2 normal = length(toEye) > 0.0 ? normalize(toEye) : vec2(0, 1);
+    vec2 right = vec2(normal.y, -normal.x);
+
+    // As wide as the building looks from this direction
+    float halfWidth = abs(right.x) * halfSize.x + abs(right.y) * halfSize.y;
+    vec3 position = vec3(base.x + right.x * corner.x * halfWidth, base.y + corner.y * base.w,
+                         base.z + right.y * corner.x * halfWidth);
+
+    vertexNormal = mat3(modelViewMatrix) * vec3(normal.x, 0, normal.y);
+    gl_Position = modelViewProjectionMatrix * vec4(position, 1);
+}
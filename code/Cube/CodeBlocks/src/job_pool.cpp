@@ -0,0 +1,102 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Work-stealing thread pool for data parallel loops.
+ */
+#include "job_pool.h"
+
+// Index of the queue owned by the current thread
+static thread_local int ownQueue = -1;
+
+static void pushJob(struct JobPool *pool, int queue, Job job) {
+    {
+        std::lock_guard<std::mutex> guard(pool->queues[queue]->lock);
+        pool->queues[queue]->jobs.push_back(job);
+    }
+    pool->queued++;
+
+    // Taking the lock orders the notification after a worker that just found nothing has started waiting
+    { std::lock_guard<std::mutex> guard(pool->sleepLock); }
+    pool->wake.notify_one();
+}
+
+// The owner takes the newest (smallest) piece from the back, thieves the oldest from the front
+static bool takeJob(struct JobPool *pool, int queue, bool steal, Job *job) {
+    JobQueue *q = pool->queues[queue];
+    std::lock_guard<std::mutex> guard(q->lock);
+    if (q->jobs.empty()) return false;
+    if (steal) {
+        *job = q->jobs.front();
+        q->jobs.pop_front();
+    } else {
+        *job = q->jobs.back();
+        q->jobs.pop_back();
+    }
+    pool->queued--;
+    return true;
+}
+
+static bool findJob(struct JobPool *pool, Job *job) {
+    int queues = (int)pool->queues.size();
+    if (takeJob(pool, ownQueue, false, job)) return true;
+    for (int i = 1; i < queues; i++) {
+        if (takeJob(pool, (ownQueue + i) % queues, true, job)) return true;
+    }
+    return false;
+}
+
+static void runJob(struct JobPool *pool, Job job) {
+    // Split off right halves for others to steal, then process what is left
+    while (job.end - job.begin > job.task->grain) {
+        int middle = job.begin + (job.end - job.begin) / 2;
+        Job right = {job.task, middle, job.end};
+        pushJob(pool, ownQueue, right);
+        job.end = middle;
+    }
+    job.task->run(job.task, job.begin, job.end);
+    job.task->remaining -= job.end - job.begin;
+}
+
+static void worker(struct JobPool *pool, int index) {
+    ownQueue = index;
+    while (!pool->stopping) {
+        Job job;
+        if (findJob(pool, &job)) {
+            runJob(pool, job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(pool->sleepLock);
+        pool->wake.wait(lock, [pool] { return pool->queued > 0 || pool->stopping; });
+    }
+}
+
+struct JobPool *initJobPool(int threads) {
+    struct JobPool *pool = new JobPool;
+    pool->queued = 0;
+    pool->stopping = false;
+    for (int i = 0; i <= threads; i++) pool->queues.push_back(new JobQueue);
+    for (int i = 0; i < threads; i++) pool->workers.push_back(std::thread(worker, pool, i));
+    return pool;
+}
+
+void freeJobPool(struct JobPool *pool) {
+    {
+        std::lock_guard<std::mutex> guard(pool->sleepLock);
+        pool->stopping = true;
+    }
+    pool->wake.notify_all();
+    for (size_t i = 0; i < pool->workers.size(); i++) pool->workers[i].join();
+    for (size_t i = 0; i < pool->queues.size(); i++) delete pool->queues[i];
+    delete pool;
+}
+
+void runJobs(struct JobPool *pool, struct ForTask *task, int begin, int end) {
+    // The calling thread owns the last queue and works along until the task is done
+    ownQueue = (int)pool->queues.size() - 1;
+    Job first = {task, begin, end};
+    runJob(pool, first);
+    while (task->remaining > 0) {
+        Job job;
+        if (findJob(pool, &job)) runJob(pool, job);
+        else std::this_thread::yield();
+    }
+}
@@ -0,0 +1,79 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Work-stealing thread pool for data parallel loops.
+ *
+ * parallelFor splits a range of indices recursively: a thread running a range pushes its
+ * right half onto the back of its own deque and continues with the left half, until the
+ * piece is at most grain indices long. Idle threads steal from the front of the other deques,
+ * where the largest pieces are, so the work spreads out without a central queue.
+ * The thread calling parallelFor helps until the whole range is done.
+ * Every deque has its own small lock, taken for a push, a pop or a steal.
+ */
+#ifndef JOB_POOL_H
+#define JOB_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+struct ForTask;
+
+// A piece of a parallelFor range
+typedef struct Job {
+    struct ForTask *task;
+    int begin, end;
+} Job;
+
+typedef struct JobQueue {
+    std::mutex lock;
+    std::deque<Job> jobs;
+} JobQueue;
+
+typedef struct JobPool {
+    std::vector<std::thread> workers;
+    std::vector<JobQueue *> queues;     // One per worker, the last one for the thread calling parallelFor
+    std::atomic<int> queued;            // Jobs in all the queues
+    std::atomic<bool> stopping;
+    std::mutex sleepLock;
+    std::condition_variable wake;       // Idle workers sleep here
+} JobPool;
+
+struct JobPool *initJobPool(int threads);
+void freeJobPool(struct JobPool *pool);
+
+// Run body(begin, end) over [0, count) in pieces of at most grain indices, and wait for all of them.
+// Only one thread may call parallelFor on a pool at a time.
+template <typename Body>
+void parallelFor(struct JobPool *pool, int count, int grain, Body body);
+
+// ------------------ Implementation ------------------ //
+
+typedef struct ForTask {
+    void (*run)(struct ForTask *task, int begin, int end);
+    void *body;
+    int grain;
+    std::atomic<int> remaining;         // Indices not processed yet
+} ForTask;
+
+void runJobs(struct JobPool *pool, struct ForTask *task, int begin, int end);
+
+template <typename Body>
+static void runBody(struct ForTask *task, int begin, int end) {
+    (*(Body *)task->body)(begin, end);
+}
+
+template <typename Body>
+void parallelFor(struct JobPool *pool, int count, int grain, Body body) {
+    if (count <= 0) return;
+    ForTask task;
+    task.run = runBody<Body>;
+    task.body = &body;
+    task.grain = grain < 1 ? 1 : grain;
+    task.remaining = count;
+    runJobs(pool, &task, 0, count);
+}
+
+#endif
@@ -0,0 +1,14 @@
+#version 330
+// Fragment shader: move the body by its (already updated) velocity
+
+uniform sampler2D positions;    // xyz, mass in w
+uniform sampler2D velocities;
+uniform float dt;
+
+out vec4 result;
+
+void main(void) {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 p = texelFetch(positions, texel, 0);
+    result = p + vec4(texelFetch(velocities, texel, 0).xyz * dt, 0.0);
+}
@@ -0,0 +1,148 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * N-body simulation that lives entirely on the GPU.
+ */
+#include "nbody_util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+// Texture and framebuffer for one copy of the state
+static void initStateTexture(GLuint *texture, GLuint *fbo, int width, int height, const float *data) {
+    glGenTextures(1, texture);
+    glBindTexture(GL_TEXTURE_2D, *texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, data);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glGenFramebuffers(1, fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static shader_prog *nbodyKernel(const char *fragmentShader) {
+    shader_prog *shader = new shader_prog("../src/nbody_pass.vert.glsl", fragmentShader);
+    shader->use();      // The only output "result" goes to color attachment 0
+    return shader;
+}
+
+struct NBody *initNBody(int count, const float *positions, const float *velocities, float dt, float softening) {
+    struct NBody *nbody = (struct NBody *)malloc(sizeof(struct NBody));
+    nbody->count = count;
+    nbody->width = count < NBODY_MAX_WIDTH ? count : NBODY_MAX_WIDTH;
+    nbody->height = (count + nbody->width - 1) / nbody->width;
+    nbody->dt = dt;
+    nbody->softening = softening;
+    nbody->current = 0;
+
+    // Padding texels are bodies without mass at the origin
+    long texels = (long)nbody->width * nbody->height;
+    std::vector<float> data(texels * 4, 0.0f);
+    memcpy(&data[0], positions, count * 4 * sizeof(float));
+    initStateTexture(&nbody->positions[0], &nbody->positionFBOs[0], nbody->width, nbody->height, &data[0]);
+    initStateTexture(&nbody->positions[1], &nbody->positionFBOs[1], nbody->width, nbody->height, NULL);
+    memcpy(&data[0], velocities, count * 4 * sizeof(float));
+    initStateTexture(&nbody->velocities[0], &nbody->velocityFBOs[0], nbody->width, nbody->height, &data[0]);
+    initStateTexture(&nbody->velocities[1], &nbody->velocityFBOs[1], nbody->width, nbody->height, NULL);
+
+    glGenVertexArrays(1, &nbody->vao);
+
+    nbody->velocityShader = nbodyKernel("../src/nbody_velocity.frag.glsl");
+    nbody->velocityShader->uniform1i("positions", 0);
+    nbody->velocityShader->uniform1i("velocities", 1);
+    nbody->velocityShader->uniform1i("count", count);
+    nbody->velocityShader->uniform1i("width", nbody->width);
+    nbody->velocityShader->uniform1f("dt", dt);
+    nbody->velocityShader->uniform1f("softening", softening);
+
+    nbody->positionShader = nbodyKernel("../src/nbody_position.frag.glsl");
+    nbody->positionShader->uniform1i("positions", 0);
+    nbody->positionShader->uniform1i("velocities", 1);
+    nbody->positionShader->uniform1f("dt", dt);
+
+    glUseProgram(0);
+    return nbody;
+}
+
+void freeNBody(struct NBody *nbody) {
+    glDeleteFramebuffers(2, nbody->positionFBOs);
+    glDeleteFramebuffers(2, nbody->velocityFBOs);
+    glDeleteTextures(2, nbody->positions);
+    glDeleteTextures(2, nbody->velocities);
+    glDeleteVertexArrays(1, &nbody->vao);
+    nbody->velocityShader->free();
+    nbody->positionShader->free();
+    delete nbody->velocityShader;
+    delete nbody->positionShader;
+    free(nbody);
+}
+
+// Render a full-screen triangle into fbo, reading the two given textures
+static void statePass(struct NBody *nbody, shader_prog *shader, GLuint fbo, GLuint positions, GLuint velocities) {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glUseProgram(*shader);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, velocities);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, positions);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void stepNBody(struct NBody *nbody) {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(0, 0, nbody->width, nbody->height);
+    glBindVertexArray(nbody->vao);
+
+    int cur = nbody->current, next = 1 - cur;
+    statePass(nbody, nbody->velocityShader, nbody->velocityFBOs[next], nbody->positions[cur], nbody->velocities[cur]);
+    statePass(nbody, nbody->positionShader, nbody->positionFBOs[next], nbody->positions[cur], nbody->velocities[next]);
+    nbody->current = next;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+GLuint nbodyPositions(struct NBody *nbody) {
+    return nbody->positions[nbody->current];
+}
+
+void readNBody(struct NBody *nbody, float *positions, float *velocities) {
+    std::vector<float> data((long)nbody->width * nbody->height * 4);
+    GLuint fbos[2] = {nbody->positionFBOs[nbody->current], nbody->velocityFBOs[nbody->current]};
+    float *targets[2] = {positions, velocities};
+
+    for (int i = 0; i < 2; i++) {
+        if (targets[i] == NULL) continue;
+        glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(0, 0, nbody->width, nbody->height, GL_RGBA, GL_FLOAT, &data[0]);
+        memcpy(targets[i], &data[0], nbody->count * 4 * sizeof(float));
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void nbodyInitialState(int count, float *positions, float *velocities) {
+    srand(42);
+    for (int i = 0; i < count; i++) {
+        float x, y, z;
+        do {
+            x = 2.0f * rand() / RAND_MAX - 1.0f;
+            y = 2.0f * rand() / RAND_MAX - 1.0f;
+            z = 2.0f * rand() / RAND_MAX - 1.0f;
+        } while (x * x + y * y + z * z > 1.0f);
+
+        positions[i * 4 + 0] = x;
+        positions[i * 4 + 1] = y * 0.3f;
+        positions[i * 4 + 2] = z;
+        positions[i * 4 + 3] = (0.5f + (float)rand() / RAND_MAX) / count;     // Mass
+
+        // Rotation around the y axis
+        velocities[i * 4 + 0] = -z * 0.5f;
+        velocities[i * 4 + 1] = 0.0f;
+        velocities[i * 4 + 2] = x * 0.5f;
+        velocities[i * 4 + 3] = 0.0f;
+    }
+}
@@ -0,0 +1,31 @@
+#version 330
+// Fragment shader: gravitational acceleration from all bodies, integrated into the velocity
+
+uniform sampler2D positions;    // xyz, mass in w
+uniform sampler2D velocities;
+uniform int count;              // Number of bodies
+uniform int width;              // Texture width, body i is texel (i % width, i / width)
+uniform float dt;
+uniform float softening;
+
+out vec4 result;
+
+void main(void) {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec3 p = texelFetch(positions, texel, 0).xyz;
+    vec3 acceleration = vec3(0.0);
+
+    // One row of the position texture is one tile
+    int rows = (count + width - 1) / width;
+    for (int y = 0; y < rows; y++) {
+        int columns = min(width, count - y * width);
+        for (int x = 0; x < columns; x++) {
+            vec4 q = texelFetch(positions, ivec2(x, y), 0);
+            vec3 d = q.xyz - p;
+            float r2 = dot(d, d) + softening * softening;
+            acceleration += q.w * d * inversesqrt(r2 * r2 * r2);
+        }
+    }
+
+    result = texelFetch(velocities, texel, 0) + vec4(acceleration * dt, 0.0);
+}
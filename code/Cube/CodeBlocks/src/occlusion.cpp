@@ -0,0 +1,224 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Occlusion culling and level of detail in a city of cube buildings.
+ */
+#include "occlusion.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+#include <algorithm>
+#include <glm/gtc/type_ptr.hpp>
+#include "scene.h"
+#include "timer_util.h"
+
+#define BOX_MARGIN 0.05f    // Query boxes stand out of the building, so its own faces do not hide them
+
+// Unit cube as 12 triangles, positions only
+static const float boxVertices[] = {
+    0, 0, 0,  0, 1, 0,  0, 1, 1,   0, 1, 1,  0, 0, 1,  0, 0, 0,
+    1, 0, 0,  1, 0, 1,  1, 1, 1,   1, 1, 1,  1, 1, 0,  1, 0, 0,
+    0, 1, 0,  0, 1, 1,  1, 1, 1,   1, 1, 1,  1, 1, 0,  0, 1, 0,
+    0, 0, 0,  0, 0, 1,  1, 0, 1,   1, 0, 1,  1, 0, 0,  0, 0, 0,
+    0, 0, 1,  0, 1, 1,  1, 1, 1,   1, 1, 1,  1, 0, 1,  0, 0, 1,
+    0, 0, 0,  0, 1, 0,  1, 1, 0,   1, 1, 0,  1, 0, 0,  0, 0, 0,
+};
+
+// Impostor quad as two triangles of (side, height) corners
+static const float quadVertices[] = {
+    -1, 0,  1, 0,  1, 1,   1, 1,  -1, 1,  -1, 0,
+};
+
+// Buildings of 3-6 x 3-6 cubes and 4-40 floors, one in the corner of every block,
+// until there are count cubes. The last one may have an unfinished top floor.
+static void generateBuildings(struct City *city, int count) {
+    int side = std::max(1, (int)ceil(sqrt(count / 450.0)));     // A building has 450 cubes on average
+    int rows = 0;
+    std::vector<glm::ivec3> corners;
+    srand(3);
+    while ((int)corners.size() < count) {
+        int block = (int)city->buildings.size();
+        int width = 3 + rand() % 4, depth = 3 + rand() % 4, height = 4 + rand() % 37;
+        glm::ivec3 origin(block % side * CITY_BLOCK, 0, block / side * CITY_BLOCK);
+        rows = block / side + 1;
+
+        Building building;
+        building.first = (int)corners.size();
+        for (int y = 0; y < height && (int)corners.size() < count; y++) {
+            for (int i = 0; i < width * depth && (int)corners.size() < count; i++) {
+                corners.push_back(origin + glm::ivec3(i % width, y, i / width));
+            }
+        }
+        building.count = (int)corners.size() - building.first;
+        city->buildings.push_back(building);
+    }
+
+    // Centered so that the streets between the middle blocks pass through -2 and CITY_BLOCK - 2
+    glm::vec3 offset(-(side / 2) * CITY_BLOCK, 0, -(rows / 2) * CITY_BLOCK);
+    city->models.resize(count);
+    city->normalMatrices.assign(count, glm::mat3(1));
+    for (int i = 0; i < count; i++) {
+        glm::mat4 model(1);
+        model[3] = glm::vec4(glm::vec3(corners[i]) + offset, 1);
+        city->models[i] = model;
+    }
+    for (size_t b = 0; b < city->buildings.size(); b++) {
+        Building &building = city->buildings[b];
+        building.min = glm::vec3(1e30f);
+        building.max = glm::vec3(-1e30f);
+        for (int i = building.first; i < building.first + building.count; i++) {
+            glm::vec3 corner(city->models[i][3]);
+            building.min = glm::min(building.min, corner);
+            building.max = glm::max(building.max, corner + glm::vec3(1));
+        }
+    }
+}
+
+static GLuint vertexArray(GLuint *buffer, const float *data, int bytes, int components) {
+    GLuint array;
+    glGenVertexArrays(1, &array);
+    glBindVertexArray(array);
+    glGenBuffers(1, buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, *buffer);
+    glBufferData(GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, components, GL_FLOAT, GL_FALSE, 0, 0);
+    return array;
+}
+
+struct City *initCity(int count, float lodDistance) {
+    struct City *city = new City;
+    city->count = count;
+    city->occlusion = true;
+    city->lodDistance = lodDistance;
+    city->planMs = 0;
+    generateBuildings(city, count);
+
+    glGenBuffers(1, &city->modelBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, city->modelBuffer);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::mat4), &city->models[0], GL_STATIC_DRAW);
+    glGenBuffers(1, &city->normalBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, city->normalBuffer);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::mat3), &city->normalMatrices[0], GL_STATIC_DRAW);
+
+    int buildings = (int)city->buildings.size();
+    city->queries.resize(buildings);
+    glGenQueries(buildings, &city->queries[0]);
+    city->queried.assign(buildings, 0);
+    city->seen.assign(buildings, 0);
+
+    city->boxArray = vertexArray(&city->boxBuffer, boxVertices, sizeof(boxVertices), 3);
+    city->impostorArray = vertexArray(&city->quadBuffer, quadVertices, sizeof(quadVertices), 2);
+    glGenBuffers(1, &city->impostorBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, city->impostorBuffer);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Impostor), (const GLvoid*)offsetof(Impostor, base));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Impostor), (const GLvoid*)offsetof(Impostor, halfSize));
+    glVertexAttribDivisor(2, 1);
+    glBindVertexArray(0);
+
+    city->boxShader = new shader_prog("../src/box.vert.glsl", "../src/cube.frag.glsl");
+    city->boxShader->use();
+    city->impostorShader = new shader_prog("../src/impostor.vert.glsl", "../src/cube.frag.glsl");
+    city->impostorShader->use();
+    return city;
+}
+
+void freeCity(struct City *city) {
+    glDeleteQueries((GLsizei)city->queries.size(), &city->queries[0]);
+    glDeleteBuffers(1, &city->modelBuffer);
+    glDeleteBuffers(1, &city->normalBuffer);
+    glDeleteVertexArrays(1, &city->boxArray);
+    glDeleteBuffers(1, &city->boxBuffer);
+    glDeleteVertexArrays(1, &city->impostorArray);
+    glDeleteBuffers(1, &city->quadBuffer);
+    glDeleteBuffers(1, &city->impostorBuffer);
+    city->boxShader->free();
+    city->impostorShader->free();
+    delete city->boxShader;
+    delete city->impostorShader;
+    delete city;
+}
+
+void planCity(struct City *city, const glm::mat4 &viewProjection, const glm::vec3 &eye) {
+    double startTime = wallClockMs();
+    city->drawn.clear();
+    city->retested.clear();
+    city->impostors.clear();
+
+    Frustum frustum = frustumPlanes(viewProjection);
+    for (int b = 0; b < (int)city->buildings.size(); b++) {
+        const Building &building = city->buildings[b];
+
+        // The answer of last frame's query. Usually the GPU has long finished it; if not,
+        // the building counts as not queried rather than waiting.
+        bool seen = false;
+        if (city->queried[b]) {
+            GLuint available = 0, samples = 0;
+            glGetQueryObjectuiv(city->queries[b], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) glGetQueryObjectuiv(city->queries[b], GL_QUERY_RESULT, &samples);
+            seen = available && samples;
+        }
+        city->queried[b] = false;
+        city->seen[b] = seen;
+
+        if (testBox(frustum, building.min, building.max) < 0) continue;
+
+        // Distance from the camera to the nearest point of the bounding box
+        glm::vec3 nearest = glm::clamp(eye, building.min, building.max);
+        if (glm::length(nearest - eye) >= city->lodDistance) {
+            Impostor impostor;
+            glm::vec3 center = (building.min + building.max) * 0.5f;
+            impostor.base = glm::vec4(center.x, building.min.y, center.z, building.max.y - building.min.y);
+            impostor.halfSize = glm::vec2(building.max.x - building.min.x, building.max.z - building.min.z) * 0.5f;
+            city->impostors.push_back(impostor);
+        } else if (seen || !city->occlusion) {
+            city->drawn.push_back(b);
+        } else {
+            city->retested.push_back(b);
+        }
+    }
+    city->planMs = wallClockMs() - startTime;
+}
+
+void drawImpostors(struct City *city, const glm::mat4 &viewProjection, const glm::mat4 &view, const glm::vec3 &eye) {
+    if (city->impostors.empty()) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, city->impostorBuffer);
+    glBufferData(GL_ARRAY_BUFFER, city->impostors.size() * sizeof(Impostor), &city->impostors[0], GL_STREAM_DRAW);
+
+    glUseProgram(*city->impostorShader);
+    city->impostorShader->uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(viewProjection));
+    city->impostorShader->uniformMatrix4fv("modelViewMatrix", glm::value_ptr(view));
+    city->impostorShader->uniform3f("eye", eye.x, eye.y, eye.z);
+    glBindVertexArray(city->impostorArray);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, (GLsizei)city->impostors.size());
+}
+
+void queryCity(struct City *city, const glm::mat4 &viewProjection) {
+    if (!city->occlusion) return;
+
+    glUseProgram(*city->boxShader);
+    city->boxShader->uniformMatrix4fv("modelViewProjectionMatrix", glm::value_ptr(viewProjection));
+    glBindVertexArray(city->boxArray);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+
+    const std::vector<int> *lists[2] = {&city->drawn, &city->retested};
+    for (int l = 0; l < 2; l++) {
+        for (size_t i = 0; i < lists[l]->size(); i++) {
+            int b = (*lists[l])[i];
+            glm::vec3 min = city->buildings[b].min - BOX_MARGIN, size = city->buildings[b].max + BOX_MARGIN - min;
+            city->boxShader->uniform3f("boxMin", min.x, min.y, min.z);
+            city->boxShader->uniform3f("boxSize", size.x, size.y, size.z);
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, city->queries[b]);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            city->queried[b] = true;
+        }
+    }
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+}
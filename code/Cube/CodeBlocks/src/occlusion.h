@@ -0,0 +1,81 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Occlusion culling and level of detail in a city of cube buildings.
+ *
+ * Frustum culling still submits everything in front of the camera, although in a street
+ * between tall buildings the nearest few hide nearly all the others. Occlusion queries ask
+ * the GPU whether any sample of a shape passes the depth test (GL_ANY_SAMPLES_PASSED).
+ * The bounding box of every building near enough is drawn into a query with color and depth
+ * writes off, after the visible geometry has filled the depth buffer.
+ *
+ * Waiting for the answers in the same frame would stall the CPU, so planCity uses the results
+ * of the previous frame: a building whose box was hidden then is not drawn with the others.
+ * It is drawn on its own inside glBeginConditionalRender with this frame's query, so the GPU
+ * skips it unless the box turns out visible, and nothing appears a frame late.
+ *
+ * Beyond lodDistance a building is replaced by an impostor: a single quad of the size of the
+ * building, turned around the vertical axis to face the camera.
+ */
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <GL/glew.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "shader_util.h"
+
+#define CITY_BLOCK 10       // Distance between parallel streets, which are 4 units wide
+
+// A block of unit cubes, drawn, tested and replaced as a whole
+typedef struct Building {
+    glm::vec3 min, max;     // Bounding box
+    int first, count;       // Range of the city's cubes
+} Building;
+
+// Per instance data of an impostor quad
+typedef struct Impostor {
+    glm::vec4 base;         // Center of the bottom face (xyz) and the height
+    glm::vec2 halfSize;     // Half the width and half the depth of the building
+} Impostor;
+
+typedef struct City {
+    int count;                                      // Number of cubes
+    std::vector<glm::mat4> models;                  // Cubes sorted by building
+    std::vector<glm::mat3> normalMatrices;
+    std::vector<Building> buildings;
+    GLuint modelBuffer, normalBuffer;               // The same matrices in instance buffers
+
+    bool occlusion;                                 // Query the near buildings, otherwise draw them all
+    float lodDistance;                              // Impostors from this distance on
+    std::vector<GLuint> queries;                    // GL_ANY_SAMPLES_PASSED, one per building
+    std::vector<char> queried, seen;                // Query issued last frame, and its result
+
+    // Lists filled by planCity
+    std::vector<int> drawn;                         // Near buildings seen in the last frame
+    std::vector<int> retested;                      // Near buildings that were hidden or not queried
+    std::vector<Impostor> impostors;                // Far buildings
+
+    shader_prog *boxShader, *impostorShader;
+    GLuint boxArray, boxBuffer;                     // Unit cube positions for the query boxes
+    GLuint impostorArray, quadBuffer, impostorBuffer;
+
+    double planMs;                                  // CPU time of the last planCity
+} City;
+
+// count cubes in buildings of random sizes along a square grid of streets around the origin.
+// The middles of the streets are at -2 plus multiples of CITY_BLOCK, in x and in z.
+struct City *initCity(int count, float lodDistance);
+void freeCity(struct City *city);
+
+// Read the queries of the last frame, cull the buildings against the view frustum
+// and sort them into drawn, retested and impostors
+void planCity(struct City *city, const glm::mat4 &viewProjection, const glm::vec3 &eye);
+
+// Draw the impostors of the last plan
+void drawImpostors(struct City *city, const glm::mat4 &viewProjection, const glm::mat4 &view, const glm::vec3 &eye);
+
+// Draw the boxes of the drawn and retested buildings into their queries, leaving the framebuffer
+// as it is. With occlusion off it does nothing.
+void queryCity(struct City *city, const glm::mat4 &viewProjection);
+
+#endif
@@ -0,0 +1,12 @@
+#version 330
+
+uniform float averageMass;
+
+in float vertexMass;
+out vec4 fragColor;
+
+void main(void) {
+    // Heavier bodies are brighter
+    float brightness = clamp(0.5 * vertexMass / averageMass, 0.2, 1.0);
+    fragColor = vec4(1.0, 0.8, 0.5, 1.0) * brightness;
+}
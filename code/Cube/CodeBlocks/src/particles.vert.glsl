@@ -0,0 +1,15 @@
+#version 330
+// Vertex shader: one point per body, the position comes straight from the simulation texture
+
+uniform mat4 modelViewProjectionMatrix;
+uniform sampler2D positions;    // xyz, mass in w
+uniform int width;              // Body i is texel (i % width, i / width)
+
+out float vertexMass;
+
+void main(void) {
+    vec4 body = texelFetch(positions, ivec2(gl_VertexID % width, gl_VertexID / width), 0);
+    vertexMass = body.w;
+    gl_Position = modelViewProjectionMatrix*vec4(body.xyz, 1);
+    gl_PointSize = 2.0;
+}
@@ -0,0 +1,30 @@
+// Phong model for point lights, prepended to the fragment shaders that do lighting.
+// Lights are 2 texels each in a texture buffer, in eye space: (position, radius), (color, 0)
+uniform samplerBuffer lights;
+
+const vec3 ambientLight = vec3(0.1);
+const vec3 materialSpecular = vec3(0.5);
+const float shininess = 32.0;
+
+// Light reflected towards the viewer (at the origin) by a surface point
+vec3 phong(int light, vec3 position, vec3 normal, vec3 albedo) {
+    vec4 positionRadius = texelFetch(lights, 2 * light);
+    vec3 color = texelFetch(lights, 2 * light + 1).rgb;
+
+    vec3 toLight = positionRadius.xyz - position;
+    float lightDistance = length(toLight);
+    if (lightDistance >= positionRadius.w) return vec3(0.0);
+
+    // Falls smoothly to zero at the radius of the light
+    float attenuation = 1.0 - lightDistance / positionRadius.w;
+    attenuation *= attenuation;
+
+    vec3 l = toLight / lightDistance;
+    float diffuse = max(dot(normal, l), 0.0);
+    float specular = 0.0;
+    if (diffuse > 0.0) {
+        vec3 r = reflect(-l, normal);
+        specular = pow(max(dot(r, normalize(-position)), 0.0), shininess);
+    }
+    return attenuation * color * (albedo * diffuse + materialSpecular * specular);
+}
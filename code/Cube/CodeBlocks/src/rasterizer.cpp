@@ -0,0 +1,314 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Software rasterizer for the cube scene.
+ */
+#include "rasterizer.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <glm/gtc/matrix_inverse.hpp>
+#include "timer_util.h"
+
+// ------------------ SIMD lanes ------------------ //
+// Four horizontally adjacent pixels are evaluated at once
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+typedef __m128 lanes;
+static inline lanes splat(float f)                     { return _mm_set1_ps(f); }
+static inline lanes set4(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+static inline lanes add(lanes a, lanes b)              { return _mm_add_ps(a, b); }
+static inline lanes mul(lanes a, lanes b)              { return _mm_mul_ps(a, b); }
+static inline lanes loadLanes(const float *p)          { return _mm_loadu_ps(p); }
+static inline void storeLanes(float *p, lanes a)       { _mm_storeu_ps(p, a); }
+// Bit i is set when lane i of a >= 0 in all three
+static inline int insideMask(lanes a, lanes b, lanes c) {
+    lanes zero = _mm_setzero_ps();
+    return _mm_movemask_ps(_mm_and_ps(_mm_and_ps(_mm_cmpge_ps(a, zero), _mm_cmpge_ps(b, zero)), _mm_cmpge_ps(c, zero)));
+}
+// Bit i is set when lane i of a < b
+static inline int lessMask(lanes a, lanes b)           { return _mm_movemask_ps(_mm_cmplt_ps(a, b)); }
+#else
+typedef struct { float v[4]; } lanes;
+static inline lanes splat(float f)                     { lanes r = {{f, f, f, f}}; return r; }
+static inline lanes set4(float a, float b, float c, float d) { lanes r = {{a, b, c, d}}; return r; }
+static inline lanes add(lanes a, lanes b)              { lanes r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] + b.v[i]; return r; }
+static inline lanes mul(lanes a, lanes b)              { lanes r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] * b.v[i]; return r; }
+static inline lanes loadLanes(const float *p)          { lanes r; memcpy(r.v, p, sizeof(r.v)); return r; }
+static inline void storeLanes(float *p, lanes a)       { memcpy(p, a.v, sizeof(a.v)); }
+static inline int insideMask(lanes a, lanes b, lanes c) {
+    int mask = 0;
+    for (int i = 0; i < 4; i++) mask |= (a.v[i] >= 0 && b.v[i] >= 0 && c.v[i] >= 0) << i;
+    return mask;
+}
+static inline int lessMask(lanes a, lanes b) {
+    int mask = 0;
+    for (int i = 0; i < 4; i++) mask |= (a.v[i] < b.v[i]) << i;
+    return mask;
+}
+#endif
+
+// Output of the vertex stage
+typedef struct RasterVertex {
+    float x, y, z;          // Window coordinates, z in [0, 1]
+    float invW;             // 1 / clip w, for perspective correct interpolation
+    glm::vec3 eye;          // Eye space position
+    glm::vec3 normal;       // Eye space normal
+} RasterVertex;
+
+// Run body(thread) on threads threads
+template <typename Body>
+static void parallel(int threads, Body body) {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) workers.push_back(std::thread(body, t));
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+}
+
+struct RasterImage *initRasterImage(int width, int height) {
+    struct RasterImage *image = new RasterImage;
+    image->width = width;
+    image->height = height;
+    image->stride = (width + 3) & ~3;
+    image->color.resize((long)image->stride * height * 3);
+    image->depth.resize((long)image->stride * height);
+    clearRasterImage(image);
+    return image;
+}
+
+void freeRasterImage(struct RasterImage *image) {
+    delete image;
+}
+
+void clearRasterImage(struct RasterImage *image) {
+    std::fill(image->color.begin(), image->color.end(), 0.0f);
+    std::fill(image->depth.begin(), image->depth.end(), 1.0f);
+}
+
+void saveRasterImage(const struct RasterImage *image, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (!file) throw std::runtime_error(std::string("Failed to write file ") + filename);
+    fprintf(file, "P6\n%d %d\n255\n", image->width, image->height);
+    std::vector<unsigned char> row(image->width * 3);
+
+    // PPM starts from the top row, OpenGL window coordinates from the bottom
+    for (int y = image->height - 1; y >= 0; y--) {
+        const float *src = &image->color[(long)y * image->stride * 3];
+        for (int i = 0; i < image->width * 3; i++) {
+            float value = src[i] < 0 ? 0 : src[i] > 1 ? 1 : src[i];
+            row[i] = (unsigned char)(value * 255 + 0.5f);
+        }
+        fwrite(&row[0], 1, row.size(), file);
+    }
+    fclose(file);
+}
+
+// The Phong model of phong.glsl with its constants
+static glm::vec3 shade(const std::vector<RasterLight> &lights, glm::vec3 position, glm::vec3 normal) {
+    const glm::vec3 albedo(0.5f), ambientLight(0.1f), materialSpecular(0.5f);
+    const float shininess = 32.0f;
+
+    glm::vec3 color = ambientLight * albedo;
+    glm::vec3 toViewer = glm::normalize(-position);
+    for (size_t i = 0; i < lights.size(); i++) {
+        glm::vec3 toLight = lights[i].position - position;
+        float lightDistance = glm::length(toLight);
+        if (lightDistance >= lights[i].radius) continue;
+
+        float attenuation = 1.0f - lightDistance / lights[i].radius;
+        attenuation *= attenuation;
+
+        glm::vec3 l = toLight / lightDistance;
+        float diffuse = std::max(glm::dot(normal, l), 0.0f);
+        float specular = 0.0f;
+        if (diffuse > 0.0f) {
+            glm::vec3 r = glm::reflect(-l, normal);
+            specular = powf(std::max(glm::dot(r, toViewer), 0.0f), shininess);
+        }
+        color += attenuation * lights[i].color * (albedo * diffuse + materialSpecular * specular);
+    }
+    return color;
+}
+
+// Depth test one triangle against the part of the image covered by the given tile.
+// Where it is the nearest so far, its index goes into the visibility buffer of the tile.
+static void rasterizeTriangle(struct RasterImage *image, int *visible, int triangle, const RasterVertex *v0,
+                              const RasterVertex *v1, const RasterVertex *v2, int tileX0, int tileY0, int tileX1, int tileY1) {
+
+    // Twice the signed area. Both windings are drawn: make it counterclockwise.
+    float area = (v1->x - v0->x) * (v2->y - v0->y) - (v1->y - v0->y) * (v2->x - v0->x);
+    if (area < 0) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+    if (area < 1e-8f) return;
+
+    int x0 = std::max(tileX0, (int)floorf(std::min(v0->x, std::min(v1->x, v2->x))));
+    int x1 = std::min(tileX1, (int)ceilf(std::max(v0->x, std::max(v1->x, v2->x))));
+    int y0 = std::max(tileY0, (int)floorf(std::min(v0->y, std::min(v1->y, v2->y))));
+    int y1 = std::min(tileY1, (int)ceilf(std::max(v0->y, std::max(v1->y, v2->y))));
+    if (x0 > x1 || y0 > y1) return;
+    x0 &= ~3;    // Start at a multiple of 4, the rows are padded to one
+
+    // Edge function of the edge opposite to vertex i: e_i(x, y) = a_i x + b_i y + c_i,
+    // normalized by the area so that the three values are the barycentric coordinates
+    const RasterVertex *v[3] = {v0, v1, v2};
+    float a[3], b[3], c[3];
+    for (int i = 0; i < 3; i++) {
+        const RasterVertex *p = v[(i + 1) % 3], *q = v[(i + 2) % 3];
+        a[i] = (p->y - q->y) / area;
+        b[i] = (q->x - p->x) / area;
+        c[i] = (p->x * q->y - p->y * q->x) / area;
+    }
+    lanes stepX[3], offsetX = set4(0.5f, 1.5f, 2.5f, 3.5f);
+    for (int i = 0; i < 3; i++) stepX[i] = splat(4 * a[i]);
+    lanes z0 = splat(v0->z), z1 = splat(v1->z), z2 = splat(v2->z);
+
+    for (int y = y0; y <= y1; y++) {
+        float py = y + 0.5f;
+        lanes e[3];
+        for (int i = 0; i < 3; i++) e[i] = add(mul(splat(a[i]), add(splat((float)x0), offsetX)), splat(b[i] * py + c[i]));
+
+        for (int x = x0; x <= x1; x += 4) {
+            int mask = insideMask(e[0], e[1], e[2]);
+            if (x + 3 > x1) mask &= (1 << (x1 - x + 1)) - 1;   // Lanes in the next tile
+            if (mask) {
+                long offset = (long)y * image->stride + x;
+                lanes z = add(add(mul(e[0], z0), mul(e[1], z1)), mul(e[2], z2));
+                mask &= lessMask(z, loadLanes(&image->depth[offset]));
+                if (mask) {
+                    float depth[4];
+                    storeLanes(depth, z);
+                    int *ids = &visible[(y - tileY0) * RASTER_TILE_SIZE + x - tileX0];
+                    for (int lane = 0; lane < 4; lane++) {
+                        if (!(mask & (1 << lane))) continue;
+                        image->depth[offset + lane] = depth[lane];
+                        ids[lane] = triangle;
+                    }
+                }
+            }
+            for (int i = 0; i < 3; i++) e[i] = add(e[i], stepX[i]);
+        }
+    }
+}
+
+// Shade every pixel of a tile once, with the triangle left in its visibility buffer
+static void shadeTile(struct RasterImage *image, const int *visible, const RasterVertex *transformed,
+                      int tileX0, int tileY0, int tileX1, int tileY1, const std::vector<RasterLight> &lights) {
+    for (int y = tileY0; y <= tileY1; y++) {
+        for (int x = tileX0; x <= tileX1; x++) {
+            int triangle = visible[(y - tileY0) * RASTER_TILE_SIZE + x - tileX0];
+            if (triangle < 0) continue;
+            const RasterVertex *v = &transformed[triangle * 3L];
+
+            // Barycentric coordinates from the signed areas, then perspective correct weights
+            float px = x + 0.5f, py = y + 0.5f, w[3], sum = 0;
+            float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+            for (int i = 0; i < 3; i++) {
+                const RasterVertex &p = v[(i + 1) % 3], &q = v[(i + 2) % 3];
+                w[i] = ((q.x - p.x) * (py - p.y) - (q.y - p.y) * (px - p.x)) / area * v[i].invW;
+                sum += w[i];
+            }
+            glm::vec3 eye = (w[0] * v[0].eye + w[1] * v[1].eye + w[2] * v[2].eye) / sum;
+            glm::vec3 normal = glm::normalize(w[0] * v[0].normal + w[1] * v[1].normal + w[2] * v[2].normal);
+            glm::vec3 color = shade(lights, eye, normal);
+
+            float *pixel = &image->color[((long)y * image->stride + x) * 3];
+            pixel[0] = color.r;
+            pixel[1] = color.g;
+            pixel[2] = color.b;
+        }
+    }
+}
+
+RasterStats rasterize(struct RasterImage *image, const float *vertices, int vertexCount,
+                      const glm::mat4 *models, int instances, const glm::mat4 &view, const glm::mat4 &projection,
+                      const std::vector<RasterLight> &lights, int threads) {
+    RasterStats stats = {0, 0, 0, 0, 0};
+    double startTime = wallClockMs();
+    int triangleCount = vertexCount / 3 * instances;
+
+    // Vertex stage: instances are split between threads
+    std::vector<RasterVertex> transformed((long)vertexCount * instances);
+    float halfWidth = image->width * 0.5f, halfHeight = image->height * 0.5f;
+    parallel(threads, [&](int t) {
+        for (int instance = instances * t / threads; instance < instances * (t + 1) / threads; instance++) {
+            glm::mat4 modelView = view * models[instance];
+            glm::mat4 modelViewProjection = projection * modelView;
+            glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(modelView));
+            for (int i = 0; i < vertexCount; i++) {
+                glm::vec4 position(vertices[i * 6], vertices[i * 6 + 1], vertices[i * 6 + 2], 1);
+                glm::vec3 normal(vertices[i * 6 + 3], vertices[i * 6 + 4], vertices[i * 6 + 5]);
+                glm::vec4 clip = modelViewProjection * position;
+                RasterVertex &out = transformed[(long)instance * vertexCount + i];
+                out.invW = clip.w > 0 ? 1.0f / clip.w : 0;      // 0 marks a vertex behind the camera
+                out.x = (clip.x * out.invW + 1) * halfWidth;
+                out.y = (clip.y * out.invW + 1) * halfHeight;
+                out.z = (clip.z * out.invW + 1) * 0.5f;
+                out.eye = glm::vec3(modelView * position);
+                out.normal = normalMatrix * normal;
+            }
+        }
+    });
+    double vertexTime = wallClockMs();
+
+    // Binning: every thread fills its own lists for a range of triangles, so no locking is needed
+    int columns = (image->width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    int rows = (image->height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    std::vector<std::vector<std::vector<int> > > bins(threads, std::vector<std::vector<int> >(columns * rows));
+    std::vector<long> binned(threads, 0);
+    parallel(threads, [&](int t) {
+        for (int triangle = (long)triangleCount * t / threads; triangle < (long)triangleCount * (t + 1) / threads; triangle++) {
+            const RasterVertex *v = &transformed[triangle * 3L];
+            if (v[0].invW == 0 || v[1].invW == 0 || v[2].invW == 0) continue;
+            if (v[0].z < 0 || v[1].z < 0 || v[2].z < 0) continue;       // Closer than the near plane
+
+            // The faces of the cube are flat but not consistently wound, so back faces are
+            // recognized by the normal pointing away from the viewer
+            if (glm::dot(v[0].normal, v[0].eye) >= 0) continue;
+
+            float minX = std::min(v[0].x, std::min(v[1].x, v[2].x)), maxX = std::max(v[0].x, std::max(v[1].x, v[2].x));
+            float minY = std::min(v[0].y, std::min(v[1].y, v[2].y)), maxY = std::max(v[0].y, std::max(v[1].y, v[2].y));
+            if (maxX < 0 || maxY < 0 || minX >= image->width || minY >= image->height) continue;
+
+            int tx0 = std::max(0, (int)minX / RASTER_TILE_SIZE), tx1 = std::min(columns - 1, (int)maxX / RASTER_TILE_SIZE);
+            int ty0 = std::max(0, (int)minY / RASTER_TILE_SIZE), ty1 = std::min(rows - 1, (int)maxY / RASTER_TILE_SIZE);
+            for (int ty = ty0; ty <= ty1; ty++) {
+                for (int tx = tx0; tx <= tx1; tx++) bins[t][ty * columns + tx].push_back(triangle);
+            }
+            binned[t]++;
+        }
+    });
+    double binTime = wallClockMs();
+
+    // Rasterization: threads take the next free tile until all are done
+    std::atomic<int> nextTile(0);
+    parallel(threads, [&](int) {
+        std::vector<int> visible(RASTER_TILE_SIZE * RASTER_TILE_SIZE);
+        for (int tile = nextTile++; tile < columns * rows; tile = nextTile++) {
+            int tileX0 = tile % columns * RASTER_TILE_SIZE, tileY0 = tile / columns * RASTER_TILE_SIZE;
+            int tileX1 = std::min(tileX0 + RASTER_TILE_SIZE, image->width) - 1;
+            int tileY1 = std::min(tileY0 + RASTER_TILE_SIZE, image->height) - 1;
+            std::fill(visible.begin(), visible.end(), -1);
+            for (int t = 0; t < threads; t++) {
+                const std::vector<int> &list = bins[t][tile];
+                for (size_t i = 0; i < list.size(); i++) {
+                    const RasterVertex *v = &transformed[list[i] * 3L];
+                    rasterizeTriangle(image, &visible[0], list[i], &v[0], &v[1], &v[2], tileX0, tileY0, tileX1, tileY1);
+                }
+            }
+            shadeTile(image, &visible[0], &transformed[0], tileX0, tileY0, tileX1, tileY1, lights);
+        }
+    });
+    double endTime = wallClockMs();
+
+    for (int t = 0; t < threads; t++) stats.triangles += binned[t];
+    stats.vertexMs = vertexTime - startTime;
+    stats.binMs = binTime - vertexTime;
+    stats.rasterMs = endTime - binTime;
+    stats.totalMs = endTime - startTime;
+    return stats;
+}
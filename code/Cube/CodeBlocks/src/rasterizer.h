@@ -0,0 +1,59 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Software rasterizer: renders the cube scene on the CPU, for machines without a GPU
+ * and as a reference to compare the GPU against.
+ *
+ * The same steps as the OpenGL pipeline, split between threads:
+ *  1. vertex stage: every vertex is transformed by the model, view and projection matrices
+ *  2. binning: the screen is divided into RASTER_TILE_SIZE x RASTER_TILE_SIZE tiles and every
+ *     front facing triangle is added to the lists of the tiles its bounding box touches
+ *  3. rasterization: threads take whole tiles, so no two threads ever write the same pixel.
+ *     The three edge functions are evaluated for four pixels at once with SSE and the covered
+ *     pixels are depth tested. The nearest triangle of every pixel is remembered, and when the
+ *     whole tile is done each pixel is shaded once with the same Phong model as phong.glsl.
+ * The cube's faces are flat but not consistently wound, so back faces are recognized by their
+ * normal instead of the winding. Triangles are not clipped: a triangle with a vertex behind
+ * the near plane is dropped.
+ */
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#define RASTER_TILE_SIZE 64
+
+typedef struct RasterImage {
+    int width, height;
+    int stride;                 // Row length in pixels, a multiple of 4
+    std::vector<float> color;   // RGB
+    std::vector<float> depth;   // Window space depth, 1 is the far plane
+} RasterImage;
+
+// Point light in eye space, with the same meaning as in phong.glsl
+typedef struct RasterLight {
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+} RasterLight;
+
+// Milliseconds spent in each stage of the last frame
+typedef struct RasterStats {
+    double vertexMs, binMs, rasterMs, totalMs;
+    long triangles;             // Front facing triangles on screen
+} RasterStats;
+
+struct RasterImage *initRasterImage(int width, int height);
+void freeRasterImage(struct RasterImage *image);
+void clearRasterImage(struct RasterImage *image);
+
+// Binary PPM, 8 bits per channel
+void saveRasterImage(const struct RasterImage *image, const char *filename);
+
+// Draw every instance (model matrix) of a triangle list of vertexCount vertices,
+// six floats each (position, normal) like cubeVertexData in cube.cpp
+RasterStats rasterize(struct RasterImage *image, const float *vertices, int vertexCount,
+                      const glm::mat4 *models, int instances, const glm::mat4 &view, const glm::mat4 &projection,
+                      const std::vector<RasterLight> &lights, int threads);
+
+#endif
@@ -0,0 +1,256 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Frustum culling of many cube instances with a bounding volume hierarchy.
+ */
+#include "scene.h"
+#include <math.h>
+#include <algorithm>
+#include <glm/gtc/matrix_inverse.hpp>
+#include "timer_util.h"
+
+#define SAH_BINS 12
+
+// ------------------ Box / frustum test ------------------ //
+// Returns -1 when the box is outside, 1 when it is inside all the planes and 0 when it crosses one
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+int testBox(const Frustum &frustum, glm::vec3 min, glm::vec3 max) {
+    glm::vec3 center = (min + max) * 0.5f, extent = (max - min) * 0.5f;
+    __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+    __m128 ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+    __m128 signMask = _mm_set1_ps(-0.0f);
+    int outside = 0, crossing = 0;
+    for (int i = 0; i < 8; i += 4) {
+        __m128 nx = _mm_loadu_ps(frustum.nx + i), ny = _mm_loadu_ps(frustum.ny + i), nz = _mm_loadu_ps(frustum.nz + i);
+
+        // Signed distance of the center and the projected half size of the box
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+                                     _mm_add_ps(_mm_mul_ps(nz, cz), _mm_loadu_ps(frustum.d + i)));
+        __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), ex),
+                                              _mm_mul_ps(_mm_andnot_ps(signMask, ny), ey)),
+                                   _mm_mul_ps(_mm_andnot_ps(signMask, nz), ez));
+        outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        crossing |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), _mm_setzero_ps()));
+    }
+    return outside ? -1 : crossing ? 0 : 1;
+}
+#else
+int testBox(const Frustum &frustum, glm::vec3 min, glm::vec3 max) {
+    glm::vec3 center = (min + max) * 0.5f, extent = (max - min) * 0.5f;
+    bool crossing = false;
+    for (int i = 0; i < 6; i++) {
+        float distance = frustum.nx[i] * center.x + frustum.ny[i] * center.y + frustum.nz[i] * center.z + frustum.d[i];
+        float radius = fabsf(frustum.nx[i]) * extent.x + fabsf(frustum.ny[i]) * extent.y + fabsf(frustum.nz[i]) * extent.z;
+        if (distance + radius < 0) return -1;
+        if (distance - radius < 0) crossing = true;
+    }
+    return crossing ? 0 : 1;
+}
+#endif
+
+Frustum frustumPlanes(const glm::mat4 &modelViewProjection) {
+    // A clip space point is inside when -w <= x, y, z <= w. Each of these inequalities is
+    // a plane: the fourth row of the matrix plus or minus one of the first three.
+    glm::mat4 m = glm::transpose(modelViewProjection);     // Rows of the matrix as columns
+    glm::vec4 planes[6] = {m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2]};
+
+    Frustum frustum;
+    for (int i = 0; i < 8; i++) {
+        glm::vec4 plane = planes[i < 6 ? i : 0];
+        plane /= glm::length(glm::vec3(plane));
+        frustum.nx[i] = plane.x;
+        frustum.ny[i] = plane.y;
+        frustum.nz[i] = plane.z;
+        frustum.d[i] = plane.w;
+    }
+    return frustum;
+}
+
+static float surfaceArea(glm::vec3 min, glm::vec3 max) {
+    glm::vec3 size = max - min;
+    return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// Split the node in two with a binned SAH over the instance centroids, or leave it a leaf
+static void splitNode(struct Scene *scene, std::vector<int> &order, int nodeIndex) {
+    BVHNode node = scene->nodes[nodeIndex];
+    if (node.count <= BVH_LEAF_SIZE) return;
+
+    // Centroid bounds pick the axis and the bins
+    glm::vec3 centroidMin(INFINITY), centroidMax(-INFINITY);
+    for (int i = node.first; i < node.first + node.count; i++) {
+        glm::vec3 c = (scene->boundsMin[order[i]] + scene->boundsMax[order[i]]) * 0.5f;
+        centroidMin = glm::min(centroidMin, c);
+        centroidMax = glm::max(centroidMax, c);
+    }
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    if (extent[axis] <= 0) return;      // All centroids in one point
+    float scale = SAH_BINS / extent[axis];
+
+    struct { glm::vec3 min, max; int count; } bins[SAH_BINS];
+    for (int b = 0; b < SAH_BINS; b++) {
+        bins[b].min = glm::vec3(INFINITY);
+        bins[b].max = glm::vec3(-INFINITY);
+        bins[b].count = 0;
+    }
+    for (int i = node.first; i < node.first + node.count; i++) {
+        int instance = order[i];
+        float c = (scene->boundsMin[instance][axis] + scene->boundsMax[instance][axis]) * 0.5f;
+        int b = std::min(SAH_BINS - 1, (int)((c - centroidMin[axis]) * scale));
+        bins[b].min = glm::min(bins[b].min, scene->boundsMin[instance]);
+        bins[b].max = glm::max(bins[b].max, scene->boundsMax[instance]);
+        bins[b].count++;
+    }
+
+    // Cost of splitting after bin b: area of each side times its instances, relative to the node.
+    // Sweep from the right first to get the right-hand areas.
+    float rightCost[SAH_BINS];
+    glm::vec3 boxMin(INFINITY), boxMax(-INFINITY);
+    int count = 0;
+    for (int b = SAH_BINS - 1; b > 0; b--) {
+        boxMin = glm::min(boxMin, bins[b].min);
+        boxMax = glm::max(boxMax, bins[b].max);
+        count += bins[b].count;
+        rightCost[b] = count ? surfaceArea(boxMin, boxMax) * count : 0;
+    }
+    float bestCost = INFINITY;
+    int bestSplit = -1;
+    boxMin = glm::vec3(INFINITY);
+    boxMax = glm::vec3(-INFINITY);
+    count = 0;
+    for (int b = 0; b < SAH_BINS - 1; b++) {
+        boxMin = glm::min(boxMin, bins[b].min);
+        boxMax = glm::max(boxMax, bins[b].max);
+        count += bins[b].count;
+        float cost = (count ? surfaceArea(boxMin, boxMax) * count : 0) + rightCost[b + 1];
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestSplit = b;
+        }
+    }
+
+    // Visiting a node costs about as much as testing one instance
+    float area = surfaceArea(node.min, node.max);
+    if (bestSplit < 0 || 1 + bestCost / area >= node.count) return;
+
+    int *middle = std::partition(&order[node.first], &order[node.first] + node.count, [&](int instance) {
+        float c = (scene->boundsMin[instance][axis] + scene->boundsMax[instance][axis]) * 0.5f;
+        return std::min(SAH_BINS - 1, (int)((c - centroidMin[axis]) * scale)) <= bestSplit;
+    });
+    int leftCount = (int)(middle - &order[node.first]);
+    if (leftCount == 0 || leftCount == node.count) return;
+
+    BVHNode left, right;
+    left.first = node.first;
+    left.count = leftCount;
+    right.first = node.first + leftCount;
+    right.count = node.count - leftCount;
+    BVHNode *children[2] = {&left, &right};
+    for (int c = 0; c < 2; c++) {
+        children[c]->left = -1;
+        children[c]->min = glm::vec3(INFINITY);
+        children[c]->max = glm::vec3(-INFINITY);
+        for (int i = children[c]->first; i < children[c]->first + children[c]->count; i++) {
+            children[c]->min = glm::min(children[c]->min, scene->boundsMin[order[i]]);
+            children[c]->max = glm::max(children[c]->max, scene->boundsMax[order[i]]);
+        }
+    }
+    scene->nodes[nodeIndex].left = (int)scene->nodes.size();
+    scene->nodes.push_back(left);
+    scene->nodes.push_back(right);
+}
+
+struct Scene *initScene(const std::vector<glm::mat4> &models) {
+    double startTime = wallClockMs();
+    struct Scene *scene = new Scene;
+    int count = scene->count = (int)models.size();
+
+    // Bounding box of the 8 transformed corners of the unit cube
+    std::vector<glm::vec3> boundsMin(count), boundsMax(count);
+    for (int i = 0; i < count; i++) {
+        glm::vec3 origin(models[i][3]);
+        boundsMin[i] = boundsMax[i] = origin;
+        for (int corner = 1; corner < 8; corner++) {
+            glm::vec3 p = origin;
+            for (int axis = 0; axis < 3; axis++) {
+                if (corner & (1 << axis)) p += glm::vec3(models[i][axis]);
+            }
+            boundsMin[i] = glm::min(boundsMin[i], p);
+            boundsMax[i] = glm::max(boundsMax[i], p);
+        }
+    }
+    scene->boundsMin = boundsMin;
+    scene->boundsMax = boundsMax;
+
+    std::vector<int> order(count);
+    for (int i = 0; i < count; i++) order[i] = i;
+
+    BVHNode root;
+    root.left = -1;
+    root.first = 0;
+    root.count = count;
+    root.min = glm::vec3(INFINITY);
+    root.max = glm::vec3(-INFINITY);
+    for (int i = 0; i < count; i++) {
+        root.min = glm::min(root.min, boundsMin[i]);
+        root.max = glm::max(root.max, boundsMax[i]);
+    }
+    scene->nodes.reserve(2 * count / BVH_LEAF_SIZE + 1);
+    scene->nodes.push_back(root);
+
+    // Children are appended behind their parent, so one pass over the growing array splits them all
+    if (count > 0) {
+        for (size_t i = 0; i < scene->nodes.size(); i++) splitNode(scene, order, (int)i);
+    }
+
+    // Store the instances in the order of the leaves
+    scene->models.resize(count);
+    scene->normalMatrices.resize(count);
+    for (int i = 0; i < count; i++) {
+        scene->models[i] = models[order[i]];
+        scene->normalMatrices[i] = glm::inverseTranspose(glm::mat3(models[order[i]]));
+        scene->boundsMin[i] = boundsMin[order[i]];
+        scene->boundsMax[i] = boundsMax[order[i]];
+    }
+    scene->visible.reserve(count);
+    scene->buildMs = wallClockMs() - startTime;
+    return scene;
+}
+
+void freeScene(struct Scene *scene) {
+    delete scene;
+}
+
+int cullScene(struct Scene *scene, const glm::mat4 &modelViewProjection) {
+    scene->visible.clear();
+    if (scene->count == 0) return 0;
+    Frustum frustum = frustumPlanes(modelViewProjection);
+
+    std::vector<int> stack(1, 0);
+    while (!stack.empty()) {
+        const BVHNode &node = scene->nodes[stack.back()];
+        stack.pop_back();
+        int test = testBox(frustum, node.min, node.max);
+        if (test < 0) continue;
+        if (test > 0 || node.left < 0) {
+            // Inside: take everything below. A crossing leaf tests its instances one by one.
+            for (int i = node.first; i < node.first + node.count; i++) {
+                if (test > 0 || testBox(frustum, scene->boundsMin[i], scene->boundsMax[i]) >= 0) scene->visible.push_back(i);
+            }
+            continue;
+        }
+        stack.push_back(node.left + 1);
+        stack.push_back(node.left);
+    }
+    return (int)scene->visible.size();
+}
+
+int cullSceneLinear(struct Scene *scene, const glm::mat4 &modelViewProjection) {
+    scene->visible.clear();
+    Frustum frustum = frustumPlanes(modelViewProjection);
+    for (int i = 0; i < scene->count; i++) {
+        if (testBox(frustum, scene->boundsMin[i], scene->boundsMax[i]) >= 0) scene->visible.push_back(i);
+    }
+    return (int)scene->visible.size();
+}
@@ -0,0 +1,64 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Frustum culling of many cube instances with a bounding volume hierarchy.
+ *
+ * Submitting every instance makes the GPU transform the vertices of cubes that end up
+ * outside the screen. A scene keeps the world space bounding box (AABB) of every instance
+ * and a BVH over them: a binary tree whose nodes hold the box around all instances below.
+ * The tree is built top-down, splitting each node where the surface area heuristic (SAH)
+ * estimates the cheapest traversal.
+ *
+ * Culling walks the tree against the six frustum planes taken from the model view projection
+ * matrix. A node outside one plane is skipped with everything below it, a node inside all
+ * planes is accepted without testing its children, and only nodes crossing a plane are opened.
+ * A box is tested against four planes at a time with SSE.
+ */
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#define BVH_LEAF_SIZE 4     // A node with at most this many instances is not split further
+
+typedef struct BVHNode {
+    glm::vec3 min, max;     // Bounding box of the instances below
+    int left;               // Index of the left child, the right one follows it. -1 in a leaf.
+    int first, count;       // Instances below the node, a range of the scene arrays
+} BVHNode;
+
+// Instances sorted by the build so that every node covers a contiguous range
+typedef struct Scene {
+    int count;
+    std::vector<glm::mat4> models;
+    std::vector<glm::mat3> normalMatrices;
+    std::vector<glm::vec3> boundsMin, boundsMax;    // World space AABB of every instance
+    std::vector<BVHNode> nodes;                     // nodes[0] is the root
+    std::vector<int> visible;                       // Instances left by the last culling
+    double buildMs;
+} Scene;
+
+// Frustum planes in structure of arrays form, padded to 8 with copies of the first one.
+// A point p is inside a plane when n.p + d >= 0.
+typedef struct Frustum {
+    float nx[8], ny[8], nz[8], d[8];
+} Frustum;
+
+// Scene of unit cubes ([0, 1]^3) placed by the given model matrices
+struct Scene *initScene(const std::vector<glm::mat4> &models);
+void freeScene(struct Scene *scene);
+
+// Planes of the view frustum of a model view projection matrix
+Frustum frustumPlanes(const glm::mat4 &modelViewProjection);
+
+// Test a box against the planes: -1 when it is outside, 1 when it is inside all of them
+// and 0 when it crosses one
+int testBox(const Frustum &frustum, glm::vec3 min, glm::vec3 max);
+
+// Fill scene->visible with the instances that may be visible, and return their number
+int cullScene(struct Scene *scene, const glm::mat4 &modelViewProjection);
+
+// The same without the tree, testing every instance
+int cullSceneLinear(struct Scene *scene, const glm::mat4 &modelViewProjection);
+
+#endif
@@ -10,8 +10,16 @@
 #include <fstream>
 #include <vector>
 #include <cstring>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 using std::strcpy;
 
+// Program binary cache
+static std::string cache_directory;
+static program_cache_stats cache_stats = {0, 0, 0};
+
 // -------- Utility functions --------------
 /**
  * Reads file contents into a string.
@@ -24,9 +32,10 @@ std::string get_file_contents(const char *filename) {
 }
 
 /**
- * Allocates and compiles given shader in OpenGL
+ * Allocates the shader and starts compiling it. The status is not asked for here, as asking waits
+ * for the compiler; see check_compiled.
  */
-GLuint compile(GLuint type, std::string source) {
+static GLuint start_compile(GLuint type, const std::string &source) {
     GLuint shader = glCreateShader(type);
 
     // Split the code into separate lines (then the compilation error messages are more informative)
@@ -44,7 +53,13 @@ GLuint compile(GLuint type, std::string source) {
     glShaderSource(shader, lines.size(), (const GLchar**)&lines[0], NULL);
     glCompileShader(shader);
     for (int i = 0; i < lines.size(); i++) free(lines[i]);
+    return shader;
+}
 
+/**
+ * Throws std::logic_error with the log if the shader did not compile
+ */
+static void check_compiled(GLuint shader) {
     GLint compiled;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
     if (!compiled) {
@@ -54,11 +69,149 @@ GLuint compile(GLuint type, std::string source) {
         glGetShaderInfoLog(shader, length, &length, &log[0]);
         std::cout << "Shader compilation error: " << log << std::endl;
         throw std::logic_error(log);
-        return false;
     }
+}
+
+/**
+ * Allocates and compiles given shader in OpenGL
+ */
+GLuint compile(GLuint type, std::string source) {
+    GLuint shader = start_compile(type, source);
+    check_compiled(shader);
     return shader;
 }
 
+/**
+ * GL_KHR_parallel_shader_compile (or the ARB version) is not in this GLEW, its names are
+ * defined and the thread count function is loaded here
+ */
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (GLAPIENTRY *max_shader_compiler_threads_proc)(GLuint count);
+
+static bool has_extension(const char *name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) return true;
+    }
+    return false;
+}
+
+bool parallel_shader_compile_supported() {
+    static int supported = -1;
+    if (supported < 0) {
+        const char *names[2][2] = {{"GL_KHR_parallel_shader_compile", "glMaxShaderCompilerThreadsKHR"},
+                                   {"GL_ARB_parallel_shader_compile", "glMaxShaderCompilerThreadsARB"}};
+        supported = 0;
+        for (int i = 0; i < 2 && !supported; i++) {
+            if (!has_extension(names[i][0])) continue;
+            supported = 1;
+
+            // 0xFFFFFFFF lets the driver use as many threads as it likes
+            max_shader_compiler_threads_proc threads = (max_shader_compiler_threads_proc)glutGetProcAddress(names[i][1]);
+            if (threads != NULL) threads(0xFFFFFFFF);
+        }
+    }
+    return supported != 0;
+}
+
+/**
+ * Program binaries can be saved if the driver has at least one binary format
+ */
+static bool program_cache_enabled() {
+    if (cache_directory.empty() || !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)) return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+/**
+ * 64-bit FNV-1a hash, names the cache files
+ */
+static unsigned long long fnv1a(const std::string &data) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < data.size(); i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Loads the binary saved under the key into the program. False if there is no such file,
+ * it was saved under another key, it is truncated, or the driver does not accept it any more.
+ * Counts the miss or the rejection.
+ */
+static bool load_program_binary(GLuint prog, const std::string &file, const std::string &key) {
+    std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+    GLenum format;
+    GLint keyLength = 0, length = 0;
+
+    // The lengths are checked against the key and the rest of the file before anything is allocated
+    bool valid = in.read((char*)&format, sizeof(format)) && in.read((char*)&keyLength, sizeof(keyLength)) &&
+                 keyLength == (GLint)key.size();
+    std::string savedKey(valid ? keyLength : 0, ' ');
+    valid = valid && in.read(&savedKey[0], keyLength) && savedKey == key && in.read((char*)&length, sizeof(length));
+    std::streamoff rest = 0;
+    if (valid) {
+        std::streampos position = in.tellg();
+        in.seekg(0, std::ios::end);
+        rest = in.tellg() - position;
+        in.seekg(position);
+    }
+    valid = valid && length > 0 && length <= rest;
+    std::vector<char> binary(valid ? length : 0);
+    if (!valid || !in.read(&binary[0], length)) {
+        cache_stats.misses++;
+        return false;
+    }
+
+    glProgramBinary(prog, format, &binary[0], length);
+    GLint linked;
+    glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+    if (!linked) cache_stats.rejected++;
+    return linked != 0;
+}
+
+/**
+ * Saves the binary of a linked program under the key: binary format, key, binary
+ */
+static void save_program_binary(GLuint prog, const std::string &file, const std::string &key) {
+    GLint linked, length;
+    glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (!linked || length <= 0) return;
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(prog, length, &length, &format, &binary[0]);
+    GLint keyLength = (GLint)key.size();
+    std::ofstream out(file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write((const char*)&format, sizeof(format));
+    out.write((const char*)&keyLength, sizeof(keyLength));
+    out.write(key.data(), keyLength);
+    out.write((const char*)&length, sizeof(length));
+    out.write(&binary[0], length);
+    if (!out) std::cout << "Could not write the program binary " << file << std::endl;
+}
+
+void set_program_cache(const char *directory) {
+    cache_directory = directory == NULL ? "" : directory;
+    if (directory == NULL) return;
+#ifdef _WIN32
+    _mkdir(directory);
+#else
+    mkdir(directory, 0755);
+#endif
+}
+
+program_cache_stats get_program_cache_stats() {
+    return cache_stats;
+}
+
 /**
  * Default shaders.
  */
@@ -80,15 +233,109 @@ const GLchar *default_fragment_shader = // Only supports coloring. Textures requ
 shader_prog::shader_prog(const char* vertex_shader_filename, const char* fragment_shader_filename) {
     v_source = vertex_shader_filename == NULL ? std::string((const char*)default_vertex_shader) : get_file_contents(vertex_shader_filename);
     f_source = fragment_shader_filename == NULL ? std::string((const char*)default_fragment_shader) : get_file_contents(fragment_shader_filename);
+    vertex_shader = fragment_shader = compute_shader = prog = 0;
+    linking = false;
 }
 
-void shader_prog::use() {
-    vertex_shader = compile(GL_VERTEX_SHADER, v_source);
-    fragment_shader = compile(GL_FRAGMENT_SHADER, f_source);
+shader_prog::shader_prog(const char* compute_shader_filename) {
+    c_source = get_file_contents(compute_shader_filename);
+    vertex_shader = fragment_shader = compute_shader = prog = 0;
+    linking = false;
+}
+
+void shader_prog::prepend(GLuint type, const std::string &code) {
+    std::string &source = type == GL_VERTEX_SHADER ? v_source : type == GL_FRAGMENT_SHADER ? f_source : c_source;
+    size_t pos = source.find("#version");
+    pos = pos == std::string::npos ? 0 : source.find('\n', pos) + 1;
+    source.insert(pos, code);
+}
+
+std::string shader_prog::binary_key() {
+    std::ostringstream key;
+    key << glGetString(GL_VENDOR) << '\n' << glGetString(GL_RENDERER) << '\n' << glGetString(GL_VERSION) << '\n';
+    key << v_source << '\0' << f_source << '\0' << c_source;
+    return key.str();
+}
+
+std::string shader_prog::cache_file() {
+    if (!program_cache_enabled()) return "";
+    std::ostringstream file;
+    file << cache_directory << "/program_" << std::hex << fnv1a(binary_key()) << ".bin";
+    return file.str();
+}
+
+void shader_prog::use_async() {
     prog = glCreateProgram();
-    glAttachShader(prog, vertex_shader);
-    glAttachShader(prog, fragment_shader);
+    linking = false;
+
+    // A binary of the same sources saves compiling and linking
+    binary_file = cache_file();
+    if (!binary_file.empty()) {
+        if (load_program_binary(prog, binary_file, binary_key())) {
+            cache_stats.hits++;
+            introspect();
+            return;
+        }
+        glDeleteProgram(prog);      // A rejected binary may leave the program unusable
+        prog = glCreateProgram();
+        glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // Every stage and the link are only submitted. With parallel compile the driver's threads
+    // work on them; without it many drivers still compile lazily, up to the first status query.
+    parallel_shader_compile_supported();
+    if (c_source.empty()) {
+        vertex_shader = start_compile(GL_VERTEX_SHADER, v_source);
+        fragment_shader = start_compile(GL_FRAGMENT_SHADER, f_source);
+        glAttachShader(prog, vertex_shader);
+        glAttachShader(prog, fragment_shader);
+    } else {
+        compute_shader = start_compile(GL_COMPUTE_SHADER, c_source);
+        glAttachShader(prog, compute_shader);
+    }
     glLinkProgram(prog);
+    linking = true;
+}
+
+bool shader_prog::ready() {
+    if (!linking) return true;
+    if (parallel_shader_compile_supported()) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(prog, GL_COMPLETION_STATUS_KHR, &done);
+        if (!done) return false;
+    }
+    finish_link();
+    return true;
+}
+
+/**
+ * Checks the stages and the link, then saves the binary and reads the uniforms
+ */
+void shader_prog::finish_link() {
+    linking = false;
+    if (c_source.empty()) {
+        check_compiled(vertex_shader);
+        check_compiled(fragment_shader);
+    } else {
+        check_compiled(compute_shader);
+    }
+    GLint linked;
+    glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        GLint length;
+        glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &length);
+        std::string log(length, ' ');
+        glGetProgramInfoLog(prog, length, &length, &log[0]);
+        std::cout << "Shader link error: " << log << std::endl;
+        throw std::logic_error(log);
+    }
+    if (!binary_file.empty()) save_program_binary(prog, binary_file, binary_key());
+    introspect();
+}
+
+void shader_prog::use() {
+    use_async();
+    if (linking) finish_link();
     glUseProgram(prog);
 }
 
@@ -96,31 +343,197 @@ void shader_prog::free() {
     glDeleteProgram(prog);
     glDeleteShader(vertex_shader);
     glDeleteShader(fragment_shader);
+    glDeleteShader(compute_shader);
     glUseProgram(0);
+    uniforms.clear();
+    uniform_names.clear();
+    linking = false;
 }
 
 shader_prog::operator GLuint() {
     return prog;
 }
 
-void shader_prog::uniform1i(const char* name, int i) {
+/**
+ * Fills the uniform table with the active uniforms outside blocks. An array is listed by glGetActiveUniform
+ * as "name[0]" and is found by both names, which lead to the same entry. The value of an array of more
+ * than one element is not cached: its elements can also be set by name ("name[2]") through locations
+ * of their own, and an upload through one would leave the other's cached value stale.
+ */
+void shader_prog::introspect() {
+    uniforms.clear();
+    uniform_names.clear();
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(prog, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(prog, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<GLchar> name(maxLength + 1);
+    for (GLint i = 0; i < count; i++) {
+        GLint size;
+        GLenum type;
+        GLsizei length = 0;
+        glGetActiveUniform(prog, i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+        std::string uniform(&name[0], length);
+        uniform_info info;
+        info.location = glGetUniformLocation(prog, uniform.c_str());
+        info.cached = size == 1;
+        if (info.location < 0) continue;    // A member of a uniform block
+        uniform_names[uniform] = (int)uniforms.size();
+        if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0) {
+            uniform_names[uniform.substr(0, uniform.size() - 3)] = (int)uniforms.size();
+        }
+        uniforms.push_back(info);
+    }
+}
+
+/**
+ * Entry of the uniform table. Names missing from it (e.g. "lights[2]") are looked up in OpenGL once,
+ * and share the entry of a name already known for the same location. Such names are elements of
+ * arrays, so their values are not cached either.
+ */
+shader_prog::uniform_info &shader_prog::find_uniform(const char *name) {
+    std::unordered_map<std::string, int>::iterator found = uniform_names.find(name);
+    if (found != uniform_names.end()) return uniforms[found->second];
     GLint loc = glGetUniformLocation(prog, name);
     if (loc < 0) throw (std::runtime_error(std::string("Location not found in shader program for variable ") + name));
-    glUniform1i(loc, i);
+    int index = 0;
+    while (index < (int)uniforms.size() && uniforms[index].location != loc) index++;
+    if (index == (int)uniforms.size()) {
+        uniform_info info;
+        info.location = loc;
+        info.cached = false;
+        uniforms.push_back(info);
+    }
+    uniform_names[name] = index;
+    return uniforms[index];
+}
+
+/**
+ * True if the value is the one uploaded last time, otherwise remembers it. Always false when not cached.
+ */
+static bool unchanged(std::vector<char> &last, bool cached, const void *value, size_t bytes) {
+    if (!cached) return false;
+    if (last.size() == bytes && (bytes == 0 || memcmp(&last[0], value, bytes) == 0)) return true;
+    last.assign((const char*)value, (const char*)value + bytes);
+    return false;
+}
+
+void shader_prog::uniform1i(const char* name, int i) {
+    uniform_info &info = find_uniform(name);
+    if (!unchanged(info.value, info.cached, &i, sizeof(i))) glUniform1i(info.location, i);
 }
 void shader_prog::uniform1f(const char* name, float f) {
-    GLint loc = glGetUniformLocation(prog, name);
-    if (loc < 0) throw (std::runtime_error(std::string("Location not found in shader program for variable ") + name));
-    glUniform1f(loc, f);
+    uniform_info &info = find_uniform(name);
+    if (!unchanged(info.value, info.cached, &f, sizeof(f))) glUniform1f(info.location, f);
 }
 void shader_prog::uniform3f(const char* name, float x, float y, float z) {
-    GLint loc = glGetUniformLocation(prog, name);
-    if (loc < 0) throw (std::runtime_error(std::string("Location not found in shader program for variable ") + name));
-    glUniform3f(loc, x, y, z);
+    uniform_info &info = find_uniform(name);
+    float v[3] = {x, y, z};
+    if (!unchanged(info.value, info.cached, v, sizeof(v))) glUniform3f(info.location, x, y, z);
+}
+void shader_prog::uniform4fv(const char* name, int count, const float* values) {
+    uniform_info &info = find_uniform(name);
+    if (!unchanged(info.value, info.cached, values, count * 4 * sizeof(float))) glUniform4fv(info.location, count, values);
+}
+void shader_prog::uniformMatrix3fv(const char* name, const float* matrix) {
+    uniform_info &info = find_uniform(name);
+    if (!unchanged(info.value, info.cached, matrix, 9 * sizeof(float))) glUniformMatrix3fv(info.location, 1, GL_FALSE, matrix);
 }
 void shader_prog::uniformMatrix4fv(const char* name, const float* matrix) {
-    GLint loc = glGetUniformLocation(prog, name);
-    if (loc < 0) throw (std::runtime_error(std::string("Location not found in shader program for variable ") + name));
-    glUniformMatrix4fv(loc, 1, GL_FALSE, matrix);
+    uniform_info &info = find_uniform(name);
+    if (!unchanged(info.value, info.cached, matrix, 16 * sizeof(float))) glUniformMatrix4fv(info.location, 1, GL_FALSE, matrix);
+}
+
+void shader_prog::bind_uniform_block(const char* name, GLuint binding) {
+    GLuint index = glGetUniformBlockIndex(prog, name);
+    if (index == GL_INVALID_INDEX) throw (std::runtime_error(std::string("Uniform block not found in shader program: ") + name));
+    glUniformBlockBinding(prog, index, binding);
+}
+
+// -------- Uniform blocks --------------
+uniform_block::uniform_block(shader_prog &program, const char* name, GLuint binding) : binding(binding), changed(true) {
+    GLuint index = glGetUniformBlockIndex(program, name);
+    if (index == GL_INVALID_INDEX) throw (std::runtime_error(std::string("Uniform block not found in shader program: ") + name));
+    program.bind_uniform_block(name, binding);
+
+    GLint size = 0, count = 0, maxLength = 0;
+    glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+    glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    if (count > 0) {
+        std::vector<GLint> indices(count), offsets(count), arrayStrides(count), matrixStrides(count);
+        glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES, &indices[0]);
+        const GLuint *uniformIndices = (const GLuint*)&indices[0];
+        glGetActiveUniformsiv(program, count, uniformIndices, GL_UNIFORM_OFFSET, &offsets[0]);
+        glGetActiveUniformsiv(program, count, uniformIndices, GL_UNIFORM_ARRAY_STRIDE, &arrayStrides[0]);
+        glGetActiveUniformsiv(program, count, uniformIndices, GL_UNIFORM_MATRIX_STRIDE, &matrixStrides[0]);
+
+        std::vector<GLchar> memberName(maxLength + 1);
+        for (GLint i = 0; i < count; i++) {
+            GLsizei length = 0;
+            glGetActiveUniformName(program, uniformIndices[i], (GLsizei)memberName.size(), &length, &memberName[0]);
+            std::string member(&memberName[0], length);
+            member_info info = {offsets[i], arrayStrides[i], matrixStrides[i]};
+            members[member] = info;
+            if (member.size() > 3 && member.compare(member.size() - 3, 3, "[0]") == 0) {
+                members[member.substr(0, member.size() - 3)] = info;
+            }
+        }
+    }
+
+    data.assign(size, 0);
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void uniform_block::free() {
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+int uniform_block::size() {
+    return (int)data.size();
+}
+
+/**
+ * Copies a value into the block: column of a matrix, or element of an array
+ */
+void uniform_block::write(const char* name, int element, int column, const void* value, int bytes) {
+    std::unordered_map<std::string, member_info>::iterator found = members.find(name);
+    if (found == members.end()) throw (std::runtime_error(std::string("Member not found in uniform block: ") + name));
+    char *target = &data[found->second.offset + element * found->second.array_stride + column * found->second.matrix_stride];
+    if (memcmp(target, value, bytes) == 0) return;
+    memcpy(target, value, bytes);
+    changed = true;
+}
+
+void uniform_block::uniform1i(const char* name, int i) {
+    write(name, 0, 0, &i, sizeof(i));
+}
+void uniform_block::uniform1f(const char* name, float f) {
+    write(name, 0, 0, &f, sizeof(f));
+}
+void uniform_block::uniform3f(const char* name, float x, float y, float z) {
+    float v[3] = {x, y, z};
+    write(name, 0, 0, v, sizeof(v));
+}
+void uniform_block::uniform4fv(const char* name, int count, const float* values) {
+    for (int i = 0; i < count; i++) write(name, i, 0, values + 4 * i, 4 * sizeof(float));
+}
+void uniform_block::uniformMatrix3fv(const char* name, const float* matrix) {
+    for (int column = 0; column < 3; column++) write(name, 0, column, matrix + 3 * column, 3 * sizeof(float));
+}
+void uniform_block::uniformMatrix4fv(const char* name, const float* matrix) {
+    for (int column = 0; column < 4; column++) write(name, 0, column, matrix + 4 * column, 4 * sizeof(float));
 }
 
+void uniform_block::upload() {
+    if (changed) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, data.size(), &data[0]);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        changed = false;
+    }
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+}
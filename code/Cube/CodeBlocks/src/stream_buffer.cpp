@@ -0,0 +1,80 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Streaming per-frame data to the GPU without stalls.
+ */
+#include "stream_buffer.h"
+
+struct StreamBuffer *initStreamBuffer(GLenum target, long regionBytes, bool allowPersistent) {
+    struct StreamBuffer *stream = new StreamBuffer;
+    stream->target = target;
+    stream->region = 0;
+    stream->stalls = 0;
+    stream->persistentData = NULL;
+    for (int i = 0; i < STREAM_FRAMES; i++) stream->fences[i] = 0;
+
+    // Regions of a uniform buffer have to start at a multiple of the offset alignment
+    GLint alignment = 1;
+    if (target == GL_UNIFORM_BUFFER) glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    stream->regionBytes = (regionBytes + alignment - 1) / alignment * alignment;
+    long bytes = stream->regionBytes * STREAM_FRAMES;
+
+    glGenBuffers(1, &stream->buffer);
+    glBindBuffer(target, stream->buffer);
+    stream->persistent = allowPersistent && GLEW_ARB_buffer_storage;
+    if (stream->persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(target, bytes, NULL, flags);
+        stream->persistentData = (char *)glMapBufferRange(target, 0, bytes, flags);
+    } else {
+        glBufferData(target, bytes, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(target, 0);
+    return stream;
+}
+
+void freeStreamBuffer(struct StreamBuffer *stream) {
+    for (int i = 0; i < STREAM_FRAMES; i++) {
+        if (stream->fences[i]) glDeleteSync(stream->fences[i]);
+    }
+    if (stream->persistent) {
+        glBindBuffer(stream->target, stream->buffer);
+        glUnmapBuffer(stream->target);
+        glBindBuffer(stream->target, 0);
+    }
+    glDeleteBuffers(1, &stream->buffer);
+    delete stream;
+}
+
+void *beginStreamFrame(struct StreamBuffer *stream) {
+    GLsync fence = stream->fences[stream->region];
+    if (fence) {
+        // Count the frames where the GPU was still reading the region from STREAM_FRAMES frames ago
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            stream->stalls++;
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fence);
+        stream->fences[stream->region] = 0;
+    }
+
+    if (stream->persistent) return stream->persistentData + streamFrameOffset(stream);
+    glBindBuffer(stream->target, stream->buffer);
+    return glMapBufferRange(stream->target, streamFrameOffset(stream), stream->regionBytes,
+                            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+}
+
+void flushStreamFrame(struct StreamBuffer *stream) {
+    // A coherent persistent mapping needs nothing: the writes are visible to the next draw call
+    if (stream->persistent) return;
+    glBindBuffer(stream->target, stream->buffer);
+    glUnmapBuffer(stream->target);
+}
+
+long streamFrameOffset(const struct StreamBuffer *stream) {
+    return stream->regionBytes * stream->region;
+}
+
+void endStreamFrame(struct StreamBuffer *stream) {
+    stream->fences[stream->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stream->region = (stream->region + 1) % STREAM_FRAMES;
+}
@@ -0,0 +1,52 @@
+/**
+ * MTAT.03.015 Computer Graphics.
+ * Streaming per-frame data (uniform blocks, instance attributes) to the GPU without stalls.
+ *
+ * Every glUniform call looks the uniform up by name, and writing a buffer that the GPU may
+ * still be reading from (glBufferSubData) makes the driver wait or copy. A stream buffer is
+ * one buffer object split into STREAM_FRAMES regions, used in turn by consecutive frames.
+ * A fence placed after the last draw reading a region tells when the GPU is done with it.
+ * With three regions the CPU writes frame n while the GPU may still draw frames n-1 and n-2,
+ * so the wait for the fence normally returns at once.
+ *
+ * With GL_ARB_buffer_storage (OpenGL 4.4) the whole buffer is mapped once with
+ * GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT and stays mapped while the GPU uses it.
+ * Otherwise each frame maps its region with glMapBufferRange, GL_MAP_UNSYNCHRONIZED_BIT
+ * (the fence already guarantees the GPU is not reading it) and GL_MAP_INVALIDATE_RANGE_BIT
+ * (the old contents are orphaned), and unmaps it before drawing.
+ */
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <GL/glew.h>
+
+#define STREAM_FRAMES 3
+
+typedef struct StreamBuffer {
+    GLenum target;                  // E.g. GL_UNIFORM_BUFFER or GL_ARRAY_BUFFER
+    GLuint buffer;
+    long regionBytes;               // Size of the region of one frame
+    int region;                     // Region of the current frame
+    bool persistent;                // Mapped once with GL_MAP_PERSISTENT_BIT
+    char *persistentData;           // Start of the buffer when persistent
+    GLsync fences[STREAM_FRAMES];   // Signalled when the GPU has finished with a region
+    long stalls;                    // Frames that had to wait for the GPU
+} StreamBuffer;
+
+// Buffer for regionBytes of data per frame. The persistent mapping is used when
+// allowPersistent is set and the driver supports it.
+struct StreamBuffer *initStreamBuffer(GLenum target, long regionBytes, bool allowPersistent);
+void freeStreamBuffer(struct StreamBuffer *stream);
+
+// Wait until the GPU has finished the region of the next frame and return a pointer to it.
+// Write the data of the frame there, then call flushStreamFrame before the draw calls.
+void *beginStreamFrame(struct StreamBuffer *stream);
+void flushStreamFrame(struct StreamBuffer *stream);
+
+// Offset of the current region in the buffer, for glBindBufferRange or vertex attribute pointers
+long streamFrameOffset(const struct StreamBuffer *stream);
+
+// Fence the region after the last draw call reading it
+void endStreamFrame(struct StreamBuffer *stream);
+
+#endif
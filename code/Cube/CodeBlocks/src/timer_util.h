@@ -0,0 +1,63 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Measuring how long the GPU actually works.
+ *
+ * OpenGL calls only put commands into a queue, so a CPU clock read right after glFlush()
+ * tells how fast we submit work, not how fast the GPU executes it. Timer queries
+ * (GL_TIME_ELAPSED, GL_TIMESTAMP) are measured by the GPU itself. A wall clock is
+ * still meaningful when the measured interval starts and ends with glFinish().
+ */
+#ifndef TIMER_UTIL_H
+#define TIMER_UTIL_H
+
+#include <stdio.h>
+#include <GL/glew.h>
+
+// A set of GL_TIME_ELAPSED queries, one per measured pass,
+// plus two GL_TIMESTAMP queries around the whole sequence
+typedef struct GPUtimer {
+    GLuint *queries;        // One GL_TIME_ELAPSED query per pass
+    GLuint stamps[2];       // GL_TIMESTAMP at the start and at the end
+    int capacity;           // Number of queries allocated
+    int count;              // Number of passes measured so far
+    bool supported;         // False when the driver lacks ARB_timer_query
+} GPUtimer;
+
+// Summary of a series of measurements, in milliseconds
+typedef struct TimingStats {
+    int samples;
+    double min, median, p95, p99, mean, total;
+} TimingStats;
+
+// Milliseconds from an arbitrary point in the past, with sub-millisecond resolution
+double wallClockMs();
+
+struct GPUtimer *initGPUTimer(int capacity);
+void freeGPUTimer(struct GPUtimer *timer);
+
+// Record a GL_TIMESTAMP before the first and after the last pass
+void startGPUTimer(struct GPUtimer *timer);
+void stopGPUTimer(struct GPUtimer *timer);
+
+// Bracket a single pass with a GL_TIME_ELAPSED query
+void beginGPUPass(struct GPUtimer *timer);
+void endGPUPass(struct GPUtimer *timer);
+
+// Wait for the query results and copy the time of every pass, in the order they were measured
+void gpuPassTimes(struct GPUtimer *timer, double *ms);
+
+// Wait for the query results and aggregate them.
+// gpuSpanMs (optional) receives the time between the two timestamps.
+TimingStats gpuTimerStats(struct GPUtimer *timer, double *gpuSpanMs);
+
+// Aggregate arbitrary samples (sorts them in place)
+TimingStats timingStats(double *samples, int count);
+
+// Write the statistics as a JSON object (without a line break)
+void printStatsJSON(FILE *out, TimingStats stats);
+
+// Write one benchmark record as a JSON object
+void printTimingJSON(FILE *out, const char *name, TimingStats gpuPass, double gpuSpanMs,
+                     double submitMs, double wallMs, double cpuMs);
+
+#endif
@@ -0,0 +1,37 @@
+#version 430
+// Compute shader: sum reduction. Every work group adds up 512 vec4 elements
+// through a tree in shared memory, something a fragment shader cannot do.
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) readonly buffer Input { vec4 inData[]; };
+layout(std430, binding = 1) writeonly buffer Output { vec4 outData[]; };
+
+uniform int count;      // Number of vec4 elements in the input
+
+shared vec4 partial[256];
+
+void main(void)
+{
+    uint local = gl_LocalInvocationID.x;
+    uint i = gl_WorkGroupID.x * 512u + local;
+
+    // Each invocation starts with two elements
+    vec4 sum = vec4(0.0);
+    if (i < uint(count)) sum = inData[i];
+    if (i + 256u < uint(count)) sum += inData[i + 256u];
+    partial[local] = sum;
+    barrier();
+
+    // Halve the number of active invocations at every step
+    for (uint stride = 128u; stride > 0u; stride >>= 1) {
+        if (local < stride) {
+            partial[local] += partial[local + stride];
+        }
+        barrier();
+    }
+
+    if (local == 0u) {
+        outData[gl_WorkGroupID.x] = partial[0];
+    }
+}
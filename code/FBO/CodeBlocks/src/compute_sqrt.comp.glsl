@@ -0,0 +1,17 @@
+#version 430
+// Compute shader: the same square root as fbo.frag.glsl, one invocation per vec4
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) readonly buffer Input { vec4 inData[]; };
+layout(std430, binding = 1) writeonly buffer Output { vec4 outData[]; };
+
+uniform int count;      // Number of vec4 elements
+
+void main(void)
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i < uint(count)) {
+        outData[i] = sqrt(inData[i]);
+    }
+}
@@ -0,0 +1,75 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Compute shader backend (OpenGL 4.3): the modern counterpart of the FBO routines.
+ */
+#include "compute_util.h"
+#include <stdlib.h>
+#include <stdexcept>
+
+bool computeSupported() {
+    return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object);
+}
+
+struct SSBOstruct *initFloatSSBO(int width, int height, float *data) {
+    struct SSBOstruct *ssbo = (struct SSBOstruct *)malloc(sizeof(struct SSBOstruct));
+    ssbo->width = width;
+    ssbo->height = height;
+
+    glGenBuffers(1, &ssbo->buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo->buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (long)width * height * 4 * sizeof(float), data, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return ssbo;
+}
+
+void freeSSBO(struct SSBOstruct *ssbo) {
+    glDeleteBuffers(1, &ssbo->buffer);
+    free(ssbo);
+}
+
+void useSSBO(struct SSBOstruct *in, struct SSBOstruct *out) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, in->buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, out->buffer);
+}
+
+void runComputeShader(shader_prog &shader, int count) {
+    int groups = (count + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE;
+    if (groups > 65535) {
+        throw std::runtime_error("Too many elements for a one-dimensional dispatch");
+    }
+    shader.uniform1i("count", count);
+    glDispatchCompute(groups, 1, 1);
+
+    // Make the results visible to the next dispatch and to buffer reads
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+void readSSBO(struct SSBOstruct *ssbo, int count, float *result) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo->buffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (long)count * 4 * sizeof(float), result);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+float reduceSumSSBO(shader_prog &reduceShader, struct SSBOstruct *in, struct SSBOstruct *scratch[2]) {
+    int count = in->width * in->height;
+    struct SSBOstruct *src = in;
+    int pass = 0;
+
+    // Each work group adds up 2 * COMPUTE_GROUP_SIZE elements into one
+    do {
+        int groups = (count + 2 * COMPUTE_GROUP_SIZE - 1) / (2 * COMPUTE_GROUP_SIZE);
+        struct SSBOstruct *dst = scratch[pass % 2];
+        useSSBO(src, dst);
+        reduceShader.uniform1i("count", count);
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        src = dst;
+        count = groups;
+        pass++;
+    } while (count > 1);
+
+    // Only a single vec4 comes back
+    float sum[4];
+    readSSBO(src, 1, sum);
+    return sum[0] + sum[1] + sum[2] + sum[3];
+}
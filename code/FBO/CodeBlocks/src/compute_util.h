@@ -0,0 +1,47 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Compute shader backend (OpenGL 4.3): the modern counterpart of the FBO routines.
+ *
+ * Instead of drawing a quad into a framebuffer so that the rasterizer starts one fragment
+ * shader per texel, a compute shader is started directly with glDispatchCompute.
+ * Data lives in shader storage buffer objects (SSBO), which the shader can index freely,
+ * and invocations of one work group can cooperate through shared memory.
+ */
+#ifndef COMPUTE_UTIL_H
+#define COMPUTE_UTIL_H
+
+#include <GL/glew.h>
+#include "shader_util.h"
+
+// Number of invocations per work group, must match local_size_x of the compute shaders
+#define COMPUTE_GROUP_SIZE 256
+
+// A structure to collect SSBO info, mirrors FBOstruct
+typedef struct SSBOstruct {
+    GLuint buffer;          // Buffer ID
+    int width, height;      // Same meaning as for an RGBA texture: width * height vec4 elements
+} SSBOstruct;
+
+// True if the context supports compute shaders
+bool computeSupported();
+
+// Create a buffer of width * height vec4 elements, initialized from data (may be NULL)
+struct SSBOstruct *initFloatSSBO(int width, int height, float *data);
+void freeSSBO(struct SSBOstruct *ssbo);
+
+// Choose input data (binding point 0) and output data (binding point 1)
+void useSSBO(struct SSBOstruct *in, struct SSBOstruct *out);
+
+// Start one invocation per element (count vec4 elements) of the bound buffers.
+// The shader gets the number of elements in the uniform "count".
+void runComputeShader(shader_prog &shader, int count);
+
+// Read count vec4 elements of the buffer into result
+void readSSBO(struct SSBOstruct *ssbo, int count, float *result);
+
+// Sum of all floats in the buffer using shared-memory tree reduction in every work group.
+// Every pass shrinks the data 2 * COMPUTE_GROUP_SIZE times, ping-ponging between the two
+// scratch buffers, which have to hold ceil(count / (2 * COMPUTE_GROUP_SIZE)) elements each.
+float reduceSumSSBO(shader_prog &reduceShader, struct SSBOstruct *in, struct SSBOstruct *scratch[2]);
+
+#endif
@@ -11,69 +11,41 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <math.h>
+#include <string.h>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
 #include "shader_util.h"
+#include "fbo_util.h"
+#include "pbo_util.h"
+#include "timer_util.h"
+#include "layout_util.h"
+#include "compute_util.h"
+#include "reduce_util.h"
+#include "image_util.h"
+#include "fbo_pool.h"
+#include "scan_util.h"
+#include "nbody_util.h"
 #define GLUT_KEY_ESCAPE 27
 #define GLUT_KEY_ENTER 13
 
 // -------------------- Variables ------------------- //
 int texSize = 256;
 int loopCount = 1000;
+int batchCount = 200;
+int pboRingSize = 3;
 int n, m;
 
-// A structure to collect FBO info
-typedef struct FBOstruct {
-    GLuint texid;       // Texture ID
-    GLuint fb;          // Frame Buffer ID
-    GLuint rb;          // Render Buffer ID
-    int width, height;
-} FBOstruct;
-
 // --------------------- Shader --------------------- //
 shader_prog shader("../src/fbo.vert.glsl", "../src/fbo.frag.glsl");
+shader_prog mrtShader("../src/fbo.vert.glsl", "../src/fbo_mrt.frag.glsl");
 
 // Application variables
 struct FBOstruct *fbo1, *fbo2;
 
-//Create FrameBuffer Object
-struct FBOstruct *initFloatFBO(int width, int height, float *data) {
-
-    struct FBOstruct *fbo = (struct FBOstruct *)malloc(sizeof(struct FBOstruct));
-
-    fbo->width = width;
-    fbo->height = height;
-
-    // initialize texture
-    glGenTextures(1, &fbo->texid);
-    glBindTexture(GL_TEXTURE_2D, fbo->texid);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F_ARB, width, height, 0, GL_RGBA, GL_FLOAT, data);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    // create framebuffer object and render buffer
-    glGenFramebuffers(1, &fbo->fb);      // frame buffer id
-    glGenRenderbuffers(1, &fbo->rb);     // render buffer id
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo->fb);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fbo->texid, 0);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    return fbo;
-}
-
-
-// Choose input data (textures) and output data (FBO)
-void useFBO(struct FBOstruct *in, struct FBOstruct *out) {
-    glViewport(0, 0, out->width, out->height);
-    glBindFramebuffer(GL_FRAMEBUFFER, out->fb);
-    glBindTexture(GL_TEXTURE_2D, in->texid);
-}
-
 
 // Draw a single quad using the selected shader
 void runComputations() {
@@ -82,49 +54,28 @@ void runComputations() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // Viewport-Sized Quad = Data Stream Generator.
-    glBegin(GL_QUADS);
-        glTexCoord2f(0, 0);
-        glVertex2i(0, 0);
-        glTexCoord2f(0, 1);
-        glVertex2i(0, m);
-        glTexCoord2f(1, 1);
-        glVertex2i(n ,m);
-        glTexCoord2f(1, 0);
-        glVertex2i(n, 0);
-    glEnd();
+    drawQuad(n, m);
 }
 
 
 /**
- * Program entry point
+ * Number in argv[index], or defaultValue if there is no such argument, it is below minimum or
+ * it is not a number
  */
-int main(int argc, char **argv) {
-
-    // initialize GLUT
-    glutInit(&argc, argv);
-
-    // standard OpenGL stuff
-    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
-    glutInitWindowSize(64, 20);
-    glutInitWindowPosition(50, 50);
-    glutCreateWindow("computing");
+int int_argument(int argc, char **argv, int index, int defaultValue, int minimum = 1) {
+    if (index >= argc) return defaultValue;
+    char *end;
+    long value = strtol(argv[index], &end, 10);
+    return end == argv[index] || *end != '\0' || value < minimum ? defaultValue : (int)value;
+}
 
-    // Initialize GLEW.
-    glewExperimental = true; // This is a hack. Without it the current GLEW version fails to load
-                             // some extension functions. See http://www.opengl.org/wiki/OpenGL_Loading_Library
-    if (glewInit() != GLEW_OK) {
-        cout << "Glew initialization failed" << endl;
-        return 1;
-    }
 
-    glEnable(GL_TEXTURE_2D);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-    glFlush();
+/**
+ * Elementwise square root of a texSize x texSize RGBA texture, GPU vs CPU
+ */
+void sqrt_benchmark() {
 
     // create test data
-    n = texSize;
-    m = texSize;
     float* data = (float*)malloc(4 * texSize * texSize * sizeof(float));
     float* result = (float*)malloc(4 * texSize * texSize * sizeof(float));
     for (long i = 0; i < texSize * texSize * 4; i++) {
@@ -138,21 +89,31 @@ int main(int argc, char **argv) {
     // read and compile shader programs
     shader.use();
 
-    // Set orthographic projection
-    gluOrtho2D(0.0, (GLfloat) n, 0.0, (GLfloat) m);
-
     // draw
-    int startTime = glutGet(GLUT_ELAPSED_TIME);
+    // The CPU clock around glFlush() only measures how fast we submit the passes.
+    // The GPU time comes from timer queries and from a wall clock bounded by glFinish().
+    struct GPUtimer *timer = initGPUTimer(loopCount);
+    glFinish();
+    double wallStart = wallClockMs();
+    startGPUTimer(timer);
     for (int loop = 0; loop < loopCount; loop++) {
+        beginGPUPass(timer);
         useFBO(fbo1, fbo2);
         runComputations();
+        endGPUPass(timer);
         glFlush();
     }
-    int endTime = glutGet(GLUT_ELAPSED_TIME);
+    stopGPUTimer(timer);
+    double submitTime = wallClockMs() - wallStart;
+    glFinish();
+    double wallTime = wallClockMs() - wallStart;
+
+    double gpuSpan;
+    TimingStats passStats = gpuTimerStats(timer, &gpuSpan);
+    freeGPUTimer(timer);
 
     // and read back
-    glReadBuffer(GL_COLOR_ATTACHMENT0);
-    glReadPixels(0, 0, texSize, texSize, GL_RGBA, GL_FLOAT, result);
+    readFBO(fbo2, 0, result);
 
     // print out results
     long loopSize = 16;
@@ -164,17 +125,961 @@ int main(int argc, char **argv) {
     for (long i = 0; i < loopSize; i++) {
         printf("%f\n",result[i]);
     }
-    printf("Total ms (GPU): %d\n", endTime - startTime);
+    printf("Total ms (GPU, submission only): %.3f\n", submitTime);
+    printf("Total ms (GPU, until glFinish): %.3f\n", wallTime);
+    if (passStats.samples > 0) {
+        printf("Pass ms (GPU timer queries): min %.4f, median %.4f, p99 %.4f\n",
+               passStats.min, passStats.median, passStats.p99);
+        printf("Total ms (GPU timestamps): %.3f\n", gpuSpan);
+    }
 
     // Same thing on the CPU should take longer.
-    startTime = glutGet(GLUT_ELAPSED_TIME);
+    double startTime = wallClockMs();
     for (int loop = 0; loop < loopCount; loop++) {
         for (long i=0; i < texSize * texSize * 4; i++) {
             result[i] = sqrt(data[i]);
         }
     }
-    endTime = glutGet(GLUT_ELAPSED_TIME);
-    printf("Total ms (CPU): %d\n", endTime - startTime);
+    double cpuTime = wallClockMs() - startTime;
+    printf("Total ms (CPU): %.3f\n", cpuTime);
+
+    printTimingJSON(stdout, "sqrt", passStats, gpuSpan, submitTime, wallTime, cpuTime);
+
+    freeFBO(fbo1);
+    freeFBO(fbo2);
+    free(data);
+    free(result);
+}
+
+
+// Largest difference between the GPU result in a color attachment of an FBO and the CPU result
+float image_error(struct FBOstruct *fbo, const struct Image *expected, int attachment = 0) {
+    struct Image *result = initImage(expected->width, expected->height);
+    readFBO(fbo, attachment, result->pixels);
+    float maxError = 0;
+    for (long i = 0; i < (long)expected->width * expected->height * 4; i++) {
+        maxError = fmax(maxError, fabs(result->pixels[i] - expected->pixels[i]));
+    }
+    freeImage(result);
+    return maxError;
+}
+
+
+/**
+ * Multiple render targets: value, gradient and mask computed in a single pass
+ * compared to three separate single-output passes
+ */
+void mrt_benchmark() {
+
+    const int outputs = 3;
+    const char* names[outputs] = {"value", "gradient", "mask"};
+    const float threshold = texSize * texSize * 2.0f;
+
+    if (maxDrawBuffers() < outputs) {
+        printf("MRT needs %d draw buffers, the driver supports %d\n", outputs, maxDrawBuffers());
+        return;
+    }
+
+    // create test data
+    long size = 4 * texSize * texSize;
+    float* data = (float*)malloc(size * sizeof(float));
+    float* result = (float*)malloc(size * sizeof(float));
+    for (long i = 0; i < size; i++) {
+        data[i] = i + 1.0;
+    }
+
+    // One FBO with three color attachments, three FBOs with one attachment each
+    struct FBOstruct *input = initFloatFBO(n, m, data);
+    struct FBOstruct *mrt = initFloatMRTFBO(n, m, outputs, NULL);
+    struct FBOstruct *single[outputs];
+    for (int c = 0; c < outputs; c++) {
+        single[c] = initFloatFBO(n, m, NULL);
+    }
+
+    mrtShader.use();
+    mrtShader.uniform1f("texelSize", 1.0f / texSize);
+    mrtShader.uniform1f("threshold", threshold);
+
+    // All outputs in one pass
+    mrtShader.uniform1i("channel", -1);
+    glFinish();
+    int startTime = glutGet(GLUT_ELAPSED_TIME);
+    for (int loop = 0; loop < loopCount; loop++) {
+        useFBO(input, mrt);
+        runComputations();
+    }
+    glFinish();
+    int mrtTime = glutGet(GLUT_ELAPSED_TIME) - startTime;
+
+    // One pass per output
+    startTime = glutGet(GLUT_ELAPSED_TIME);
+    for (int loop = 0; loop < loopCount; loop++) {
+        for (int c = 0; c < outputs; c++) {
+            mrtShader.uniform1i("channel", c);
+            useFBO(input, single[c]);
+            runComputations();
+        }
+    }
+    glFinish();
+    int singleTime = glutGet(GLUT_ELAPSED_TIME) - startTime;
+
+    // Read back each attachment and compare it to the CPU
+    struct Image *expected = initImage(texSize, texSize);
+    for (int c = 0; c < outputs; c++) {
+        for (long i = 0; i < size; i++) {
+            long x = (i / 4) % texSize;
+            float right = x + 1 < texSize ? data[i + 4] : data[i];
+            expected->pixels[i] = c == 0 ? sqrt(data[i]) : c == 1 ? right - data[i] : (data[i] >= threshold ? 1.0f : 0.0f);
+        }
+        readFBO(mrt, c, result);
+        float maxError = image_error(mrt, expected, c);
+        printf("Attachment %d (%s): %f %f %f %f ... max error %f%s\n", c, names[c],
+               result[0], result[1], result[2], result[3], maxError, maxError > 1e-3f ? "  MISMATCH" : "");
+    }
+    freeImage(expected);
+    printf("Total ms (GPU, %d outputs in one pass): %d\n", outputs, mrtTime);
+    printf("Total ms (GPU, one pass per output): %d\n", singleTime);
+
+    freeFBO(input);
+    freeFBO(mrt);
+    for (int c = 0; c < outputs; c++) {
+        freeFBO(single[c]);
+    }
+    free(data);
+    free(result);
+}
+
+
+/**
+ * Stream batches through the GPU: upload, compute, read back.
+ * Blocking transfers vs pixel buffer objects where readback of batch N overlaps with batch N+1.
+ */
+void pbo_benchmark() {
+
+    long size = 4 * texSize * texSize;
+    long bytes = size * sizeof(float);
+    float* data = (float*)malloc(bytes);
+    float* result = (float*)malloc(bytes);
+    for (long i = 0; i < size; i++) {
+        data[i] = i + 1.0;
+    }
+
+    struct FBOstruct *input = initFloatFBO(n, m, data);
+    struct FBOstruct *output = initFloatFBO(n, m, NULL);
+    shader.use();
+
+    // Every batch differs in the first element, the checksum collects its square root
+    double blockingChecksum = 0, asyncChecksum = 0;
+
+    // Blocking: glTexSubImage2D and glReadPixels from/to client memory
+    glFinish();
+    int startTime = glutGet(GLUT_ELAPSED_TIME);
+    for (int batch = 0; batch < batchCount; batch++) {
+        data[0] = batch + 1.0;
+        glBindTexture(GL_TEXTURE_2D, input->texid);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, n, m, GL_RGBA, GL_FLOAT, data);
+        useFBO(input, output);
+        runComputations();
+        readFBO(output, 0, result);
+        blockingChecksum += result[0];
+    }
+    int blockingTime = glutGet(GLUT_ELAPSED_TIME) - startTime;
+
+    // Asynchronous: results are mapped pboRingSize - 1 batches after they were requested
+    struct PBOring *uploads = initPBORing(GL_PIXEL_UNPACK_BUFFER, 2, bytes);
+    struct PBOring *downloads = initPBORing(GL_PIXEL_PACK_BUFFER, pboRingSize, bytes);
+    int pending[PBO_MAX_RING_SIZE];
+    glFinish();
+    startTime = glutGet(GLUT_ELAPSED_TIME);
+    for (int batch = 0; batch < batchCount + pboRingSize - 1; batch++) {
+        if (batch < batchCount) {
+            data[0] = batch + 1.0;
+            writeFBOAsync(uploads, input, data);
+            useFBO(input, output);
+            runComputations();
+            pending[batch % pboRingSize] = readFBOAsync(downloads, output, 0);
+        }
+        int ready = batch - (pboRingSize - 1);
+        if (ready >= 0) {
+            int index = pending[ready % pboRingSize];
+            asyncChecksum += mapPBO(downloads, index)[0];
+            unmapPBO(downloads, index);
+        }
+    }
+    int asyncTime = glutGet(GLUT_ELAPSED_TIME) - startTime;
+
+    printf("Checksum (blocking): %f\n", blockingChecksum);
+    printf("Checksum (PBO): %f\n", asyncChecksum);
+    printf("Total ms (GPU, blocking transfers, %d batches): %d\n", batchCount, blockingTime);
+    printf("Total ms (GPU, PBO ring of %d, %d batches): %d\n", pboRingSize, batchCount, asyncTime);
+
+    freePBORing(uploads);
+    freePBORing(downloads);
+    freeFBO(input);
+    freeFBO(output);
+    free(data);
+    free(result);
+}
+
+
+/**
+ * Run the layout kernel over an array of the given shape and compare it to the CPU
+ */
+void run_layout_kernel(int width, int height, int depth, int maxTexSize) {
+
+    ArrayLayout layout = arrayLayout(width, height, depth, maxTexSize);
+    float* data = (float*)malloc(layout.length * sizeof(float));
+    float* result = (float*)malloc(layout.length * sizeof(float));
+    for (long i = 0; i < layout.length; i++) {
+        data[i] = i + 1.0;
+    }
+
+    struct FBOstruct **input = initLayoutFBOs(&layout, data);
+    struct FBOstruct **output = initLayoutFBOs(&layout, NULL);
+
+    // The index math depends on the layout, so the shader is built for it.
+    // Both stages have to agree on the GLSL version.
+    shader_prog layoutShader("../src/fbo.vert.glsl", "../src/fbo_layout.frag.glsl");
+    layoutShader.prepend(GL_VERTEX_SHADER, "#version 130\n");
+    layoutShader.prepend(GL_FRAGMENT_SHADER, layoutShaderHeader(&layout));
+    layoutShader.use();
+
+    glFinish();
+    double startTime = wallClockMs();
+    for (int t = 0; t < layout.textures; t++) {
+        layoutShader.uniform1i("layoutTexture", t);
+        useFBO(input[t], output[t]);
+        drawQuad(layout.texWidth, layout.texHeight);
+    }
+    glFinish();
+    double gpuTime = wallClockMs() - startTime;
+
+    readLayoutFBOs(&layout, output, result);
+
+    float maxError = 0;
+    for (long i = 0; i < layout.length; i++) {
+        float expected = sqrt(data[i]) + i / ((long)width * height);
+        maxError = fmax(maxError, fabs(result[i] - expected) / expected);
+    }
+
+    printf("Array %d x %d x %d (%ld elements): %d texture(s) of %d x %d, %ld padding floats, "
+           "max relative error %g, %.3f ms (GPU)\n",
+           width, height, depth, layout.length, layout.textures, layout.texWidth, layout.texHeight,
+           layout.padding, maxError, gpuTime);
+
+    layoutShader.free();
+    freeLayoutFBOs(&layout, input);
+    freeLayoutFBOs(&layout, output);
+    free(data);
+    free(result);
+}
+
+
+/**
+ * Arrays of arbitrary size and shape mapped onto RGBA textures
+ */
+void layout_benchmark() {
+
+    // A small texture size limit forces the larger arrays to be split across several textures
+    int maxTexSize = 512;
+
+    run_layout_kernel(1, 1, 1, maxTexSize);
+    run_layout_kernel(1000003, 1, 1, maxTexSize);
+    run_layout_kernel(3000001, 1, 1, maxTexSize);
+    run_layout_kernel(641, 479, 1, maxTexSize);
+    run_layout_kernel(37, 23, 11, maxTexSize);
+    run_layout_kernel(3000001, 1, 1, 0);
+}
+
+
+/**
+ * Fragment shader over a quad (FBO path) vs compute shader with storage buffers,
+ * for the square root and for a sum reduction
+ */
+void compute_benchmark() {
+
+    if (!computeSupported()) {
+        printf("Compute shaders need OpenGL 4.3, this context has %s\n", glGetString(GL_VERSION));
+        return;
+    }
+
+    long size = 4 * texSize * texSize;
+    float* data = (float*)malloc(size * sizeof(float));
+    float* result = (float*)malloc(size * sizeof(float));
+    float* computeResult = (float*)malloc(size * sizeof(float));
+    for (long i = 0; i < size; i++) {
+        data[i] = 1.0 + i % 7;
+    }
+
+    // ----------------- Square root ----------------- //
+    struct FBOstruct *fboIn = initFloatFBO(n, m, data);
+    struct FBOstruct *fboOut = initFloatFBO(n, m, NULL);
+    shader.use();
+    glFinish();
+    double startTime = wallClockMs();
+    for (int loop = 0; loop < loopCount; loop++) {
+        useFBO(fboIn, fboOut);
+        runComputations();
+    }
+    glFinish();
+    double fboTime = wallClockMs() - startTime;
+    readFBO(fboOut, 0, result);
+
+    shader_prog sqrtShader("../src/compute_sqrt.comp.glsl");
+    struct SSBOstruct *ssboIn = initFloatSSBO(n, m, data);
+    struct SSBOstruct *ssboOut = initFloatSSBO(n, m, NULL);
+    sqrtShader.use();
+    glFinish();
+    startTime = wallClockMs();
+    for (int loop = 0; loop < loopCount; loop++) {
+        useSSBO(ssboIn, ssboOut);
+        runComputeShader(sqrtShader, n * m);
+    }
+    glFinish();
+    double computeTime = wallClockMs() - startTime;
+    readSSBO(ssboOut, n * m, computeResult);
+    sqrtShader.free();
+
+    float maxDifference = 0;
+    for (long i = 0; i < size; i++) {
+        maxDifference = fmax(maxDifference, fabs(result[i] - computeResult[i]));
+    }
+    printf("sqrt: max difference between the paths %g\n", maxDifference);
+    printf("Total ms (GPU, fragment shader + FBO): %.3f\n", fboTime);
+    printf("Total ms (GPU, compute shader + SSBO): %.3f\n", computeTime);
+
+    // ------------------ Reduction ------------------ //
+    // The fragment path cannot share data between fragments, so it reads the texture
+    // back and leaves the summation to the CPU.
+    double expected = 0;
+    for (long i = 0; i < size; i++) {
+        expected += data[i];
+    }
+
+    int reduceLoops = loopCount / 10;
+    double fboSum = 0;
+    glFinish();
+    startTime = wallClockMs();
+    for (int loop = 0; loop < reduceLoops; loop++) {
+        readFBO(fboIn, 0, result);
+        fboSum = 0;
+        for (long i = 0; i < size; i++) {
+            fboSum += result[i];
+        }
+    }
+    double fboReduceTime = wallClockMs() - startTime;
+
+    shader_prog reduceShader("../src/compute_reduce.comp.glsl");
+    int scratchSize = (n * m + 2 * COMPUTE_GROUP_SIZE - 1) / (2 * COMPUTE_GROUP_SIZE);
+    struct SSBOstruct *scratch[2] = {initFloatSSBO(scratchSize, 1, NULL), initFloatSSBO(scratchSize, 1, NULL)};
+    reduceShader.use();
+    float computeSum = 0;
+    glFinish();
+    startTime = wallClockMs();
+    for (int loop = 0; loop < reduceLoops; loop++) {
+        computeSum = reduceSumSSBO(reduceShader, ssboIn, scratch);
+    }
+    double computeReduceTime = wallClockMs() - startTime;
+    reduceShader.free();
+
+    printf("sum: expected %.1f, readback + CPU %.1f, compute shader %.1f\n", expected, fboSum, computeSum);
+    printf("Total ms (readback + CPU sum, %d times): %.3f\n", reduceLoops, fboReduceTime);
+    printf("Total ms (GPU, compute shader shared-memory reduction, %d times): %.3f\n", reduceLoops, computeReduceTime);
+
+    freeSSBO(ssboIn);
+    freeSSBO(ssboOut);
+    freeSSBO(scratch[0]);
+    freeSSBO(scratch[1]);
+    freeFBO(fboIn);
+    freeFBO(fboOut);
+    free(data);
+    free(result);
+    free(computeResult);
+}
+
+
+/**
+ * Sum, min and max of a non-power-of-two texture with mipmap-style FBO passes
+ * vs a single- and a multithreaded CPU reduction
+ */
+void reduce_benchmark() {
+
+    const char* opNames[3] = {"sum", "min", "max"};
+    int width = 1000, height = 777;
+    long size = 4L * width * height;
+    int reduceLoops = 100;
+    int threads = std::thread::hardware_concurrency();
+    if (threads < 1) threads = 1;
+
+    float* data = (float*)malloc(size * sizeof(float));
+    for (long i = 0; i < size; i++) {
+        data[i] = (i * 7919 % 100003) / 1000.0f;
+    }
+    struct FBOstruct *input = initFloatFBO(width, height, data);
+
+    shader_prog reduceShader("../src/fbo.vert.glsl", "../src/fbo_reduce.frag.glsl");
+    reduceShader.prepend(GL_VERTEX_SHADER, "#version 130\n");
+    reduceShader.use();
+
+    for (int factor = 2; factor <= 4; factor += 2) {
+        struct ReductionChain *chain = initReduction(width, height, factor);
+        for (int op = REDUCE_SUM; op <= REDUCE_MAX; op++) {
+            float gpu = 0, cpu = 0, cpuThreaded = 0;
+
+            glFinish();
+            double startTime = wallClockMs();
+            for (int loop = 0; loop < reduceLoops; loop++) {
+                gpu = reduceFBO(chain, reduceShader, input, (ReduceOp)op);
+            }
+            double gpuTime = wallClockMs() - startTime;
+
+            startTime = wallClockMs();
+            for (int loop = 0; loop < reduceLoops; loop++) {
+                cpu = reduceCPU(data, size, (ReduceOp)op, 1);
+            }
+            double cpuTime = wallClockMs() - startTime;
+
+            startTime = wallClockMs();
+            for (int loop = 0; loop < reduceLoops; loop++) {
+                cpuThreaded = reduceCPU(data, size, (ReduceOp)op, threads);
+            }
+            double cpuThreadedTime = wallClockMs() - startTime;
+
+            // The GPU adds in float, in another order than the CPU, so the sum may differ slightly
+            float error = fabs(gpu - cpu) / fmax(fabs(cpu), 1.0f);
+            printf("%s, %dx%d blocks, %d passes: GPU %f, CPU %f, CPU (%d threads) %f, relative error %g%s\n",
+                   opNames[op], factor, factor, chain->levels, gpu, cpu, threads, cpuThreaded, error,
+                   error > 1e-4f ? "  MISMATCH" : "");
+            printf("    Total ms (%d times): GPU %.3f, CPU %.3f, CPU (%d threads) %.3f\n",
+                   reduceLoops, gpuTime, cpuTime, threads, cpuThreadedTime);
+        }
+        freeReduction(chain);
+    }
+
+    // Small arrays split between up to as many threads as elements, against a single thread
+    int smallMismatches = 0;
+    for (long smallSize = 1; smallSize <= 16; smallSize++) {
+        for (int smallThreads = 2; smallThreads <= 8; smallThreads++) {
+            for (int op = REDUCE_SUM; op <= REDUCE_MAX; op++) {
+                float single = reduceCPU(data, smallSize, (ReduceOp)op, 1);
+                float split = reduceCPU(data, smallSize, (ReduceOp)op, smallThreads);
+                if (fabs(split - single) > 1e-6f * fmax(fabs(single), 1.0f)) smallMismatches++;
+            }
+        }
+    }
+    printf("CPU reduction of 1-16 elements with 2-8 threads: %d mismatches\n", smallMismatches);
+
+    reduceShader.free();
+    freeFBO(input);
+    free(data);
+}
+
+
+/**
+ * Run every image kernel on the GPU and on the CPU, report megapixels per second
+ */
+void run_image_kernels(struct ImageKernels *kernels, const ImageParams *params, struct Image *image,
+                       int threads, const char *outputPrefix) {
+
+    const int kernelCount = 5;
+    const char* names[kernelCount] = {"blur", "sobel", "dilate", "erode", "bilateral"};
+    int gpuLoops = 20;
+    int width = image->width, height = image->height;
+    double megapixels = width * (double)height / 1.0e6;
+
+    struct FBOstruct *in = initFloatFBO(width, height, image->pixels);
+    struct FBOstruct *tmp = initFloatFBO(width, height, NULL);
+    struct FBOstruct *out = initFloatFBO(width, height, NULL);
+    struct Image *cpuTmp = initImage(width, height);
+    struct Image *cpuOut = initImage(width, height);
+
+    for (int k = 0; k < kernelCount; k++) {
+        glFinish();
+        double startTime = wallClockMs();
+        for (int loop = 0; loop < gpuLoops; loop++) {
+            switch (k) {
+                case 0: blurGPU(kernels, in, tmp, out); break;
+                case 1: sobelGPU(kernels, in, out); break;
+                case 2: morphGPU(kernels, in, out, true); break;
+                case 3: morphGPU(kernels, in, out, false); break;
+                case 4: bilateralGPU(kernels, in, out); break;
+            }
+        }
+        glFinish();
+        double gpuTime = (wallClockMs() - startTime) / gpuLoops;
+
+        startTime = wallClockMs();
+        switch (k) {
+            case 0: blurCPU(params, image, cpuTmp, cpuOut, threads); break;
+            case 1: sobelCPU(image, cpuOut, threads); break;
+            case 2: morphCPU(params, image, cpuOut, true, threads); break;
+            case 3: morphCPU(params, image, cpuOut, false, threads); break;
+            case 4: bilateralCPU(params, image, cpuOut, threads); break;
+        }
+        double cpuTime = wallClockMs() - startTime;
+
+        printf("%dx%d %-9s  GPU %8.1f MP/s  CPU (%d threads) %8.1f MP/s  max difference %g\n",
+               width, height, names[k], megapixels / gpuTime * 1000, threads, megapixels / cpuTime * 1000,
+               image_error(out, cpuOut));
+
+        if (outputPrefix != NULL) {
+            struct Image *result = initImage(width, height);
+            readFBO(out, 0, result->pixels);
+            saveImage(result, (std::string(outputPrefix) + "_" + names[k] + ".ppm").c_str());
+            freeImage(result);
+        }
+    }
+
+    freeImage(cpuTmp);
+    freeImage(cpuOut);
+    freeFBO(in);
+    freeFBO(tmp);
+    freeFBO(out);
+}
+
+
+/**
+ * Image processing kernels on synthetic images of several sizes, or on a given file:
+ *   FBO image [picture.pgm | picture.ppm | picture.raw width height channels]
+ */
+void image_benchmark(int argc, char **argv) {
+
+    ImageParams params;
+    params.blurRadius = 4;
+    params.blurSigma = 2.0f;
+    params.morphRadius = 2;
+    params.bilateralRadius = 3;
+    params.sigmaSpatial = 2.0f;
+    params.sigmaRange = 0.1f;
+
+    int threads = std::thread::hardware_concurrency();
+    if (threads < 1) threads = 1;
+
+    struct ImageKernels *kernels = initImageKernels(&params);
+
+    if (argc > 2) {
+        const char *filename = argv[2];
+        struct Image *image = argc > 5 ? loadRawImage(filename, atoi(argv[3]), atoi(argv[4]), atoi(argv[5]))
+                                       : loadImage(filename);
+        run_image_kernels(kernels, &params, image, threads, "image");
+        freeImage(image);
+    } else {
+        int sizes[3] = {512, 1024, 2048};
+        for (int s = 0; s < 3; s++) {
+            struct Image *image = testImage(sizes[s], sizes[s]);
+            run_image_kernels(kernels, &params, image, threads, NULL);
+            freeImage(image);
+        }
+    }
+
+    freeImageKernels(kernels);
+}
+
+
+/**
+ * Square root of a scalar array stored in textures of different formats.
+ * Reports the memory traffic of a pass and how much of it the format saves.
+ */
+void format_benchmark() {
+
+    // Can we render into the format at all?
+    GLenum all[] = {GL_R32F, GL_RG32F, GL_RGBA32F, GL_R16F, GL_RG16F, GL_RGBA16F,
+                    GL_R32I, GL_RG32I, GL_RGBA32I, GL_R32UI, GL_RG32UI, GL_RGBA32UI};
+    for (unsigned i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        try {
+            struct FBOstruct *fbo = initFBO(16, 16, all[i], NULL);
+            printf("%-9s complete\n", fbo->format.name);
+            freeFBO(fbo);
+        } catch (std::exception &e) {
+            printf("%-9s %s\n", fboFormat(all[i])->name, e.what());
+        }
+    }
+
+    // Scalar data: one element per texel, or four elements packed into RGBA by hand
+    const int variants = 5;
+    GLenum internalFormats[variants] = {GL_RGBA32F, GL_R32F, GL_R16F, GL_RGBA32F, GL_RGBA16F};
+    bool packed[variants] = {false, false, false, true, true};
+
+    int side = 1024;
+    long count = (long)side * side;
+    float* data = (float*)malloc(count * sizeof(float));
+    float* texels = (float*)malloc(count * 4 * sizeof(float));
+    float* result = (float*)malloc(count * 4 * sizeof(float));
+    for (long i = 0; i < count; i++) {
+        data[i] = 1.0 + i % 1000;
+    }
+
+    shader.use();
+    double baselineBytes = 0;
+    for (int v = 0; v < variants; v++) {
+        const FBOformat *format = fboFormat(internalFormats[v]);
+        int width = side, height = packed[v] ? side / 4 : side;
+
+        // Unpacked RGBA wastes three channels per element
+        memset(texels, 0, count * 4 * sizeof(float));
+        for (long i = 0; i < count; i++) {
+            texels[packed[v] ? i : i * format->channels] = data[i];
+        }
+
+        struct FBOstruct *in, *out;
+        try {
+            in = initFBO(width, height, format->internalFormat, texels);
+            out = initFBO(width, height, format->internalFormat, NULL);
+        } catch (std::exception &e) {
+            printf("%s: %s\n", format->name, e.what());
+            continue;
+        }
+
+        glFinish();
+        double startTime = wallClockMs();
+        for (int loop = 0; loop < loopCount; loop++) {
+            useFBO(in, out);
+            drawQuad(width, height);
+        }
+        glFinish();
+        double gpuTime = wallClockMs() - startTime;
+
+        readFBO(out, 0, result);
+        float maxError = 0;
+        for (long i = 0; i < count; i++) {
+            float value = result[packed[v] ? i : i * format->channels];
+            maxError = fmax(maxError, fabs(value - sqrt(data[i])) / sqrt(data[i]));
+        }
+
+        // Every pass reads the input texture and writes the output texture
+        double bytes = 2.0 * width * height * format->bytesPerTexel;
+        if (v == 0) baselineBytes = bytes;
+        printf("%-8s %-8s %5.1f bytes/element, %6.2f MB/pass, %6.2f GB/s, saves %3.0f%% of the traffic, "
+               "max relative error %g, %.3f ms (GPU)\n",
+               format->name, packed[v] ? "packed" : "scalar", bytes / 2 / count, bytes / 1.0e6,
+               bytes * loopCount / gpuTime / 1.0e6, 100.0 * (1.0 - bytes / baselineBytes), maxError, gpuTime);
+
+        freeFBO(in);
+        freeFBO(out);
+    }
+
+    free(data);
+    free(texels);
+    free(result);
+}
+
+
+/**
+ * A batch of small jobs (upload, one pass, read back) of a few different sizes.
+ * Creating and deleting the FBOs for every job vs recycling them through a pool.
+ */
+void pool_benchmark() {
+
+    const int sizeCount = 3;
+    int sizes[sizeCount] = {128, 256, 512};
+    int jobs = 2000;
+    long maxSize = 4L * sizes[sizeCount - 1] * sizes[sizeCount - 1];
+
+    float* data = (float*)malloc(maxSize * sizeof(float));
+    float* result = (float*)malloc(maxSize * sizeof(float));
+    for (long i = 0; i < maxSize; i++) {
+        data[i] = i + 1.0;
+    }
+    shader.use();
+
+    // New FBOs for every job
+    double checksum = 0;
+    glFinish();
+    double startTime = wallClockMs();
+    for (int job = 0; job < jobs; job++) {
+        int size = sizes[job % sizeCount];
+        struct FBOstruct *in = initFloatFBO(size, size, data);
+        struct FBOstruct *out = initFloatFBO(size, size, NULL);
+        useFBO(in, out);
+        drawQuad(size, size);
+        readFBO(out, 0, result);
+        checksum += result[4 * size * size - 1];
+        freeFBO(in);
+        freeFBO(out);
+    }
+    double createTime = wallClockMs() - startTime;
+    printf("Checksum (new FBOs): %f\n", checksum);
+
+    // FBOs from the pool
+    fbo_pool pool;
+    checksum = 0;
+    startTime = wallClockMs();
+    for (int job = 0; job < jobs; job++) {
+        int size = sizes[job % sizeCount];
+        struct FBOstruct *in = pool.acquire(size, size);
+        struct FBOstruct *out = pool.acquire(size, size);
+        writeFBO(in, 0, data);
+        useFBO(in, out);
+        drawQuad(size, size);
+        readFBO(out, 0, result);
+        checksum += result[4 * size * size - 1];
+        pool.release(in);
+        pool.release(out);
+    }
+    double poolTime = wallClockMs() - startTime;
+    printf("Checksum (pool): %f\n", checksum);
+    pool.print_stats();
+
+    printf("Total ms (%d jobs, new FBOs every job): %.3f\n", jobs, createTime);
+    printf("Total ms (%d jobs, FBO pool): %.3f\n", jobs, poolTime);
+
+    free(data);
+    free(result);
+}
+
+
+// Number of positions where the GPU result differs from the CPU one
+long count_mismatches(struct FBOstruct *fbo, const float *expected, int count) {
+    float* result = (float*)malloc((long)fbo->width * fbo->height * sizeof(float));
+    readFBO(fbo, 0, result);
+    long mismatches = 0;
+    for (int i = 0; i < count; i++) {
+        if (result[i] != expected[i]) mismatches++;
+    }
+    free(result);
+    return mismatches;
+}
+
+
+/**
+ * Prefix sum, stream compaction and radix sort on FBO passes vs the CPU,
+ * from 64K elements up to maxElements (16M by default): FBO scan [maxElements]
+ */
+void scan_benchmark(int argc, char **argv) {
+
+    int maxElements = int_argument(argc, argv, 2, SCAN_MAX_ELEMENTS, 1 << 16);     // At least the smallest size
+    int keyBits = 16;
+    float threshold = 0.5f;
+
+    struct ScanKernels *kernels = initScanKernels();
+    fbo_pool pool;
+
+    for (int count = 1 << 16; count <= maxElements; count *= 4) {
+        long texels = (long)scanWidth(count) * scanHeight(count);
+        float* flags = (float*)calloc(texels, sizeof(float));
+        float* values = (float*)calloc(texels, sizeof(float));
+        float* keys = (float*)calloc(texels, sizeof(float));
+        float* expected = (float*)malloc(count * sizeof(float));
+        srand(count);
+        for (int i = 0; i < count; i++) {
+            flags[i] = rand() % 2;
+            values[i] = rand() / (RAND_MAX + 1.0f);
+            keys[i] = rand() % (1 << keyBits);
+        }
+
+        struct FBOstruct *in = pool.acquire(scanWidth(count), scanHeight(count), GL_R32F);
+        double elements = count / 1.0e6;
+
+        // Scan
+        writeFBO(in, 0, flags);
+        glFinish();
+        double startTime = wallClockMs();
+        struct FBOstruct *out = scanFBO(kernels, pool, in, count);
+        glFinish();
+        double gpuTime = wallClockMs() - startTime;
+        startTime = wallClockMs();
+        scanCPU(flags, expected, count);
+        double cpuTime = wallClockMs() - startTime;
+        printf("%8d scan:    GPU %8.1f Melem/s  CPU %8.1f Melem/s  mismatches %ld\n", count,
+               elements / gpuTime * 1000, elements / cpuTime * 1000, count_mismatches(out, expected, count));
+        pool.release(out);
+
+        // Compaction
+        writeFBO(in, 0, values);
+        int kept;
+        glFinish();
+        startTime = wallClockMs();
+        out = compactFBO(kernels, pool, in, count, threshold, &kept);
+        gpuTime = wallClockMs() - startTime;
+        startTime = wallClockMs();
+        int expectedKept = compactCPU(values, expected, count, threshold);
+        cpuTime = wallClockMs() - startTime;
+        printf("%8d compact: GPU %8.1f Melem/s  CPU %8.1f Melem/s  kept %d (CPU %d)  mismatches %ld\n", count,
+               elements / gpuTime * 1000, elements / cpuTime * 1000, kept, expectedKept,
+               count_mismatches(out, expected, expectedKept));
+        pool.release(out);
+
+        // Radix sort
+        writeFBO(in, 0, keys);
+        glFinish();
+        startTime = wallClockMs();
+        out = radixSortFBO(kernels, pool, in, count, keyBits);
+        glFinish();
+        gpuTime = wallClockMs() - startTime;
+        startTime = wallClockMs();
+        radixSortCPU(keys, expected, count, keyBits);
+        cpuTime = wallClockMs() - startTime;
+        printf("%8d sort:    GPU %8.1f Melem/s  CPU %8.1f Melem/s  mismatches %ld (%d-bit keys)\n", count,
+               elements / gpuTime * 1000, elements / cpuTime * 1000, count_mismatches(out, expected, count), keyBits);
+        pool.release(out);
+
+        pool.release(in);
+        free(flags);
+        free(values);
+        free(keys);
+        free(expected);
+    }
+
+    pool.print_stats();
+    freeScanKernels(kernels);
+}
+
+
+// One step of the same integration as the shaders in nbody_util, rows of bodies split between threads
+void nbody_step_cpu(int count, const float *positions, const float *velocities,
+                    float *newPositions, float *newVelocities, float dt, float softening, int threads) {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([=]() {
+            for (int i = count * t / threads; i < count * (t + 1) / threads; i++) {
+                const float *p = positions + i * 4;
+                float ax = 0, ay = 0, az = 0;
+                for (int j = 0; j < count; j++) {
+                    const float *q = positions + j * 4;
+                    float dx = q[0] - p[0], dy = q[1] - p[1], dz = q[2] - p[2];
+                    float r2 = dx * dx + dy * dy + dz * dz + softening * softening;
+                    float s = q[3] / (r2 * sqrtf(r2));
+                    ax += dx * s;
+                    ay += dy * s;
+                    az += dz * s;
+                }
+                float *v = newVelocities + i * 4;
+                v[0] = velocities[i * 4 + 0] + ax * dt;
+                v[1] = velocities[i * 4 + 1] + ay * dt;
+                v[2] = velocities[i * 4 + 2] + az * dt;
+                v[3] = velocities[i * 4 + 3];
+                newPositions[i * 4 + 0] = p[0] + v[0] * dt;
+                newPositions[i * 4 + 1] = p[1] + v[1] * dt;
+                newPositions[i * 4 + 2] = p[2] + v[2] * dt;
+                newPositions[i * 4 + 3] = p[3];
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+}
+
+
+/**
+ * Gravitational N-body simulation on the GPU (nbody_util.h) vs a multithreaded CPU version,
+ * from 1K bodies up to maxBodies (16K by default): FBO nbody [maxBodies].
+ * Throughput is reported in body-body interactions per second.
+ */
+void nbody_benchmark(int argc, char **argv) {
+
+    int maxBodies = int_argument(argc, argv, 2, 16384, 1024);     // At least the smallest size
+    int steps = 4;
+    float dt = 0.001f, softening = 0.05f;
+    int threads = std::thread::hardware_concurrency();
+    if (threads < 1) threads = 1;
+
+    for (int count = 1024; count <= maxBodies; count *= 2) {
+        float* positions = (float*)malloc(count * 4 * sizeof(float));
+        float* velocities = (float*)malloc(count * 4 * sizeof(float));
+        float* tmpPositions = (float*)malloc(count * 4 * sizeof(float));
+        float* tmpVelocities = (float*)malloc(count * 4 * sizeof(float));
+        float* result = (float*)malloc(count * 4 * sizeof(float));
+        nbodyInitialState(count, positions, velocities);
+
+        struct NBody *nbody = initNBody(count, positions, velocities, dt, softening);
+        stepNBody(nbody);       // Warm up, then start again from the initial state
+        freeNBody(nbody);
+        nbody = initNBody(count, positions, velocities, dt, softening);
+
+        glFinish();
+        double startTime = wallClockMs();
+        for (int i = 0; i < steps; i++) {
+            stepNBody(nbody);
+        }
+        glFinish();
+        double gpuTime = wallClockMs() - startTime;
+        readNBody(nbody, result, NULL);
+        freeNBody(nbody);
+
+        startTime = wallClockMs();
+        for (int i = 0; i < steps; i++) {
+            nbody_step_cpu(count, positions, velocities, tmpPositions, tmpVelocities, dt, softening, threads);
+            swap(positions, tmpPositions);
+            swap(velocities, tmpVelocities);
+        }
+        double cpuTime = wallClockMs() - startTime;
+
+        float maxError = 0;
+        for (int i = 0; i < count * 4; i++) {
+            maxError = max(maxError, fabsf(result[i] - positions[i]));
+        }
+
+        double interactions = (double)count * count * steps;
+        printf("%6d bodies: GPU %8.3f Ginteractions/s (%7.2f ms/step)  CPU %d threads %8.3f Ginteractions/s (%7.2f ms/step)  max error %g\n",
+               count, interactions / gpuTime / 1.0e6, gpuTime / steps, threads,
+               interactions / cpuTime / 1.0e6, cpuTime / steps, maxError);
+
+        free(positions);
+        free(velocities);
+        free(tmpPositions);
+        free(tmpVelocities);
+        free(result);
+    }
+}
+
+
+/**
+ * Program entry point
+ */
+int main(int argc, char **argv) {
+
+    // initialize GLUT
+    glutInit(&argc, argv);
+
+    // standard OpenGL stuff
+    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
+    glutInitWindowSize(64, 20);
+    glutInitWindowPosition(50, 50);
+    glutCreateWindow("computing");
+
+    // Initialize GLEW.
+    glewExperimental = true; // This is a hack. Without it the current GLEW version fails to load
+                             // some extension functions. See http://www.opengl.org/wiki/OpenGL_Loading_Library
+    if (glewInit() != GLEW_OK) {
+        cout << "Glew initialization failed" << endl;
+        return 1;
+    }
+
+    glEnable(GL_TEXTURE_2D);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glFlush();
+
+    n = texSize;
+    m = texSize;
+
+    // Select the workload, e.g. "FBO mrt"
+    const char* mode = argc > 1 ? argv[1] : "sqrt";
+    if (strcmp(mode, "sqrt") == 0) {
+        sqrt_benchmark();
+    } else if (strcmp(mode, "mrt") == 0) {
+        mrt_benchmark();
+    } else if (strcmp(mode, "pbo") == 0) {
+        pbo_benchmark();
+    } else if (strcmp(mode, "layout") == 0) {
+        layout_benchmark();
+    } else if (strcmp(mode, "compute") == 0) {
+        compute_benchmark();
+    } else if (strcmp(mode, "reduce") == 0) {
+        reduce_benchmark();
+    } else if (strcmp(mode, "image") == 0) {
+        image_benchmark(argc, argv);
+    } else if (strcmp(mode, "formats") == 0) {
+        format_benchmark();
+    } else if (strcmp(mode, "pool") == 0) {
+        pool_benchmark();
+    } else if (strcmp(mode, "scan") == 0) {
+        scan_benchmark(argc, argv);
+    } else if (strcmp(mode, "nbody") == 0) {
+        nbody_benchmark(argc, argv);
+    } else {
+        printf("Unknown mode %s, expected one of: sqrt mrt pbo layout compute reduce image formats pool scan nbody\n", mode);
+        return 1;
+    }
 
     system("pause");
 }
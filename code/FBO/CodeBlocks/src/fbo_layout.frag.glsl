@@ -0,0 +1,28 @@
+#version 130
+// Fragment shader working on arrays of arbitrary size.
+// The LAYOUT_* constants and layout* functions are inserted by the host, see layout_util.h
+
+uniform sampler2D texUnit;
+uniform int layoutTexture;      // Which texture of the array we are computing
+
+void main(void)
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 texVal = texelFetch(texUnit, texel, 0);
+    vec4 result;
+
+    for (int c = 0; c < 4; c++) {
+        int index = layoutElementIndex(layoutTexture, texel, c);
+
+        // Padding past the end of the array stays zero
+        if (index >= LAYOUT_LENGTH) {
+            result[c] = 0.0;
+            continue;
+        }
+
+        // Square root plus the number of the slice the element belongs to (0 for 1D and 2D arrays)
+        ivec3 coord = layoutElementCoord(index);
+        result[c] = sqrt(texVal[c]) + float(coord.z);
+    }
+    gl_FragColor = result;
+}
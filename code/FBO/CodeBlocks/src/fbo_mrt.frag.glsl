@@ -0,0 +1,25 @@
+// Fragment shader with multiple outputs (multiple render targets)
+
+uniform sampler2D texUnit;
+uniform float texelSize;    // 1.0 / texture size
+uniform float threshold;    // mask is 1 where the value exceeds the threshold
+uniform int channel;        // -1 writes all outputs at once, otherwise only the selected one
+
+void main(void)
+{
+    vec4 texVal   = texture2D(texUnit, gl_TexCoord[0].xy);
+    vec4 rightVal = texture2D(texUnit, gl_TexCoord[0].xy + vec2(texelSize, 0.0));
+
+    vec4 value    = sqrt(texVal);
+    vec4 gradient = rightVal - texVal;     // Forward difference along x
+    vec4 mask     = step(vec4(threshold), texVal);
+
+    if (channel < 0) {
+        gl_FragData[0] = value;
+        gl_FragData[1] = gradient;
+        gl_FragData[2] = mask;
+    }
+    else if (channel == 0) gl_FragData[0] = value;
+    else if (channel == 1) gl_FragData[0] = gradient;
+    else                   gl_FragData[0] = mask;
+}
@@ -0,0 +1,84 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Pool of FBOs reused between jobs.
+ */
+#include "fbo_pool.h"
+#include <stdio.h>
+#include <stdexcept>
+
+bool fbo_pool::key::operator<(const key &other) const {
+    if (width != other.width) return width < other.width;
+    if (height != other.height) return height < other.height;
+    if (attachments != other.attachments) return attachments < other.attachments;
+    return internalFormat < other.internalFormat;
+}
+
+fbo_pool::fbo_pool(long max_idle_bytes)
+    : max_idle_bytes(max_idle_bytes), idle_bytes(0), in_use_bytes(0), peak_bytes(0),
+      created(0), reused(0), deleted(0) {
+}
+
+fbo_pool::~fbo_pool() {
+    if (!in_use.empty()) {
+        printf("fbo_pool: %d FBO(s) were never released\n", (int)in_use.size());
+    }
+    for (std::set<struct FBOstruct *>::iterator it = in_use.begin(); it != in_use.end(); ++it) {
+        destroy(*it);
+    }
+    trim();
+}
+
+void fbo_pool::destroy(struct FBOstruct *fbo) {
+    freeFBO(fbo);
+    deleted++;
+}
+
+struct FBOstruct *fbo_pool::acquire(int width, int height, GLenum internalFormat, int attachments) {
+    key k = {width, height, attachments, internalFormat};
+    struct FBOstruct *fbo;
+
+    std::multimap<key, struct FBOstruct *>::iterator it = idle.find(k);
+    if (it != idle.end()) {
+        fbo = it->second;
+        idle.erase(it);
+        idle_bytes -= fboBytes(fbo);
+        reused++;
+    } else {
+        fbo = initMRTFBO(width, height, attachments, internalFormat, NULL);
+        created++;
+    }
+
+    in_use.insert(fbo);
+    in_use_bytes += fboBytes(fbo);
+    if (in_use_bytes + idle_bytes > peak_bytes) peak_bytes = in_use_bytes + idle_bytes;
+    return fbo;
+}
+
+void fbo_pool::release(struct FBOstruct *fbo) {
+    if (in_use.erase(fbo) == 0) {
+        throw std::runtime_error("Releasing an FBO that does not belong to the pool");
+    }
+    in_use_bytes -= fboBytes(fbo);
+
+    if (max_idle_bytes > 0 && idle_bytes + fboBytes(fbo) > max_idle_bytes) {
+        destroy(fbo);
+        return;
+    }
+    key k = {fbo->width, fbo->height, fbo->attachments, fbo->format.internalFormat};
+    idle.insert(std::make_pair(k, fbo));
+    idle_bytes += fboBytes(fbo);
+}
+
+void fbo_pool::trim() {
+    for (std::multimap<key, struct FBOstruct *>::iterator it = idle.begin(); it != idle.end(); ++it) {
+        destroy(it->second);
+    }
+    idle.clear();
+    idle_bytes = 0;
+}
+
+void fbo_pool::print_stats() const {
+    printf("FBO pool: %d created, %d reused, %d deleted; %d in use (%.2f MB), %d idle (%.2f MB), peak %.2f MB\n",
+           created, reused, deleted, (int)in_use.size(), in_use_bytes / 1.0e6, (int)idle.size(),
+           idle_bytes / 1.0e6, peak_bytes / 1.0e6);
+}
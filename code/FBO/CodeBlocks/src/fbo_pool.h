@@ -0,0 +1,54 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Pool of FBOs reused between jobs.
+ *
+ * Creating textures and framebuffers is expensive compared to a single pass of a kernel,
+ * and forgetting to delete them leaks GPU memory. A job acquires the FBOs it needs from the
+ * pool and releases them when done; released FBOs are kept and handed out again to a later
+ * request with the same width, height, format and number of attachments.
+ * The contents of a reused FBO are whatever the previous job left there.
+ */
+#ifndef FBO_POOL_H
+#define FBO_POOL_H
+
+#include <map>
+#include <set>
+#include "fbo_util.h"
+
+class fbo_pool {
+private:
+    struct key {
+        int width, height, attachments;
+        GLenum internalFormat;
+        bool operator<(const key &other) const;
+    };
+    std::multimap<key, struct FBOstruct *> idle;    // Released, waiting for reuse
+    std::set<struct FBOstruct *> in_use;            // Handed out and not released yet
+    long max_idle_bytes;                            // Idle FBOs beyond this are deleted
+    long idle_bytes, in_use_bytes, peak_bytes;
+    int created, reused, deleted;
+
+    void destroy(struct FBOstruct *fbo);
+public:
+    // max_idle_bytes = 0 means no limit on the memory kept for reuse
+    explicit fbo_pool(long max_idle_bytes = 0);
+
+    // Deletes all the FBOs; complains about those that were never released
+    ~fbo_pool();
+
+    // The pool owns its FBOs, a copy would delete them a second time
+    fbo_pool(const fbo_pool &) = delete;
+    fbo_pool &operator=(const fbo_pool &) = delete;
+
+    struct FBOstruct *acquire(int width, int height, GLenum internalFormat = GL_RGBA32F, int attachments = 1);
+    void release(struct FBOstruct *fbo);
+
+    // Delete all idle FBOs
+    void trim();
+
+    long bytes_in_use() const { return in_use_bytes; }
+    long bytes_idle() const { return idle_bytes; }
+    void print_stats() const;
+};
+
+#endif
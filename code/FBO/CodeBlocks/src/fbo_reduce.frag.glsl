@@ -0,0 +1,33 @@
+#version 130
+// Fragment shader for one reduction pass: combines a factor x factor block of texels
+
+uniform sampler2D texUnit;
+uniform int inputWidth;     // Size of the previous level in texels
+uniform int inputHeight;
+uniform int factor;         // Block size
+uniform int operation;      // 0 = sum, 1 = min, 2 = max
+
+vec4 combine(vec4 a, vec4 b)
+{
+    if (operation == 1) return min(a, b);
+    if (operation == 2) return max(a, b);
+    return a + b;
+}
+
+void main(void)
+{
+    ivec2 base = ivec2(gl_FragCoord.xy) * factor;
+
+    // The first texel of the block always exists, the rest may fall outside
+    // of a texture whose size is not a multiple of the factor
+    vec4 result = texelFetch(texUnit, base, 0);
+    for (int y = 0; y < factor; y++) {
+        for (int x = 0; x < factor; x++) {
+            ivec2 texel = base + ivec2(x, y);
+            if ((x > 0 || y > 0) && texel.x < inputWidth && texel.y < inputHeight) {
+                result = combine(result, texelFetch(texUnit, texel, 0));
+            }
+        }
+    }
+    gl_FragColor = result;
+}
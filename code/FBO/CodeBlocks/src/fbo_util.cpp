@@ -0,0 +1,178 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Framebuffer object utility routines for computing with GLSL.
+ */
+#include "fbo_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+
+int maxDrawBuffers() {
+    GLint maxBuffers = 1;
+    glGetIntegerv(GL_MAX_DRAW_BUFFERS, &maxBuffers);
+    return maxBuffers < FBO_MAX_ATTACHMENTS ? maxBuffers : FBO_MAX_ATTACHMENTS;
+}
+
+// Formats we know how to upload and read back
+static const FBOformat formats[] = {
+    {GL_R32F,       GL_RED,          GL_FLOAT,        1,  4, "R32F"},
+    {GL_RG32F,      GL_RG,           GL_FLOAT,        2,  8, "RG32F"},
+    {GL_RGBA32F,    GL_RGBA,         GL_FLOAT,        4, 16, "RGBA32F"},
+    {GL_R16F,       GL_RED,          GL_FLOAT,        1,  2, "R16F"},
+    {GL_RG16F,      GL_RG,           GL_FLOAT,        2,  4, "RG16F"},
+    {GL_RGBA16F,    GL_RGBA,         GL_FLOAT,        4,  8, "RGBA16F"},
+    {GL_R32I,       GL_RED_INTEGER,  GL_INT,          1,  4, "R32I"},
+    {GL_RG32I,      GL_RG_INTEGER,   GL_INT,          2,  8, "RG32I"},
+    {GL_RGBA32I,    GL_RGBA_INTEGER, GL_INT,          4, 16, "RGBA32I"},
+    {GL_R32UI,      GL_RED_INTEGER,  GL_UNSIGNED_INT, 1,  4, "R32UI"},
+    {GL_RG32UI,     GL_RG_INTEGER,   GL_UNSIGNED_INT, 2,  8, "RG32UI"},
+    {GL_RGBA32UI,   GL_RGBA_INTEGER, GL_UNSIGNED_INT, 4, 16, "RGBA32UI"},
+};
+
+const FBOformat *fboFormat(GLenum internalFormat) {
+    for (unsigned i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (formats[i].internalFormat == internalFormat) return &formats[i];
+    }
+    return NULL;
+}
+
+GLenum chooseFBOFormat(int channels, FBOelement element) {
+    // There are no three-channel formats among the renderable ones, use four
+    int index = channels <= 1 ? 0 : channels == 2 ? 1 : 2;
+    static const GLenum table[4][3] = {
+        {GL_R32F,  GL_RG32F, GL_RGBA32F},       // FBO_FLOAT32
+        {GL_R16F,  GL_RG16F, GL_RGBA16F},       // FBO_FLOAT16
+        {GL_R32I,  GL_RG32I, GL_RGBA32I},       // FBO_INT32
+        {GL_R32UI, GL_RG32UI, GL_RGBA32UI},     // FBO_UINT32
+    };
+    return table[element][index];
+}
+
+struct FBOstruct *initFloatFBO(int width, int height, float *data) {
+    return initFBO(width, height, GL_RGBA32F, data);
+}
+
+struct FBOstruct *initFloatMRTFBO(int width, int height, int attachments, float **data) {
+    return initMRTFBO(width, height, attachments, GL_RGBA32F, (const void **)data);
+}
+
+struct FBOstruct *initFBO(int width, int height, GLenum internalFormat, const void *data) {
+    return initMRTFBO(width, height, 1, internalFormat, &data);
+}
+
+struct FBOstruct *initMRTFBO(int width, int height, int attachments, GLenum internalFormat, const void **data) {
+
+    if (attachments < 1 || attachments > maxDrawBuffers()) {
+        throw std::runtime_error("Requested number of color attachments is not supported by the driver");
+    }
+    const FBOformat *format = fboFormat(internalFormat);
+    if (format == NULL) {
+        throw std::runtime_error("Unknown texture format for an FBO");
+    }
+
+    struct FBOstruct *fbo = (struct FBOstruct *)malloc(sizeof(struct FBOstruct));
+
+    fbo->width = width;
+    fbo->height = height;
+    fbo->attachments = attachments;
+    fbo->format = *format;
+
+    // initialize one texture per color attachment
+    glGenTextures(attachments, fbo->texids);
+    for (int i = 0; i < attachments; i++) {
+        glBindTexture(GL_TEXTURE_2D, fbo->texids[i]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format->internalFormat, width, height, 0, format->format, format->type,
+                     data == NULL ? NULL : data[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    }
+    fbo->texid = fbo->texids[0];
+
+    // create framebuffer object. We only render into textures, so no render buffer is needed.
+    glGenFramebuffers(1, &fbo->fb);      // frame buffer id
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo->fb);
+    for (int i = 0; i < attachments; i++) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, fbo->texids[i], 0);
+    }
+
+    // Not every format can be rendered into on every driver
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        freeFBO(fbo);
+        char message[128];
+        sprintf(message, "Framebuffer with %s attachments is incomplete (status 0x%x)", format->name, status);
+        throw std::runtime_error(message);
+    }
+
+    return fbo;
+}
+
+void freeFBO(struct FBOstruct *fbo) {
+    glDeleteFramebuffers(1, &fbo->fb);
+    glDeleteTextures(fbo->attachments, fbo->texids);
+    free(fbo);
+}
+
+long fboBytes(const struct FBOstruct *fbo) {
+    return (long)fbo->width * fbo->height * fbo->format.bytesPerTexel * fbo->attachments;
+}
+
+void writeFBO(struct FBOstruct *fbo, int attachment, const void *data) {
+    glBindTexture(GL_TEXTURE_2D, fbo->texids[attachment]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, fbo->width, fbo->height, fbo->format.format, fbo->format.type, data);
+}
+
+void useFBO(struct FBOstruct *in, struct FBOstruct *out) {
+    useFBOs(&in, 1, out);
+}
+
+void useFBOs(struct FBOstruct **in, int inputs, struct FBOstruct *out) {
+    static const GLenum buffers[FBO_MAX_ATTACHMENTS] = {
+        GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3,
+        GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5, GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7
+    };
+
+    glViewport(0, 0, out->width, out->height);
+    glBindFramebuffer(GL_FRAMEBUFFER, out->fb);
+
+    // gl_FragData[i] of the shader goes to the i-th color attachment
+    glDrawBuffers(out->attachments, buffers);
+    for (int i = inputs - 1; i >= 0; i--) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, in[i]->texid);
+    }
+}
+
+void drawQuad(int width, int height) {
+
+    // Set orthographic projection so that one unit corresponds to one texel
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluOrtho2D(0.0, (GLfloat) width, 0.0, (GLfloat) height);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    // Viewport-Sized Quad = Data Stream Generator.
+    glBegin(GL_QUADS);
+        glTexCoord2f(0, 0);
+        glVertex2i(0, 0);
+        glTexCoord2f(0, 1);
+        glVertex2i(0, height);
+        glTexCoord2f(1, 1);
+        glVertex2i(width, height);
+        glTexCoord2f(1, 0);
+        glVertex2i(width, 0);
+    glEnd();
+}
+
+void readFBO(struct FBOstruct *fbo, int attachment, void *result) {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo->fb);
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + attachment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, fbo->width, fbo->height, fbo->format.format, fbo->format.type, result);
+}
@@ -0,0 +1,82 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Framebuffer object utility routines for computing with GLSL.
+ */
+#ifndef FBO_UTIL_H
+#define FBO_UTIL_H
+
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+// Upper bound for the number of color attachments we keep track of.
+// The actual limit of the driver is GL_MAX_DRAW_BUFFERS (see maxDrawBuffers()).
+#define FBO_MAX_ATTACHMENTS 8
+
+// Kind of the elements stored in a texture
+enum FBOelement { FBO_FLOAT32, FBO_FLOAT16, FBO_INT32, FBO_UINT32 };
+
+// Description of a texture format we can render into
+typedef struct FBOformat {
+    GLenum internalFormat;      // How the texture is stored on the GPU, e.g. GL_R32F
+    GLenum format;              // Channels of the data we upload and read back, e.g. GL_RED
+    GLenum type;                // Type of the data we upload and read back, e.g. GL_FLOAT
+    int channels;
+    int bytesPerTexel;          // Size of one texel in GPU memory
+    const char *name;
+} FBOformat;
+
+// A structure to collect FBO info
+typedef struct FBOstruct {
+    GLuint texid;                               // Texture ID (same as texids[0])
+    GLuint texids[FBO_MAX_ATTACHMENTS];         // Texture ID of every color attachment
+    int attachments;                            // Number of color attachments in use
+    GLuint fb;                                  // Frame Buffer ID
+    int width, height;
+    FBOformat format;                           // Format of all the attachments
+} FBOstruct;
+
+// Number of color attachments a single pass can write to
+int maxDrawBuffers();
+
+// Format description for an internal format: GL_R32F, GL_RG32F, GL_RGBA32F, GL_R16F, GL_RG16F,
+// GL_RGBA16F and the 32-bit integer GL_R*32I / GL_R*32UI ones. NULL if we do not know it.
+const FBOformat *fboFormat(GLenum internalFormat);
+
+// Smallest internal format holding the given number of channels (1, 2 or 4) of the given kind
+GLenum chooseFBOFormat(int channels, FBOelement element);
+
+// Create FrameBuffer Object with one color attachment of the given internal format.
+// data (may be NULL) is laid out as described by fboFormat(internalFormat).
+// Throws if the driver cannot render into the format (glCheckFramebufferStatus).
+struct FBOstruct *initFBO(int width, int height, GLenum internalFormat, const void *data);
+
+// Create FrameBuffer Object with several color attachments (multiple render targets).
+// data[i] initializes attachment i, data itself or any data[i] may be NULL.
+struct FBOstruct *initMRTFBO(int width, int height, int attachments, GLenum internalFormat, const void **data);
+
+// Shorthands for RGBA32F
+struct FBOstruct *initFloatFBO(int width, int height, float *data);
+struct FBOstruct *initFloatMRTFBO(int width, int height, int attachments, float **data);
+
+// Delete the textures and the framebuffer of an FBO and the structure itself
+void freeFBO(struct FBOstruct *fbo);
+
+// GPU memory taken by the textures of an FBO, in bytes
+long fboBytes(const struct FBOstruct *fbo);
+
+// Replace the contents of one color attachment (laid out as fbo->format)
+void writeFBO(struct FBOstruct *fbo, int attachment, const void *data);
+
+// Choose input data (textures) and output data (FBO)
+void useFBO(struct FBOstruct *in, struct FBOstruct *out);
+
+// Same with several inputs, in[i] is bound to texture unit i
+void useFBOs(struct FBOstruct **in, int inputs, struct FBOstruct *out);
+
+// Draw a viewport-sized quad with texture coordinates spanning [0, 1]
+void drawQuad(int width, int height);
+
+// Read the contents of one color attachment into result (width * height * channels values)
+void readFBO(struct FBOstruct *fbo, int attachment, void *result);
+
+#endif
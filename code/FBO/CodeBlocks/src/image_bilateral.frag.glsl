@@ -0,0 +1,29 @@
+#version 130
+// Fragment shader: bilateral filter, smooths the image but keeps the edges
+
+uniform sampler2D texUnit;
+uniform int radius;         // Window covers (2 * radius + 1)^2 texels
+uniform float sigmaSpatial; // Falloff with the distance
+uniform float sigmaRange;   // Falloff with the difference in color
+
+void main(void)
+{
+    ivec2 size = textureSize(texUnit, 0);
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float spatial = 1.0 / (2.0 * sigmaSpatial * sigmaSpatial);
+    float range = 1.0 / (2.0 * sigmaRange * sigmaRange);
+
+    vec4 center = texelFetch(texUnit, texel, 0);
+    vec4 sum = vec4(0.0);
+    float total = 0.0;
+    for (int dy = -radius; dy <= radius; dy++) {
+        for (int dx = -radius; dx <= radius; dx++) {
+            vec4 v = texelFetch(texUnit, clamp(texel + ivec2(dx, dy), ivec2(0), size - 1), 0);
+            vec3 diff = v.rgb - center.rgb;
+            float weight = exp(-float(dx * dx + dy * dy) * spatial - dot(diff, diff) * range);
+            sum += weight * v;
+            total += weight;
+        }
+    }
+    gl_FragColor = sum / total;
+}
@@ -0,0 +1,23 @@
+#version 130
+// Fragment shader: one pass of a separable Gaussian blur
+
+uniform sampler2D texUnit;
+uniform int radius;         // Kernel covers 2 * radius + 1 texels
+uniform float sigma;
+uniform int horizontal;     // 1 for the horizontal pass, 0 for the vertical one
+
+void main(void)
+{
+    ivec2 size = textureSize(texUnit, 0);
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 direction = horizontal == 1 ? ivec2(1, 0) : ivec2(0, 1);
+
+    vec4 sum = vec4(0.0);
+    float total = 0.0;
+    for (int i = -radius; i <= radius; i++) {
+        float weight = exp(-float(i * i) / (2.0 * sigma * sigma));
+        sum += weight * texelFetch(texUnit, clamp(texel + i * direction, ivec2(0), size - 1), 0);
+        total += weight;
+    }
+    gl_FragColor = sum / total;
+}
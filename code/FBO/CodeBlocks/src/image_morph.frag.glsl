@@ -0,0 +1,21 @@
+#version 130
+// Fragment shader: dilation (maximum) or erosion (minimum) over a square window
+
+uniform sampler2D texUnit;
+uniform int radius;         // Window covers (2 * radius + 1)^2 texels
+uniform int dilate;         // 1 for dilation, 0 for erosion
+
+void main(void)
+{
+    ivec2 size = textureSize(texUnit, 0);
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+
+    vec4 result = texelFetch(texUnit, texel, 0);
+    for (int dy = -radius; dy <= radius; dy++) {
+        for (int dx = -radius; dx <= radius; dx++) {
+            vec4 v = texelFetch(texUnit, clamp(texel + ivec2(dx, dy), ivec2(0), size - 1), 0);
+            result = dilate == 1 ? max(result, v) : min(result, v);
+        }
+    }
+    gl_FragColor = result;
+}
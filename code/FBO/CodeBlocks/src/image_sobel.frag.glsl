@@ -0,0 +1,21 @@
+#version 130
+// Fragment shader: Sobel edge detector, gradient magnitude of every channel
+
+uniform sampler2D texUnit;
+
+vec4 fetch(ivec2 texel)
+{
+    return texelFetch(texUnit, clamp(texel, ivec2(0), textureSize(texUnit, 0) - 1), 0);
+}
+
+void main(void)
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    vec4 tl = fetch(p + ivec2(-1, 1)), t = fetch(p + ivec2(0, 1)), tr = fetch(p + ivec2(1, 1));
+    vec4 l  = fetch(p + ivec2(-1, 0)),                             r  = fetch(p + ivec2(1, 0));
+    vec4 bl = fetch(p + ivec2(-1,-1)), b = fetch(p + ivec2(0,-1)), br = fetch(p + ivec2(1,-1));
+
+    vec4 gx = (tr + 2.0 * r + br) - (tl + 2.0 * l + bl);
+    vec4 gy = (tl + 2.0 * t + tr) - (bl + 2.0 * b + br);
+    gl_FragColor = sqrt(gx * gx + gy * gy);
+}
@@ -0,0 +1,335 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Image processing kernels on the FBO engine and their CPU references.
+ */
+#include "image_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ------------------- SIMD pixel ------------------- //
+// One RGBA pixel is exactly one SSE register
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+typedef __m128 pixel;
+static inline pixel load(const float *p)             { return _mm_loadu_ps(p); }
+static inline void store(float *p, pixel a)          { _mm_storeu_ps(p, a); }
+static inline pixel splat(float f)                   { return _mm_set1_ps(f); }
+static inline pixel add(pixel a, pixel b)            { return _mm_add_ps(a, b); }
+static inline pixel sub(pixel a, pixel b)            { return _mm_sub_ps(a, b); }
+static inline pixel mul(pixel a, pixel b)            { return _mm_mul_ps(a, b); }
+static inline pixel pmin(pixel a, pixel b)           { return _mm_min_ps(a, b); }
+static inline pixel pmax(pixel a, pixel b)           { return _mm_max_ps(a, b); }
+static inline pixel psqrt(pixel a)                   { return _mm_sqrt_ps(a); }
+#else
+typedef struct { float v[4]; } pixel;
+static inline pixel load(const float *p)             { pixel r; memcpy(r.v, p, sizeof(r.v)); return r; }
+static inline void store(float *p, pixel a)          { memcpy(p, a.v, sizeof(a.v)); }
+static inline pixel splat(float f)                   { pixel r = {{f, f, f, f}}; return r; }
+#define PIXEL_OP(name, expr) \
+    static inline pixel name(pixel a, pixel b) { pixel r; for (int c = 0; c < 4; c++) r.v[c] = expr; return r; }
+PIXEL_OP(add, a.v[c] + b.v[c])
+PIXEL_OP(sub, a.v[c] - b.v[c])
+PIXEL_OP(mul, a.v[c] * b.v[c])
+PIXEL_OP(pmin, a.v[c] < b.v[c] ? a.v[c] : b.v[c])
+PIXEL_OP(pmax, a.v[c] > b.v[c] ? a.v[c] : b.v[c])
+static inline pixel psqrt(pixel a)                   { pixel r; for (int c = 0; c < 4; c++) r.v[c] = sqrtf(a.v[c]); return r; }
+#endif
+
+// Squared length of the RGB part
+static inline float rgbLength2(pixel a) {
+    float v[4];
+    store(v, mul(a, a));
+    return v[0] + v[1] + v[2];
+}
+
+// Pixel with coordinates clamped to the image, like texelFetch with clamped coordinates
+static inline pixel fetch(const struct Image *image, int x, int y) {
+    x = x < 0 ? 0 : x >= image->width ? image->width - 1 : x;
+    y = y < 0 ? 0 : y >= image->height ? image->height - 1 : y;
+    return load(image->pixels + ((long)y * image->width + x) * 4);
+}
+
+// Split the rows of the image between threads
+template <typename RowFunction>
+static void parallelRows(int height, int threads, RowFunction row) {
+    std::vector<std::thread> workers;
+    int chunk = (height + threads - 1) / threads;
+    for (int t = 0; t < threads; t++) {
+        int begin = t * chunk;
+        int end = begin + chunk < height ? begin + chunk : height;
+        workers.push_back(std::thread([=]() {
+            for (int y = begin; y < end; y++) row(y);
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+}
+
+// ---------------------- Images --------------------- //
+struct Image *initImage(int width, int height) {
+    struct Image *image = (struct Image *)malloc(sizeof(struct Image));
+    image->width = width;
+    image->height = height;
+    image->pixels = (float *)malloc((long)width * height * 4 * sizeof(float));
+    return image;
+}
+
+void freeImage(struct Image *image) {
+    free(image->pixels);
+    free(image);
+}
+
+// Next number of a PGM/PPM header, skipping whitespace and "#" comments up to the end of the line
+static bool readHeaderNumber(FILE *file, int *value) {
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        if (c == '#') {
+            while ((c = fgetc(file)) != EOF && c != '\n');
+        } else if (!isspace(c)) {
+            ungetc(c, file);
+            return fscanf(file, "%d", value) == 1;
+        }
+    }
+    return false;
+}
+
+struct Image *loadImage(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) throw std::runtime_error(std::string("Failed to read file ") + filename);
+
+    char magic[3] = {0};
+    int width, height, maxValue;
+    if (fscanf(file, "%2s", magic) != 1 || !readHeaderNumber(file, &width) || !readHeaderNumber(file, &height) ||
+        !readHeaderNumber(file, &maxValue) || width <= 0 || height <= 0 ||
+        (strcmp(magic, "P5") != 0 && strcmp(magic, "P6") != 0) || maxValue != 255) {
+        fclose(file);
+        throw std::runtime_error(std::string("Not an 8-bit binary PGM/PPM file: ") + filename);
+    }
+    fgetc(file);    // Single whitespace before the pixel data
+
+    int channels = magic[1] == '5' ? 1 : 3;
+    long count = (long)width * height * channels;
+    std::vector<unsigned char> bytes(count);
+    long read = fread(&bytes[0], 1, count, file);
+    fclose(file);
+    if (read != count) throw std::runtime_error(std::string("Truncated image file ") + filename);
+
+    struct Image *image = initImage(width, height);
+    for (long i = 0; i < (long)width * height; i++) {
+        for (int c = 0; c < 3; c++) {
+            image->pixels[i * 4 + c] = bytes[i * channels + (channels == 1 ? 0 : c)] / 255.0f;
+        }
+        image->pixels[i * 4 + 3] = 1.0f;
+    }
+    return image;
+}
+
+void saveImage(const struct Image *image, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) throw std::runtime_error(std::string("Failed to write file ") + filename);
+
+    fprintf(file, "P6\n%d %d\n255\n", image->width, image->height);
+    for (long i = 0; i < (long)image->width * image->height; i++) {
+        for (int c = 0; c < 3; c++) {
+            float v = image->pixels[i * 4 + c];
+            fputc((int)((v < 0 ? 0 : v > 1 ? 1 : v) * 255.0f + 0.5f), file);
+        }
+    }
+    fclose(file);
+}
+
+struct Image *loadRawImage(const char *filename, int width, int height, int channels) {
+    if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+        throw std::runtime_error(std::string("Raw image needs a positive size and 1-4 channels: ") + filename);
+    }
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) throw std::runtime_error(std::string("Failed to read file ") + filename);
+
+    long count = (long)width * height * channels;
+    std::vector<float> values(count);
+    long read = fread(&values[0], sizeof(float), count, file);
+    fclose(file);
+    if (read != count) throw std::runtime_error(std::string("Truncated raw image file ") + filename);
+
+    struct Image *image = initImage(width, height);
+    for (long i = 0; i < (long)width * height; i++) {
+        for (int c = 0; c < 4; c++) {
+            image->pixels[i * 4 + c] = c < channels ? values[i * channels + c] :
+                                       c == 3 ? 1.0f : values[i * channels];
+        }
+    }
+    return image;
+}
+
+struct Image *testImage(int width, int height) {
+    struct Image *image = initImage(width, height);
+    unsigned int seed = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float *p = image->pixels + ((long)y * width + x) * 4;
+            seed = seed * 1103515245 + 12345;
+            float noise = ((seed >> 16) & 0xff) / 255.0f * 0.1f;
+            float checker = ((x / 32 + y / 32) % 2) * 0.5f;
+            p[0] = checker + noise;
+            p[1] = (float)x / width * 0.5f + noise;
+            p[2] = (float)y / height * 0.5f + checker * 0.5f;
+            p[3] = 1.0f;
+        }
+    }
+    return image;
+}
+
+// ------------------- GPU kernels ------------------- //
+static shader_prog *imageKernel(const char *fragmentShader) {
+    shader_prog *shader = new shader_prog("../src/fbo.vert.glsl", fragmentShader);
+    shader->prepend(GL_VERTEX_SHADER, "#version 130\n");
+    shader->use();
+    return shader;
+}
+
+struct ImageKernels *initImageKernels(const ImageParams *params) {
+    struct ImageKernels *kernels = (struct ImageKernels *)malloc(sizeof(struct ImageKernels));
+
+    kernels->blur = imageKernel("../src/image_blur.frag.glsl");
+    kernels->blur->uniform1i("radius", params->blurRadius);
+    kernels->blur->uniform1f("sigma", params->blurSigma);
+
+    kernels->sobel = imageKernel("../src/image_sobel.frag.glsl");
+
+    kernels->morph = imageKernel("../src/image_morph.frag.glsl");
+    kernels->morph->uniform1i("radius", params->morphRadius);
+
+    kernels->bilateral = imageKernel("../src/image_bilateral.frag.glsl");
+    kernels->bilateral->uniform1i("radius", params->bilateralRadius);
+    kernels->bilateral->uniform1f("sigmaSpatial", params->sigmaSpatial);
+    kernels->bilateral->uniform1f("sigmaRange", params->sigmaRange);
+
+    glUseProgram(0);
+    return kernels;
+}
+
+void freeImageKernels(struct ImageKernels *kernels) {
+    shader_prog *shaders[4] = {kernels->blur, kernels->sobel, kernels->morph, kernels->bilateral};
+    for (int i = 0; i < 4; i++) {
+        shaders[i]->free();
+        delete shaders[i];
+    }
+    free(kernels);
+}
+
+// One pass of a kernel over the whole image
+static void imagePass(struct FBOstruct *in, struct FBOstruct *out) {
+    useFBO(in, out);
+    drawQuad(out->width, out->height);
+}
+
+void blurGPU(struct ImageKernels *kernels, struct FBOstruct *in, struct FBOstruct *tmp, struct FBOstruct *out) {
+    glUseProgram(*kernels->blur);
+    kernels->blur->uniform1i("horizontal", 1);
+    imagePass(in, tmp);
+    kernels->blur->uniform1i("horizontal", 0);
+    imagePass(tmp, out);
+}
+
+void sobelGPU(struct ImageKernels *kernels, struct FBOstruct *in, struct FBOstruct *out) {
+    glUseProgram(*kernels->sobel);
+    imagePass(in, out);
+}
+
+void morphGPU(struct ImageKernels *kernels, struct FBOstruct *in, struct FBOstruct *out, bool dilate) {
+    glUseProgram(*kernels->morph);
+    kernels->morph->uniform1i("dilate", dilate);
+    imagePass(in, out);
+}
+
+void bilateralGPU(struct ImageKernels *kernels, struct FBOstruct *in, struct FBOstruct *out) {
+    glUseProgram(*kernels->bilateral);
+    imagePass(in, out);
+}
+
+// ------------------- CPU kernels ------------------- //
+void blurCPU(const ImageParams *params, const struct Image *in, struct Image *tmp, struct Image *out, int threads) {
+    int r = params->blurRadius;
+    std::vector<float> weights(2 * r + 1);
+    float total = 0;
+    for (int i = -r; i <= r; i++) {
+        weights[i + r] = expf(-(i * i) / (2.0f * params->blurSigma * params->blurSigma));
+        total += weights[i + r];
+    }
+    for (int i = 0; i <= 2 * r; i++) weights[i] /= total;
+    const float *w = &weights[0];
+
+    // Horizontal pass into tmp, vertical pass into out
+    parallelRows(in->height, threads, [=](int y) {
+        for (int x = 0; x < in->width; x++) {
+            pixel sum = splat(0);
+            for (int i = -r; i <= r; i++) sum = add(sum, mul(splat(w[i + r]), fetch(in, x + i, y)));
+            store(tmp->pixels + ((long)y * in->width + x) * 4, sum);
+        }
+    });
+    parallelRows(in->height, threads, [=](int y) {
+        for (int x = 0; x < in->width; x++) {
+            pixel sum = splat(0);
+            for (int i = -r; i <= r; i++) sum = add(sum, mul(splat(w[i + r]), fetch(tmp, x, y + i)));
+            store(out->pixels + ((long)y * in->width + x) * 4, sum);
+        }
+    });
+}
+
+void sobelCPU(const struct Image *in, struct Image *out, int threads) {
+    parallelRows(in->height, threads, [=](int y) {
+        pixel two = splat(2);
+        for (int x = 0; x < in->width; x++) {
+            pixel tl = fetch(in, x - 1, y + 1), t = fetch(in, x, y + 1), tr = fetch(in, x + 1, y + 1);
+            pixel l  = fetch(in, x - 1, y),                              r = fetch(in, x + 1, y);
+            pixel bl = fetch(in, x - 1, y - 1), b = fetch(in, x, y - 1), br = fetch(in, x + 1, y - 1);
+            pixel gx = sub(add(add(tr, mul(two, r)), br), add(add(tl, mul(two, l)), bl));
+            pixel gy = sub(add(add(tl, mul(two, t)), tr), add(add(bl, mul(two, b)), br));
+            store(out->pixels + ((long)y * in->width + x) * 4, psqrt(add(mul(gx, gx), mul(gy, gy))));
+        }
+    });
+}
+
+void morphCPU(const ImageParams *params, const struct Image *in, struct Image *out, bool dilate, int threads) {
+    int r = params->morphRadius;
+    parallelRows(in->height, threads, [=](int y) {
+        for (int x = 0; x < in->width; x++) {
+            pixel result = fetch(in, x, y);
+            for (int dy = -r; dy <= r; dy++) {
+                for (int dx = -r; dx <= r; dx++) {
+                    pixel v = fetch(in, x + dx, y + dy);
+                    result = dilate ? pmax(result, v) : pmin(result, v);
+                }
+            }
+            store(out->pixels + ((long)y * in->width + x) * 4, result);
+        }
+    });
+}
+
+void bilateralCPU(const ImageParams *params, const struct Image *in, struct Image *out, int threads) {
+    int r = params->bilateralRadius;
+    float spatial = 1.0f / (2.0f * params->sigmaSpatial * params->sigmaSpatial);
+    float range = 1.0f / (2.0f * params->sigmaRange * params->sigmaRange);
+    parallelRows(in->height, threads, [=](int y) {
+        for (int x = 0; x < in->width; x++) {
+            pixel center = fetch(in, x, y);
+            pixel sum = splat(0);
+            float total = 0;
+            for (int dy = -r; dy <= r; dy++) {
+                for (int dx = -r; dx <= r; dx++) {
+                    pixel v = fetch(in, x + dx, y + dy);
+                    float w = expf(-(dx * dx + dy * dy) * spatial - rgbLength2(sub(v, center)) * range);
+                    sum = add(sum, mul(splat(w), v));
+                    total += w;
+                }
+            }
+            store(out->pixels + ((long)y * in->width + x) * 4, mul(sum, splat(1.0f / total)));
+        }
+    });
+}
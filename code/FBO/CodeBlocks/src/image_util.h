@@ -0,0 +1,69 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Image processing kernels on the FBO engine and their CPU references.
+ *
+ * Images are kept as RGBA float textures. Every kernel is a fragment shader
+ * reading a neighbourhood of the current texel (clamped at the borders):
+ *  - separable Gaussian blur: a horizontal and a vertical pass through an intermediate FBO
+ *  - Sobel edges: gradient magnitude of every channel
+ *  - dilation / erosion: maximum / minimum over a square window
+ *  - bilateral filter: Gaussian weights in space and in color
+ * The CPU versions split the rows between threads and process the four channels
+ * of a pixel at once with SSE.
+ */
+#ifndef IMAGE_UTIL_H
+#define IMAGE_UTIL_H
+
+#include "fbo_util.h"
+#include "shader_util.h"
+
+// RGBA float image, rows stored one after another
+typedef struct Image {
+    int width, height;
+    float *pixels;          // width * height * 4 floats, values in [0, 1]
+} Image;
+
+struct Image *initImage(int width, int height);
+void freeImage(struct Image *image);
+
+// Binary netpbm files: P5 (grayscale .pgm) or P6 (color .ppm), 8 bits per channel
+struct Image *loadImage(const char *filename);
+void saveImage(const struct Image *image, const char *filename);
+
+// Headerless file of width * height * channels floats (channels = 1 to 4; the missing color channels
+// copy the first one and alpha is 1). Throws std::runtime_error for other sizes or channel counts.
+struct Image *loadRawImage(const char *filename, int width, int height, int channels);
+
+// Synthetic test image: gradients, edges and some noise
+struct Image *testImage(int width, int height);
+
+// Kernel parameters shared by the GPU and the CPU versions
+typedef struct ImageParams {
+    int blurRadius;
+    float blurSigma;
+    int morphRadius;
+    int bilateralRadius;
+    float sigmaSpatial, sigmaRange;
+} ImageParams;
+
+// Fragment shaders of the kernels, compiled by initImageKernels
+typedef struct ImageKernels {
+    shader_prog *blur, *sobel, *morph, *bilateral;
+} ImageKernels;
+
+struct ImageKernels *initImageKernels(const ImageParams *params);
+void freeImageKernels(struct ImageKernels *kernels);
+
+// GPU kernels: read the in FBO, write the out FBO (tmp holds the first blur pass)
+void blurGPU(struct ImageKernels *kernels, struct FBOstruct *in, struct FBOstruct *tmp, struct FBOstruct *out);
+void sobelGPU(struct ImageKernels *kernels, struct FBOstruct *in, struct FBOstruct *out);
+void morphGPU(struct ImageKernels *kernels, struct FBOstruct *in, struct FBOstruct *out, bool dilate);
+void bilateralGPU(struct ImageKernels *kernels, struct FBOstruct *in, struct FBOstruct *out);
+
+// CPU references
+void blurCPU(const ImageParams *params, const struct Image *in, struct Image *tmp, struct Image *out, int threads);
+void sobelCPU(const struct Image *in, struct Image *out, int threads);
+void morphCPU(const ImageParams *params, const struct Image *in, struct Image *out, bool dilate, int threads);
+void bilateralCPU(const ImageParams *params, const struct Image *in, struct Image *out, int threads);
+
+#endif
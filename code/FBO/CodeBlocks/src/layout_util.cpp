@@ -0,0 +1,120 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Mapping arrays of arbitrary size onto RGBA float textures.
+ */
+#include "layout_util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <sstream>
+#include <stdexcept>
+
+ArrayLayout arrayLayout(int width, int height, int depth, int maxTexSize) {
+    ArrayLayout layout;
+    layout.width = width;
+    layout.height = height;
+    layout.depth = depth;
+    layout.length = (long)width * height * depth;
+
+    // Element indices are plain ints in GLSL
+    if (layout.length <= 0 || layout.length > INT_MAX - 3) {
+        throw std::runtime_error("Array size not supported by the texture layout");
+    }
+
+    if (maxTexSize <= 0) {
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexSize);
+    }
+
+    long texels = (layout.length + 3) / 4;
+    long maxTexels = (long)maxTexSize * maxTexSize;
+    if (texels <= maxTexels) {
+        // As square as possible, so that neither side exceeds the limit
+        layout.texWidth = (int)ceil(sqrt((double)texels));
+        layout.texHeight = (int)((texels + layout.texWidth - 1) / layout.texWidth);
+        layout.textures = 1;
+    } else {
+        layout.texWidth = maxTexSize;
+        layout.texHeight = maxTexSize;
+        layout.textures = (int)((texels + maxTexels - 1) / maxTexels);
+    }
+    layout.texelsPerTexture = (long)layout.texWidth * layout.texHeight;
+    layout.padding = layout.textures * layout.texelsPerTexture * 4 - layout.length;
+    return layout;
+}
+
+struct FBOstruct **initLayoutFBOs(const ArrayLayout *layout, const float *data) {
+    struct FBOstruct **fbos = (struct FBOstruct **)malloc(layout->textures * sizeof(struct FBOstruct *));
+    long floatsPerTexture = layout->texelsPerTexture * 4;
+    float *texels = data == NULL ? NULL : (float *)malloc(floatsPerTexture * sizeof(float));
+
+    for (int t = 0; t < layout->textures; t++) {
+        if (texels != NULL) {
+            long offset = t * floatsPerTexture;
+            long count = layout->length - offset < floatsPerTexture ? layout->length - offset : floatsPerTexture;
+            memcpy(texels, data + offset, count * sizeof(float));
+            memset(texels + count, 0, (floatsPerTexture - count) * sizeof(float));
+        }
+        fbos[t] = initFloatFBO(layout->texWidth, layout->texHeight, texels);
+    }
+
+    free(texels);
+    return fbos;
+}
+
+void freeLayoutFBOs(const ArrayLayout *layout, struct FBOstruct **fbos) {
+    for (int t = 0; t < layout->textures; t++) {
+        freeFBO(fbos[t]);
+    }
+    free(fbos);
+}
+
+void readLayoutFBOs(const ArrayLayout *layout, struct FBOstruct **fbos, float *data) {
+    long floatsPerTexture = layout->texelsPerTexture * 4;
+    float *texels = (float *)malloc(floatsPerTexture * sizeof(float));
+
+    for (int t = 0; t < layout->textures; t++) {
+        readFBO(fbos[t], 0, texels);
+        long offset = t * floatsPerTexture;
+        long count = layout->length - offset < floatsPerTexture ? layout->length - offset : floatsPerTexture;
+        memcpy(data + offset, texels, count * sizeof(float));
+    }
+
+    free(texels);
+}
+
+std::string layoutShaderHeader(const ArrayLayout *layout) {
+    std::ostringstream glsl;
+    glsl << "// ------- Array layout (generated by layoutShaderHeader) ------- //\n"
+         << "const int LAYOUT_LENGTH = " << layout->length << ";\n"
+         << "const ivec3 LAYOUT_SHAPE = ivec3(" << layout->width << ", " << layout->height << ", " << layout->depth << ");\n"
+         << "const int LAYOUT_TEX_WIDTH = " << layout->texWidth << ";\n"
+         << "const int LAYOUT_TEX_HEIGHT = " << layout->texHeight << ";\n"
+         << "const int LAYOUT_TEXELS_PER_TEXTURE = " << layout->texelsPerTexture << ";\n"
+         << "\n"
+         << "// Index of the element stored in a channel of a texel of texture number tex\n"
+         << "int layoutElementIndex(int tex, ivec2 texel, int channel) {\n"
+         << "    return (tex * LAYOUT_TEXELS_PER_TEXTURE + texel.y * LAYOUT_TEX_WIDTH + texel.x) * 4 + channel;\n"
+         << "}\n"
+         << "\n"
+         << "// Position of an element in the original (row-major) array\n"
+         << "ivec3 layoutElementCoord(int index) {\n"
+         << "    return ivec3(index % LAYOUT_SHAPE.x,\n"
+         << "                 (index / LAYOUT_SHAPE.x) % LAYOUT_SHAPE.y,\n"
+         << "                 index / (LAYOUT_SHAPE.x * LAYOUT_SHAPE.y));\n"
+         << "}\n"
+         << "\n"
+         << "// Where an element is stored: texture number, texel and channel\n"
+         << "int layoutTextureOf(int index) {\n"
+         << "    return (index / 4) / LAYOUT_TEXELS_PER_TEXTURE;\n"
+         << "}\n"
+         << "ivec2 layoutTexelOf(int index) {\n"
+         << "    int texel = (index / 4) % LAYOUT_TEXELS_PER_TEXTURE;\n"
+         << "    return ivec2(texel % LAYOUT_TEX_WIDTH, texel / LAYOUT_TEX_WIDTH);\n"
+         << "}\n"
+         << "int layoutChannelOf(int index) {\n"
+         << "    return index % 4;\n"
+         << "}\n"
+         << "// ------------------------------------------------------------- //\n";
+    return glsl.str();
+}
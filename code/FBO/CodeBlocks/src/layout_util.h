@@ -0,0 +1,46 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Mapping arrays of arbitrary size onto RGBA float textures.
+ *
+ * The array (1D, 2D or 3D, stored row-major) is flattened and cut into groups of four
+ * floats, one group per RGBA texel. Texels fill the rows of a texture one after another.
+ * When the array does not fit into a single texture of at most GL_MAX_TEXTURE_SIZE texels
+ * per side, it continues in the next texture. The tail of the last texture is padded with zeros.
+ *
+ *   element index e  ->  texel t = e / 4, channel c = e % 4
+ *   texel t          ->  texture t / texelsPerTexture, x = (t % texelsPerTexture) % texWidth,
+ *                                                      y = (t % texelsPerTexture) / texWidth
+ *
+ * layoutShaderHeader() generates the same index math in GLSL.
+ */
+#ifndef LAYOUT_UTIL_H
+#define LAYOUT_UTIL_H
+
+#include <string>
+#include "fbo_util.h"
+
+typedef struct ArrayLayout {
+    int width, height, depth;   // Shape of the array in elements
+    long length;                // width * height * depth
+    int texWidth, texHeight;    // Size of each texture in texels
+    long texelsPerTexture;      // texWidth * texHeight
+    int textures;               // Number of textures the array is split into
+    long padding;               // Number of unused floats at the end of the last texture
+} ArrayLayout;
+
+// Compute the layout of a width x height x depth array.
+// maxTexSize <= 0 means GL_MAX_TEXTURE_SIZE of the driver.
+ArrayLayout arrayLayout(int width, int height, int depth, int maxTexSize);
+
+// Create one FBO per texture of the layout, filled from data (or left empty if data is NULL)
+struct FBOstruct **initLayoutFBOs(const ArrayLayout *layout, const float *data);
+void freeLayoutFBOs(const ArrayLayout *layout, struct FBOstruct **fbos);
+
+// Read back all the textures of a layout into data (layout->length floats), dropping the padding
+void readLayoutFBOs(const ArrayLayout *layout, struct FBOstruct **fbos, float *data);
+
+// GLSL constants and functions implementing the index math of the layout.
+// Needs #version 130; insert it with shader_prog::prepend(GL_FRAGMENT_SHADER, ...).
+std::string layoutShaderHeader(const ArrayLayout *layout);
+
+#endif
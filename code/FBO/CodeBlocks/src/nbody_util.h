@@ -0,0 +1,52 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * N-body simulation that lives entirely on the GPU.
+ *
+ * Positions (xyz, mass in w) and velocities are RGBA32F textures, body i being texel
+ * (i % width, i / width). Each of them has two copies that are swapped every step (ping-pong):
+ *  1. velocity pass: every fragment loops over the position texture row by row (one row
+ *     is one tile) summing the gravitational pull of all bodies, and integrates the velocity
+ *  2. position pass: moves every body by its new velocity
+ * A renderer can draw the bodies straight from the position texture (vertex texture fetch
+ * with gl_VertexID), so nothing is copied back to the CPU.
+ *
+ * Only uses OpenGL 3.3 core profile functionality.
+ */
+#ifndef NBODY_UTIL_H
+#define NBODY_UTIL_H
+
+#include <GL/glew.h>
+#include "shader_util.h"
+
+#define NBODY_MAX_WIDTH 1024
+
+typedef struct NBody {
+    int count;                  // Number of bodies
+    int width, height;          // Size of the state textures
+    float dt, softening;        // Time step, and a distance added to avoid infinite forces
+    GLuint positions[2];        // Position textures, positions[current] is the latest
+    GLuint velocities[2];       // Velocity textures
+    GLuint positionFBOs[2];     // Framebuffers rendering into the textures above
+    GLuint velocityFBOs[2];
+    int current;
+    GLuint vao;                 // Empty vertex array for the full-screen triangle
+    shader_prog *velocityShader, *positionShader;
+} NBody;
+
+// Upload count bodies: positions and velocities hold 4 floats per body (w of a position is the mass)
+struct NBody *initNBody(int count, const float *positions, const float *velocities, float dt, float softening);
+void freeNBody(struct NBody *nbody);
+
+// Advance the simulation by one time step (two passes). Keeps the viewport and binds framebuffer 0.
+void stepNBody(struct NBody *nbody);
+
+// Texture with the latest positions
+GLuint nbodyPositions(struct NBody *nbody);
+
+// Read the latest state back (for checking), 4 floats per body each, either may be NULL
+void readNBody(struct NBody *nbody, float *positions, float *velocities);
+
+// A rotating ball of bodies with random masses
+void nbodyInitialState(int count, float *positions, float *velocities);
+
+#endif
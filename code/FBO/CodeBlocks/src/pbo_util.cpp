@@ -0,0 +1,103 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Asynchronous transfers between the CPU and FBO textures using pixel buffer objects.
+ */
+#include "pbo_util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+
+struct PBOring *initPBORing(GLenum target, int count, long bytes) {
+
+    if (count < 1 || count > PBO_MAX_RING_SIZE) {
+        throw std::runtime_error("Unsupported number of pixel buffer objects in a ring");
+    }
+
+    struct PBOring *ring = (struct PBOring *)malloc(sizeof(struct PBOring));
+    ring->target = target;
+    ring->count = count;
+    ring->next = 0;
+    ring->bytes = bytes;
+
+    // GL_STREAM_READ: filled by the GPU, read once by us. GL_STREAM_DRAW: the other way around.
+    GLenum usage = target == GL_PIXEL_PACK_BUFFER ? GL_STREAM_READ : GL_STREAM_DRAW;
+    glGenBuffers(count, ring->buffers);
+    for (int i = 0; i < count; i++) {
+        glBindBuffer(target, ring->buffers[i]);
+        glBufferData(target, bytes, NULL, usage);
+        ring->fences[i] = 0;
+    }
+    glBindBuffer(target, 0);
+    return ring;
+}
+
+void freePBORing(struct PBOring *ring) {
+    for (int i = 0; i < ring->count; i++) {
+        if (ring->fences[i]) glDeleteSync(ring->fences[i]);
+    }
+    glDeleteBuffers(ring->count, ring->buffers);
+    free(ring);
+}
+
+// Block until the previous transfer of the buffer has completed
+static void waitFence(struct PBOring *ring, int index) {
+    if (!ring->fences[index]) return;
+    while (glClientWaitSync(ring->fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(ring->fences[index]);
+    ring->fences[index] = 0;
+}
+
+int readFBOAsync(struct PBOring *ring, struct FBOstruct *fbo, int attachment) {
+    int index = ring->next;
+    ring->next = (ring->next + 1) % ring->count;
+
+    // Overwriting a buffer nobody has mapped yet is fine, but its old fence has to go
+    if (ring->fences[index]) glDeleteSync(ring->fences[index]);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo->fb);
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + attachment);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ring->buffers[index]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    // With a pack buffer bound the last argument is an offset into the buffer
+    glReadPixels(0, 0, fbo->width, fbo->height, fbo->format.format, fbo->format.type, 0);
+    ring->fences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return index;
+}
+
+const float *mapPBO(struct PBOring *ring, int index) {
+    waitFence(ring, index);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ring->buffers[index]);
+    const float *data = (const float *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, ring->bytes, GL_MAP_READ_BIT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return data;
+}
+
+void unmapPBO(struct PBOring *ring, int index) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ring->buffers[index]);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void writeFBOAsync(struct PBOring *ring, struct FBOstruct *fbo, const void *data) {
+    int index = ring->next;
+    ring->next = (ring->next + 1) % ring->count;
+
+    // The buffer may still be feeding an earlier glTexSubImage2D
+    waitFence(ring, index);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->buffers[index]);
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ring->bytes,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    memcpy(dst, data, ring->bytes);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // With an unpack buffer bound the last argument is an offset into the buffer
+    glBindTexture(GL_TEXTURE_2D, fbo->texid);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, fbo->width, fbo->height, fbo->format.format, fbo->format.type, 0);
+    ring->fences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
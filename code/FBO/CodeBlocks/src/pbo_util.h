@@ -0,0 +1,46 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Asynchronous transfers between the CPU and FBO textures using pixel buffer objects.
+ *
+ * glReadPixels into client memory blocks until the GPU has finished all the work before it.
+ * When a GL_PIXEL_PACK_BUFFER is bound, glReadPixels only schedules the copy and returns at once.
+ * A fence placed after the copy tells us later whether the data has arrived, so we can keep
+ * the GPU busy with the next batch in the meantime and map the buffer when it is ready.
+ * Uploads work the same way with GL_PIXEL_UNPACK_BUFFER and glTexSubImage2D.
+ */
+#ifndef PBO_UTIL_H
+#define PBO_UTIL_H
+
+#include "fbo_util.h"
+
+#define PBO_MAX_RING_SIZE 8
+
+// A ring of pixel buffer objects, each guarded by a fence
+typedef struct PBOring {
+    GLenum target;                          // GL_PIXEL_PACK_BUFFER or GL_PIXEL_UNPACK_BUFFER
+    GLuint buffers[PBO_MAX_RING_SIZE];      // Buffer IDs
+    GLsync fences[PBO_MAX_RING_SIZE];       // Signalled when the transfer of a buffer is complete
+    int count;                              // Number of buffers in the ring
+    int next;                               // Buffer to be used by the next transfer
+    long bytes;                             // Size of each buffer
+} PBOring;
+
+// Create a ring of count buffers of the given size for readback (GL_PIXEL_PACK_BUFFER)
+// or upload (GL_PIXEL_UNPACK_BUFFER)
+struct PBOring *initPBORing(GLenum target, int count, long bytes);
+void freePBORing(struct PBOring *ring);
+
+// Schedule a copy of one color attachment into the next buffer of a pack ring.
+// Returns the index of the buffer to pass to mapPBO later.
+int readFBOAsync(struct PBOring *ring, struct FBOstruct *fbo, int attachment);
+
+// Wait until the transfer into the given buffer has finished and map it for reading.
+// The pointer stays valid until unmapPBO.
+const float *mapPBO(struct PBOring *ring, int index);
+void unmapPBO(struct PBOring *ring, int index);
+
+// Copy data into the next buffer of an unpack ring and schedule the upload into the
+// FBO texture (ring->bytes of data laid out as fbo->format). Returns without waiting for the GPU.
+void writeFBOAsync(struct PBOring *ring, struct FBOstruct *fbo, const void *data);
+
+#endif
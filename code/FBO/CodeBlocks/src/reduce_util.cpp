@@ -0,0 +1,97 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Parallel reduction (sum, min, max) with a sequence of FBO passes.
+ */
+#include "reduce_util.h"
+#include <stdlib.h>
+#include <math.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+struct ReductionChain *initReduction(int width, int height, int factor) {
+    struct ReductionChain *chain = (struct ReductionChain *)malloc(sizeof(struct ReductionChain));
+    chain->width = width;
+    chain->height = height;
+    chain->factor = factor;
+    chain->levels = 0;
+
+    do {
+        if (chain->levels == REDUCE_MAX_LEVELS) {
+            throw std::runtime_error("Reduction chain is too long");
+        }
+        width = (width + factor - 1) / factor;
+        height = (height + factor - 1) / factor;
+        chain->fbos[chain->levels++] = initFloatFBO(width, height, NULL);
+    } while (width > 1 || height > 1);
+
+    return chain;
+}
+
+void freeReduction(struct ReductionChain *chain) {
+    for (int i = 0; i < chain->levels; i++) {
+        freeFBO(chain->fbos[i]);
+    }
+    free(chain);
+}
+
+// Combine two partial results
+static double combine(double a, double b, ReduceOp op) {
+    if (op == REDUCE_MIN) return a < b ? a : b;
+    if (op == REDUCE_MAX) return a > b ? a : b;
+    return a + b;
+}
+
+float reduceFBO(struct ReductionChain *chain, shader_prog &reduceShader, struct FBOstruct *in, ReduceOp op) {
+    glUseProgram(reduceShader);
+    reduceShader.uniform1i("operation", op);
+    reduceShader.uniform1i("factor", chain->factor);
+
+    struct FBOstruct *src = in;
+    int width = chain->width, height = chain->height;
+    for (int i = 0; i < chain->levels; i++) {
+        struct FBOstruct *dst = chain->fbos[i];
+        reduceShader.uniform1i("inputWidth", width);
+        reduceShader.uniform1i("inputHeight", height);
+        useFBO(src, dst);
+        drawQuad(dst->width, dst->height);
+        src = dst;
+        width = dst->width;
+        height = dst->height;
+    }
+
+    // Only a single texel comes back
+    float texel[4];
+    readFBO(src, 0, texel);
+    return combine(combine(texel[0], texel[1], op), combine(texel[2], texel[3], op), op);
+}
+
+// Reduce a part of the array, accumulating sums in double
+static void reduceRange(const float *data, long begin, long end, ReduceOp op, double *result) {
+    double acc = op == REDUCE_SUM ? 0 : data[begin];
+    for (long i = begin; i < end; i++) {
+        acc = combine(acc, data[i], op);
+    }
+    *result = acc;
+}
+
+float reduceCPU(const float *data, long size, ReduceOp op, int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > size) threads = size;
+    std::vector<double> partial(threads);
+    std::vector<std::thread> workers;
+
+    // Every thread gets a non-empty range, as there are at most size threads
+    for (int t = 0; t < threads; t++) {
+        long begin = size * t / threads;
+        long end = size * (t + 1) / threads;
+        workers.push_back(std::thread(reduceRange, data, begin, end, op, &partial[t]));
+    }
+
+    double result = 0;
+    for (int t = 0; t < threads; t++) {
+        workers[t].join();
+        result = t == 0 ? partial[0] : combine(result, partial[t], op);
+    }
+    return result;
+}
@@ -0,0 +1,39 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Parallel reduction (sum, min, max) with a sequence of FBO passes.
+ *
+ * Like building a mipmap: every pass renders into a texture factor times smaller in
+ * each direction, and every fragment combines a factor x factor block of the previous
+ * level. After log_factor(max(width, height)) passes a single texel is left, and only that
+ * texel is read back. Blocks sticking out of a non-power-of-two texture are simply cut.
+ */
+#ifndef REDUCE_UTIL_H
+#define REDUCE_UTIL_H
+
+#include "fbo_util.h"
+#include "shader_util.h"
+
+#define REDUCE_MAX_LEVELS 32
+
+enum ReduceOp { REDUCE_SUM = 0, REDUCE_MIN = 1, REDUCE_MAX = 2 };
+
+// The chain of ever smaller FBOs the passes render into
+typedef struct ReductionChain {
+    int width, height;                          // Size of the input
+    int factor;                                 // Each pass shrinks a side this many times (2 or 4)
+    int levels;                                 // Number of passes
+    struct FBOstruct *fbos[REDUCE_MAX_LEVELS];  // Output of every pass, the last one is 1 x 1
+} ReductionChain;
+
+// Allocate the FBOs for reducing a width x height RGBA texture
+struct ReductionChain *initReduction(int width, int height, int factor);
+void freeReduction(struct ReductionChain *chain);
+
+// Reduce all four channels of all texels of the input FBO into a single number.
+// reduceShader is fbo_reduce.frag.glsl, compiled with use() beforehand.
+float reduceFBO(struct ReductionChain *chain, shader_prog &reduceShader, struct FBOstruct *in, ReduceOp op);
+
+// The same on the CPU with the given number of threads
+float reduceCPU(const float *data, long size, ReduceOp op, int threads);
+
+#endif
@@ -0,0 +1,18 @@
+#version 130
+// Fragment shader: 1 for the elements to keep, 0 for the rest and for the padding
+
+uniform sampler2D texUnit;
+uniform int width;          // Texture width, element i is texel (i % width, i / width)
+uniform int count;          // Number of elements
+uniform float threshold;    // Keep the elements greater than this...
+uniform int bit;            // ...or, when bit >= 0, the integer keys with this bit cleared
+
+void main(void)
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    int i = texel.y * width + texel.x;
+    float value = texelFetch(texUnit, texel, 0).r;
+
+    bool keep = bit >= 0 ? ((int(value) >> bit) & 1) == 0 : value > threshold;
+    gl_FragColor = vec4(i < count && keep ? 1.0 : 0.0);
+}
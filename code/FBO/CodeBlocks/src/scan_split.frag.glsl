@@ -0,0 +1,49 @@
+#version 130
+// Fragment shader: stable split by a flag. Output element k is the (k + 1)-th flagged
+// element, found by binary search in the inclusive scan of the flags. When keepRest is set
+// the elements without the flag follow in their original order, otherwise the tail is zero.
+
+uniform sampler2D values;   // Elements
+uniform sampler2D scan;     // Inclusive prefix sum of the flags
+uniform int width;          // Texture width, element i is texel (i % width, i / width)
+uniform int count;          // Number of elements
+uniform int keepRest;
+
+float fetch(sampler2D s, int i)
+{
+    return texelFetch(s, ivec2(i % width, i / width), 0).r;
+}
+
+// Number of flagged (or, with flagged == false, not flagged) elements among 0..i
+int rank(int i, bool flagged)
+{
+    int total = int(fetch(scan, i) + 0.5);
+    return flagged ? total : i + 1 - total;
+}
+
+// First position whose rank reaches k + 1
+int find(int k, bool flagged)
+{
+    int lo = 0, hi = count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (rank(mid, flagged) >= k + 1) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+void main(void)
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    int k = texel.y * width + texel.x;
+    int flaggedTotal = rank(count - 1, true);
+
+    float result = 0.0;
+    if (k < flaggedTotal) {
+        result = fetch(values, find(k, true));
+    } else if (keepRest == 1 && k < count) {
+        result = fetch(values, find(k - flaggedTotal, false));
+    }
+    gl_FragColor = vec4(result);
+}
@@ -0,0 +1,19 @@
+#version 130
+// Fragment shader: one Hillis-Steele scan step, adds the element offset positions back
+
+uniform sampler2D texUnit;
+uniform int width;          // Texture width, element i is texel (i % width, i / width)
+uniform int offset;         // 1, 2, 4, ...
+
+void main(void)
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    int i = texel.y * width + texel.x;
+
+    float sum = texelFetch(texUnit, texel, 0).r;
+    if (i >= offset) {
+        int j = i - offset;
+        sum += texelFetch(texUnit, ivec2(j % width, j / width), 0).r;
+    }
+    gl_FragColor = vec4(sum);
+}
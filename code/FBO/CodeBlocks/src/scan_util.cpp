@@ -0,0 +1,177 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Parallel prefix sum (scan), stream compaction and radix sort with FBO passes.
+ */
+#include "scan_util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <vector>
+
+static shader_prog *scanKernel(const char *fragmentShader) {
+    shader_prog *shader = new shader_prog("../src/fbo.vert.glsl", fragmentShader);
+    shader->prepend(GL_VERTEX_SHADER, "#version 130\n");
+    shader->use();
+    return shader;
+}
+
+struct ScanKernels *initScanKernels() {
+    struct ScanKernels *kernels = (struct ScanKernels *)malloc(sizeof(struct ScanKernels));
+    kernels->scan = scanKernel("../src/scan_step.frag.glsl");
+    kernels->flag = scanKernel("../src/scan_flag.frag.glsl");
+    kernels->split = scanKernel("../src/scan_split.frag.glsl");
+    kernels->split->uniform1i("values", 0);
+    kernels->split->uniform1i("scan", 1);
+    glUseProgram(0);
+    return kernels;
+}
+
+void freeScanKernels(struct ScanKernels *kernels) {
+    shader_prog *shaders[3] = {kernels->scan, kernels->flag, kernels->split};
+    for (int i = 0; i < 3; i++) {
+        shaders[i]->free();
+        delete shaders[i];
+    }
+    free(kernels);
+}
+
+int scanWidth(int count) {
+    return count < SCAN_MAX_WIDTH ? count : SCAN_MAX_WIDTH;
+}
+
+int scanHeight(int count) {
+    return (count + SCAN_MAX_WIDTH - 1) / SCAN_MAX_WIDTH;
+}
+
+// One pass over the whole array
+static void scanPass(struct FBOstruct **in, int inputs, struct FBOstruct *out) {
+    useFBOs(in, inputs, out);
+    drawQuad(out->width, out->height);
+}
+
+struct FBOstruct *scanFBO(struct ScanKernels *kernels, fbo_pool &pool, struct FBOstruct *in, int count) {
+    if (count > SCAN_MAX_ELEMENTS) {
+        throw std::runtime_error("Too many elements to scan in single precision");
+    }
+    int width = scanWidth(count), height = scanHeight(count);
+
+    glUseProgram(*kernels->scan);
+    kernels->scan->uniform1i("width", width);
+
+    // Ping-pong between two pool FBOs; the input itself is left untouched
+    struct FBOstruct *src = in, *dst = NULL, *spare = NULL;
+    for (int offset = 1; offset < count; offset *= 2) {
+        dst = spare != NULL ? spare : pool.acquire(width, height, GL_R32F);
+        kernels->scan->uniform1i("offset", offset);
+        scanPass(&src, 1, dst);
+        spare = src == in ? NULL : src;
+        src = dst;
+    }
+    if (spare != NULL) pool.release(spare);
+
+    // A single element is its own prefix sum
+    if (src == in) {
+        dst = pool.acquire(width, height, GL_R32F);
+        kernels->scan->uniform1i("offset", count);
+        scanPass(&src, 1, dst);
+        src = dst;
+    }
+    return src;
+}
+
+// Flags (1 or 0) of the first count elements: value > threshold, or bit of the key cleared when bit >= 0
+static struct FBOstruct *flagFBO(struct ScanKernels *kernels, fbo_pool &pool, struct FBOstruct *in, int count,
+                                 float threshold, int bit) {
+    struct FBOstruct *flags = pool.acquire(scanWidth(count), scanHeight(count), GL_R32F);
+    glUseProgram(*kernels->flag);
+    kernels->flag->uniform1i("width", flags->width);
+    kernels->flag->uniform1i("count", count);
+    kernels->flag->uniform1f("threshold", threshold);
+    kernels->flag->uniform1i("bit", bit);
+    scanPass(&in, 1, flags);
+    return flags;
+}
+
+// Gather the flagged elements to the front, and the rest after them when keepRest is set
+static struct FBOstruct *splitFBO(struct ScanKernels *kernels, fbo_pool &pool, struct FBOstruct *in,
+                                  struct FBOstruct *scan, int count, bool keepRest) {
+    struct FBOstruct *out = pool.acquire(scanWidth(count), scanHeight(count), GL_R32F);
+    struct FBOstruct *inputs[2] = {in, scan};
+    glUseProgram(*kernels->split);
+    kernels->split->uniform1i("width", out->width);
+    kernels->split->uniform1i("count", count);
+    kernels->split->uniform1i("keepRest", keepRest);
+    scanPass(inputs, 2, out);
+    return out;
+}
+
+struct FBOstruct *compactFBO(struct ScanKernels *kernels, fbo_pool &pool, struct FBOstruct *in, int count,
+                             float threshold, int *kept) {
+    struct FBOstruct *flags = flagFBO(kernels, pool, in, count, threshold, -1);
+    struct FBOstruct *scan = scanFBO(kernels, pool, flags, count);
+    struct FBOstruct *out = splitFBO(kernels, pool, in, scan, count, false);
+
+    // The last element of the scan is the number of kept elements
+    if (kept != NULL) {
+        float total;
+        int last = count - 1;
+        glBindFramebuffer(GL_FRAMEBUFFER, scan->fb);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(last % scan->width, last / scan->width, 1, 1, GL_RED, GL_FLOAT, &total);
+        *kept = (int)total;
+    }
+
+    pool.release(flags);
+    pool.release(scan);
+    return out;
+}
+
+struct FBOstruct *radixSortFBO(struct ScanKernels *kernels, fbo_pool &pool, struct FBOstruct *in, int count, int bits) {
+    if (bits < 1) {
+        throw std::runtime_error("Radix sort needs at least one bit");
+    }
+
+    struct FBOstruct *keys = in;
+    for (int bit = 0; bit < bits; bit++) {
+        struct FBOstruct *flags = flagFBO(kernels, pool, keys, count, 0, bit);
+        struct FBOstruct *scan = scanFBO(kernels, pool, flags, count);
+        struct FBOstruct *sorted = splitFBO(kernels, pool, keys, scan, count, true);
+        pool.release(flags);
+        pool.release(scan);
+        if (keys != in) pool.release(keys);
+        keys = sorted;
+    }
+    return keys;
+}
+
+// ------------------- CPU versions ------------------ //
+void scanCPU(const float *in, float *out, int count) {
+    float sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += in[i];
+        out[i] = sum;
+    }
+}
+
+int compactCPU(const float *in, float *out, int count, float threshold) {
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (in[i] > threshold) out[kept++] = in[i];
+    }
+    return kept;
+}
+
+void radixSortCPU(const float *in, float *out, int count, int bits) {
+    // Eight bits per round with counting sort
+    std::vector<unsigned> keys(count), tmp(count);
+    for (int i = 0; i < count; i++) keys[i] = (unsigned)in[i];
+
+    for (int shift = 0; shift < bits; shift += 8) {
+        int histogram[257] = {0};
+        for (int i = 0; i < count; i++) histogram[((keys[i] >> shift) & 0xff) + 1]++;
+        for (int d = 0; d < 256; d++) histogram[d + 1] += histogram[d];
+        for (int i = 0; i < count; i++) tmp[histogram[(keys[i] >> shift) & 0xff]++] = keys[i];
+        keys.swap(tmp);
+    }
+    for (int i = 0; i < count; i++) out[i] = (float)keys[i];
+}
@@ -0,0 +1,55 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Parallel prefix sum (scan), stream compaction and radix sort with FBO passes.
+ *
+ * The array is stored one element per texel in an R32F texture, row after row
+ * (element i is texel (i % width, i / width)).
+ *  - scan: Hillis-Steele, log2(N) passes; pass k adds the element 2^k positions back
+ *  - compaction: flag the elements to keep, scan the flags; the scan of the flags tells
+ *    every kept element its output position. A fragment shader cannot scatter, so every
+ *    output texel k gathers instead: it binary searches the scan for the first position
+ *    where it reaches k + 1
+ *  - radix sort: one bit per round; the elements with the bit cleared go first (compaction
+ *    of the flags), the others after them (compaction of the complement), keeping the order
+ *
+ * Counts are kept in floats, which are exact up to 2^24 = 16M elements.
+ * Temporary FBOs come from an fbo_pool, results are pool FBOs the caller has to release.
+ */
+#ifndef SCAN_UTIL_H
+#define SCAN_UTIL_H
+
+#include "fbo_util.h"
+#include "fbo_pool.h"
+#include "shader_util.h"
+
+#define SCAN_MAX_WIDTH 4096
+#define SCAN_MAX_ELEMENTS (1 << 24)
+
+typedef struct ScanKernels {
+    shader_prog *scan, *flag, *split;
+} ScanKernels;
+
+struct ScanKernels *initScanKernels();
+void freeScanKernels(struct ScanKernels *kernels);
+
+// Size of the R32F texture holding count elements
+int scanWidth(int count);
+int scanHeight(int count);
+
+// Inclusive prefix sum of the first count elements
+struct FBOstruct *scanFBO(struct ScanKernels *kernels, fbo_pool &pool, struct FBOstruct *in, int count);
+
+// Elements greater than threshold moved to the front in their original order.
+// kept receives their number (read back from a single texel), may be NULL.
+struct FBOstruct *compactFBO(struct ScanKernels *kernels, fbo_pool &pool, struct FBOstruct *in, int count,
+                             float threshold, int *kept);
+
+// Stable sort of integer keys in [0, 2^bits) stored as floats, bits >= 1
+struct FBOstruct *radixSortFBO(struct ScanKernels *kernels, fbo_pool &pool, struct FBOstruct *in, int count, int bits);
+
+// CPU references
+void scanCPU(const float *in, float *out, int count);
+int compactCPU(const float *in, float *out, int count, float threshold);
+void radixSortCPU(const float *in, float *out, int count, int bits);
+
+#endif
@@ -2,27 +2,138 @@
  * MTAT.03.015 Computer Graphics.
  * Shader configuration utility routines.
  */
+#ifndef SHADER_UTIL_H
+#define SHADER_UTIL_H
+
 #include <string>
+#include <vector>
+#include <unordered_map>
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 
+// Reads file contents into a string, throws std::runtime_error if it cannot be read
+std::string get_file_contents(const char *filename);
+
+/**
+ * On-disk cache of linked programs (ARB_get_program_binary, core in OpenGL 4.1), off by default.
+ * With a cache directory set, use() first looks for a binary saved from the same sources by
+ * the same driver (vendor, renderer and version) and only compiles from source when there is
+ * none, or when the driver rejects it, saving the new binary for the next start.
+ * The directory is created if needed. NULL turns the cache off.
+ */
+void set_program_cache(const char *directory);
+
+// Programs loaded from the cache, compiled because there was no matching binary,
+// and compiled because the driver refused the binary
+typedef struct program_cache_stats {
+    int hits, misses, rejected;
+} program_cache_stats;
+
+program_cache_stats get_program_cache_stats();
+
+// GL_KHR_parallel_shader_compile or GL_ARB_parallel_shader_compile, with which the driver compiles
+// on its own threads and tells when a program is done (GL_COMPLETION_STATUS_KHR).
+// The first call also asks for as many compiler threads as the driver allows.
+bool parallel_shader_compile_supported();
+
 /**
  * Modified version of code from:
  *  http://stackoverflow.com/questions/2795044/easy-framework-for-opengl-shaders-in-c-c
  */
 class shader_prog {
 private:
-    GLuint vertex_shader, fragment_shader, prog;
-    std::string v_source, f_source;
+    GLuint vertex_shader, fragment_shader, compute_shader, prog;
+    std::string v_source, f_source, c_source;
+    std::string binary_key();
+    std::string binary_file;    // Cache file the linked program is saved to
+    bool linking;               // Started by use_async(), not yet checked
+    void finish_link();
+
+    // Location and last uploaded value of every uniform, so that the setters below
+    // neither look the name up in OpenGL nor upload a value the program already has
+    struct uniform_info {
+        GLint location;
+        bool cached;                // False for arrays, whose elements have locations of their own
+        std::vector<char> value;    // Empty before the first upload
+    };
+    std::vector<uniform_info> uniforms;
+    std::unordered_map<std::string, int> uniform_names;    // Index into uniforms, aliases share one entry
+    void introspect();
+    uniform_info &find_uniform(const char *name);
 public:
     shader_prog(const char* vertex_shader_filename, const char* fragment_shader_filename);
+
+    // Compute shader program (OpenGL 4.3), consists of a single GL_COMPUTE_SHADER stage
+    explicit shader_prog(const char* compute_shader_filename);
+
+    // Insert code (e.g. "#define FOO 1\n") right after the #version line of the
+    // GL_VERTEX_SHADER, GL_FRAGMENT_SHADER or GL_COMPUTE_SHADER source. Takes effect on the next use().
+    void prepend(GLuint type, const std::string &code);
     void use();
+
+    /**
+     * Asynchronous use(): submits the compiles and the link and returns without waiting for them
+     * or binding the program, so that many programs can be queued at once and built in parallel.
+     * ready() then polls GL_COMPLETION_STATUS_KHR; once it returns true the program is checked
+     * and can be bound with glUseProgram. Errors are thrown by ready() as by use().
+     * Without parallel compile ready() always returns true, waiting for the driver if needed.
+     */
+    void use_async();
+    bool ready();
     void free();
     operator GLuint();
 
-    // Shorthands for glUniform specification
+    // File of the cached binary of the current sources, empty when the cache is off
+    std::string cache_file();
+
+    // Shorthands for glUniform specification. The locations are read once after linking
+    // (glGetActiveUniform), and a call with the value set last time does nothing (arrays of more
+    // than one element and their elements are always uploaded), so values must not be changed by
+    // glUniform calls behind the program's back.
+    // Throw std::runtime_error for a name the program does not use.
+    void uniform1i(const char* name, int i);
+    void uniform1f(const char* name, float f);
+    void uniform3f(const char* name, float x, float y, float z);
+    void uniform4fv(const char* name, int count, const float* values);
+    void uniformMatrix3fv(const char* name, const float* matrix);
+    void uniformMatrix4fv(const char* name, const float* matrix);
+
+    // Read the named uniform block from the buffer bound to the binding point
+    // (glBindBufferBase(GL_UNIFORM_BUFFER, binding, ...)), throws std::runtime_error if there is no such block
+    void bind_uniform_block(const char* name, GLuint binding);
+};
+
+/**
+ * A std140 uniform block kept on the CPU and uploaded with a single glBufferSubData, e.g. all
+ * the uniforms of a frame. The offsets and strides of the members are read from a linked
+ * program using the block (glGetActiveUniformBlockiv, glGetActiveUniformsiv), so the CPU side
+ * needs no struct mirroring the layout. The setters take the same arguments as shader_prog's.
+ */
+class uniform_block {
+private:
+    struct member_info {
+        GLint offset, array_stride, matrix_stride;
+    };
+    std::unordered_map<std::string, member_info> members;
+    std::vector<char> data;
+    GLuint buffer, binding;
+    bool changed;               // Set since the last upload
+    void write(const char* name, int element, int column, const void* value, int bytes);
+public:
+    // Layout of the named block in the program; also binds the block to the binding point
+    uniform_block(shader_prog &program, const char* name, GLuint binding);
+    void free();
+    int size();
+
     void uniform1i(const char* name, int i);
     void uniform1f(const char* name, float f);
     void uniform3f(const char* name, float x, float y, float z);
+    void uniform4fv(const char* name, int count, const float* values);
+    void uniformMatrix3fv(const char* name, const float* matrix);
     void uniformMatrix4fv(const char* name, const float* matrix);
+
+    // Write the block into its buffer if anything changed, and bind the buffer to the binding point
+    void upload();
 };
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * MTAT.03.296 Computer Graphics Seminar.
+ * Measuring how long the GPU actually works.
+ */
+#include "timer_util.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+
+double wallClockMs() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct GPUtimer *initGPUTimer(int capacity) {
+    struct GPUtimer *timer = (struct GPUtimer *)malloc(sizeof(struct GPUtimer));
+    timer->capacity = capacity;
+    timer->count = 0;
+    timer->supported = GLEW_ARB_timer_query || GLEW_VERSION_3_3;
+    timer->queries = (GLuint *)malloc(capacity * sizeof(GLuint));
+    if (timer->supported) {
+        glGenQueries(capacity, timer->queries);
+        glGenQueries(2, timer->stamps);
+    }
+    return timer;
+}
+
+void freeGPUTimer(struct GPUtimer *timer) {
+    if (timer->supported) {
+        glDeleteQueries(timer->capacity, timer->queries);
+        glDeleteQueries(2, timer->stamps);
+    }
+    free(timer->queries);
+    free(timer);
+}
+
+void startGPUTimer(struct GPUtimer *timer) {
+    timer->count = 0;
+    if (timer->supported) glQueryCounter(timer->stamps[0], GL_TIMESTAMP);
+}
+
+void stopGPUTimer(struct GPUtimer *timer) {
+    if (timer->supported) glQueryCounter(timer->stamps[1], GL_TIMESTAMP);
+}
+
+void beginGPUPass(struct GPUtimer *timer) {
+    if (timer->supported && timer->count < timer->capacity) {
+        glBeginQuery(GL_TIME_ELAPSED, timer->queries[timer->count]);
+    }
+}
+
+void endGPUPass(struct GPUtimer *timer) {
+    if (timer->supported && timer->count < timer->capacity) {
+        glEndQuery(GL_TIME_ELAPSED);
+        timer->count++;
+    }
+}
+
+TimingStats timingStats(double *samples, int count) {
+    TimingStats stats = {count, 0, 0, 0, 0, 0, 0};
+    if (count == 0) return stats;
+
+    std::sort(samples, samples + count);
+    for (int i = 0; i < count; i++) stats.total += samples[i];
+    stats.min = samples[0];
+    stats.median = samples[count / 2];
+    stats.p95 = samples[std::min(count - 1, (int)(count * 0.95))];
+    stats.p99 = samples[std::min(count - 1, (int)(count * 0.99))];
+    stats.mean = stats.total / count;
+    return stats;
+}
+
+void gpuPassTimes(struct GPUtimer *timer, double *ms) {
+    GLuint64 elapsed;
+
+    // Reading a result waits until the GPU gets to the query
+    for (int i = 0; i < timer->count; i++) {
+        glGetQueryObjectui64v(timer->queries[i], GL_QUERY_RESULT, &elapsed);
+        ms[i] = elapsed / 1.0e6;
+    }
+}
+
+TimingStats gpuTimerStats(struct GPUtimer *timer, double *gpuSpanMs) {
+    double *samples = (double *)malloc((timer->count + 1) * sizeof(double));
+    gpuPassTimes(timer, samples);
+
+    if (gpuSpanMs != NULL) {
+        *gpuSpanMs = 0;
+        if (timer->supported) {
+            GLuint64 start, end;
+            glGetQueryObjectui64v(timer->stamps[0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(timer->stamps[1], GL_QUERY_RESULT, &end);
+            *gpuSpanMs = (end - start) / 1.0e6;
+        }
+    }
+
+    TimingStats stats = timingStats(samples, timer->count);
+    free(samples);
+    return stats;
+}
+
+void printStatsJSON(FILE *out, TimingStats stats) {
+    fprintf(out, "{\"samples\": %d, \"min\": %.6f, \"median\": %.6f, \"p95\": %.6f, \"p99\": %.6f, \"mean\": %.6f, \"total\": %.6f}",
+            stats.samples, stats.min, stats.median, stats.p95, stats.p99, stats.mean, stats.total);
+}
+
+void printTimingJSON(FILE *out, const char *name, TimingStats gpuPass, double gpuSpanMs,
+                     double submitMs, double wallMs, double cpuMs) {
+    fprintf(out, "{\"benchmark\": \"%s\", \"gpu_pass_ms\": ", name);
+    printStatsJSON(out, gpuPass);
+    fprintf(out, ", \"gpu_timestamp_span_ms\": %.6f, \"submit_ms\": %.6f, \"wall_ms\": %.6f, \"cpu_ms\": %.6f}\n",
+            gpuSpanMs, submitMs, wallMs, cpuMs);
+}